@@ -93,13 +93,41 @@ document.addEventListener("DOMContentLoaded", function () {
     // Fetch data initially when the page loads and update UI
     fetchRelays().then(updateUI);
 
-    // Function to continuously update relay data
-    function updateRelayData() {
+    // Apply a change pushed by the server to the already rendered relay
+    function updateRelay(relay) {
+        const switchName = document.getElementById(`relaySwitchName${relay.id}`);
+        const switchElement = document.getElementById(`relaySwitch${relay.id}`);
+        if (!switchName || !switchElement) {
+            // New relay, render the whole list again
+            fetchRelays().then(updateUI);
+            return;
+        }
+        switchName.textContent = relay.name;
+        switchElement.checked = relay.state === true;
+    }
+
+    // Live updates from the server, fall back to polling without EventSource support
+    if (!window.EventSource) {
         setInterval(() => {
             fetchRelays().then(updateUI);
         }, 1000);
+        return;
     }
 
-    // Call the function to start data updating
-    updateRelayData();
+    const events = new EventSource("/api/events");
+    // Changes may have been missed while disconnected
+    events.addEventListener("open", () => fetchRelays().then(updateUI));
+    events.addEventListener("resync", () => fetchRelays().then(updateUI));
+    events.addEventListener("relay", event => updateRelay(JSON.parse(event.data)));
+    events.addEventListener("relay-removed", event => {
+        const relayControl = document.getElementById(`relay-control${JSON.parse(event.data).id}`);
+        if (relayControl) {
+            relayControl.remove();
+        }
+    });
+    events.addEventListener("settings", event => {
+        const systemName = JSON.parse(event.data).systemName;
+        document.getElementById("title").textContent = systemName;
+        document.title = systemName;
+    });
 });
@@ -208,40 +208,40 @@ document.addEventListener("DOMContentLoaded", function () {
 
         fetch(`/api/relay-alarms?relayId=${relay.id}`)
             .then(response => response.json())
-            .then(alarmRulesob => {
-                let alarmRules = alarmRulesob.alarms;
-
-                // Clear existing rules before updating
-                while (relayDiv.firstChild) {
-                    relayDiv.removeChild(relayDiv.firstChild);
-                }
+            .then(alarmRulesob => renderRelayAlarmRules(relay, relayDiv, alarmRulesob.alarms));
+    }
 
-                const rulesHeading = document.createElement('h3');
-                rulesHeading.id = `relay-${relay.id}-rules-heading`;
-                rulesHeading.textContent = `Rules: ${relay.name}`;
-                relayDiv.appendChild(rulesHeading);
-
-                alarmRules.forEach((rule) => {
-                    const ruleId = rule.id;
-                    let ruleElement = createRuleElement(relay.id, rule, ruleId, "delete");
-                    relayDiv.appendChild(ruleElement);
-
-                    // Attach event listeners properly
-                    document.getElementById(`relay-${relay.id}-select-${ruleId}`).addEventListener('change', () => updateRelayRule(relay.id, ruleId));
-                    document.getElementById(`relay-${relay.id}-time-${ruleId}-hour`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
-                    document.getElementById(`relay-${relay.id}-time-${ruleId}-minute`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
-                    document.getElementById(`relay-${relay.id}-time-${ruleId}-second`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
-
-                    const days = ["sun", "mon", "tue", "wed", "thu", "fri", "sat"];
-                    days.forEach(day => {
-                        document.getElementById(`relay-${relay.id}-${day}-${ruleId}`).addEventListener('change', () => updateRelayRule(relay.id, ruleId));
-                    });
-                });
+    function renderRelayAlarmRules(relay, relayDiv, alarmRules) {
+        // Clear existing rules before updating
+        while (relayDiv.firstChild) {
+            relayDiv.removeChild(relayDiv.firstChild);
+        }
 
-                // Ensure the "Add" button is always at the bottom
-                const newRuleElement = createRuleElement(relay.id, { state: true, hour: 0, minute: 0, second: 0, weekdays: [false, false, false, false, false, false, false] }, alarmRules.length + 1, "add");
-                relayDiv.appendChild(newRuleElement);
+        const rulesHeading = document.createElement('h3');
+        rulesHeading.id = `relay-${relay.id}-rules-heading`;
+        rulesHeading.textContent = `Rules: ${relay.name}`;
+        relayDiv.appendChild(rulesHeading);
+
+        alarmRules.forEach((rule) => {
+            const ruleId = rule.id;
+            let ruleElement = createRuleElement(relay.id, rule, ruleId, "delete");
+            relayDiv.appendChild(ruleElement);
+
+            // Attach event listeners properly
+            document.getElementById(`relay-${relay.id}-select-${ruleId}`).addEventListener('change', () => updateRelayRule(relay.id, ruleId));
+            document.getElementById(`relay-${relay.id}-time-${ruleId}-hour`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
+            document.getElementById(`relay-${relay.id}-time-${ruleId}-minute`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
+            document.getElementById(`relay-${relay.id}-time-${ruleId}-second`).addEventListener('input', () => updateRelayRule(relay.id, ruleId));
+
+            const days = ["sun", "mon", "tue", "wed", "thu", "fri", "sat"];
+            days.forEach(day => {
+                document.getElementById(`relay-${relay.id}-${day}-${ruleId}`).addEventListener('change', () => updateRelayRule(relay.id, ruleId));
             });
+        });
+
+        // Ensure the "Add" button is always at the bottom
+        const newRuleElement = createRuleElement(relay.id, { state: true, hour: 0, minute: 0, second: 0, weekdays: [false, false, false, false, false, false, false] }, alarmRules.length + 1, "add");
+        relayDiv.appendChild(newRuleElement);
     }
 
     function updateRelayRule(relayID, ruleID) {
@@ -330,7 +330,12 @@ document.addEventListener("DOMContentLoaded", function () {
 
             relayAlarmRulesDiv.appendChild(relayMainDiv);
 
-            updateRelayAlarmRules(relay, relayDiv);
+            // The dashboard already contains the alarms
+            if (relay.alarms) {
+                renderRelayAlarmRules(relay, relayDiv, relay.alarms);
+            } else {
+                updateRelayAlarmRules(relay, relayDiv);
+            }
         });
     }
 
@@ -345,32 +350,29 @@ document.addEventListener("DOMContentLoaded", function () {
 
     // Load settings on page load
     Relays = [];
-    fetch("/api/settings")
-        .then(response => response.json())
-        .then(data => {
-            document.getElementById("system-name").value = data.systemName;
-            document.getElementById("title").textContent = data.systemName;
-
-            const relayNamesDiv = document.getElementById('relay-names');
-            if (!relayNamesDiv) {
-                console.error('relay-names div not found');
-                return;
-            }
+    function showSettings(data) {
+        document.getElementById("system-name").value = data.systemName;
+        document.getElementById("title").textContent = data.systemName;
 
-            Relays = data.relays;
+        const relayNamesDiv = document.getElementById('relay-names');
+        if (!relayNamesDiv) {
+            console.error('relay-names div not found');
+            return;
+        }
 
-            data.relays.forEach(element => {
-                const nameElement = createNameElement(element);
-                relayNamesDiv.appendChild(nameElement);
-            });
-        })
-        .then(() => {
-            Relays.forEach(relay => {
-                document.getElementById(`relay-name-${relay.id}`).addEventListener("input", saveGeneralSettings);
-            });
-            document.getElementById("system-name").addEventListener("input", saveGeneralSettings);
+        Relays = data.relays;
+
+        data.relays.forEach(element => {
+            const nameElement = createNameElement(element);
+            relayNamesDiv.appendChild(nameElement);
         });
 
+        Relays.forEach(relay => {
+            document.getElementById(`relay-name-${relay.id}`).addEventListener("input", saveGeneralSettings);
+        });
+        document.getElementById("system-name").addEventListener("input", saveGeneralSettings);
+    }
+
     // Save settings
     function saveGeneralSettings() {
         let systemName = document.getElementById("system-name").value;
@@ -406,31 +408,52 @@ document.addEventListener("DOMContentLoaded", function () {
             });
     }
 
-    // Fetch and load the HTML template, then fetch relays and update the relay-alarm-rules section
-    loadTemplate()
-        .then(() => {
-            fetch('/api/all-relays')
-                .then(response => response.json())
-                .then(relaysob => {
-                    updateAllRelayAlarmRules(relaysob.relays);
-                })
-                .catch(error => console.error('Error fetching relays:', error));
-        })
-        .catch(error => console.error('Error loading template:', error));
+    // Show alarm changes made by other clients or the device. A relay that is
+    // being edited here is left alone so the input under the cursor stays.
+    // Events of one change arrive together, so they are collected briefly
+    const pendingRefresh = {};
+    function refreshRelayAlarms(relayId) {
+        clearTimeout(pendingRefresh[relayId]);
+        pendingRefresh[relayId] = setTimeout(() => {
+            const relayDiv = document.getElementById(`relay-${relayId}-form`);
+            const relay = Relays.find(relay => relay.id === relayId);
+            if (!relayDiv || !relay || relayDiv.contains(document.activeElement)) {
+                return;
+            }
+            updateRelayAlarmRules(relay, relayDiv);
+        }, 100);
+    }
 
+    if (window.EventSource) {
+        const events = new EventSource("/api/events");
+        events.addEventListener("alarm", event => refreshRelayAlarms(JSON.parse(event.data).relayId));
+        events.addEventListener("alarm-removed", event => refreshRelayAlarms(JSON.parse(event.data).relayId));
+        events.addEventListener("resync", () => Relays.forEach(relay => refreshRelayAlarms(relay.id)));
+    }
 
+    // Load the HTML template and everything shown on the page in parallel, the
+    // dashboard contains the settings, the time and all relays with their alarms
+    Promise.all([loadTemplate(), fetch('/api/dashboard').then(response => response.json())])
+        .then(([, dashboard]) => {
+            showSettings(dashboard);
+            showServerTime(dashboard.time);
+            updateAllRelayAlarmRules(dashboard.relays);
+        })
+        .catch(error => console.error('Error loading settings:', error));
 
     // Time
     // Function to update the time every second
+    function showServerTime(data) {
+        document.getElementById('system-time-hour').textContent = data.hour;
+        document.getElementById('system-time-minute').textContent = data.minute;
+        document.getElementById('system-time-second').textContent = data.second;
+        document.getElementById('system-date').value = `${data.year}-${String(data.month).padStart(2, '0')}-${String(data.day).padStart(2, '0')}`;
+    }
+
     function fetchServerTime() {
         fetch('/api/server-time')
             .then(response => response.json())
-            .then(data => {
-                document.getElementById('system-time-hour').textContent = data.hour;
-                document.getElementById('system-time-minute').textContent = data.minute;
-                document.getElementById('system-time-second').textContent = data.second;
-                document.getElementById('system-date').value = `${data.year}-${String(data.month).padStart(2, '0')}-${String(data.day).padStart(2, '0')}`;
-            })
+            .then(showServerTime)
             .catch(error => console.error('Error fetching server time:', error));
     }
 
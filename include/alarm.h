@@ -1,36 +1,37 @@
 #pragma once
 #include "relay.h"
 #include "rtc.h"
+#include "alarmTable.h"
 #include <array>
 #include <cstdint>
 #include <tuple>
-#include <ArduinoJson.h>
 
-// Forward declaration of Relay
+// Forward declarations
 class Relay;
+class JsonWriter;
 
+// Lightweight view of one record in the AlarmTable. Copy it by value; it stays
+// valid until the alarm is removed.
 class Alarm {
     private:
-        static uint idCounter;
-        uint id;
+        uint id = ALARM_FREE_ID;
+        uint16_t slot = ALARM_NO_SLOT;
 
-        DateTime lastAlarm;
+        uint32_t record() const;
+        void update(uint32_t record);
 
-        Relay* relay = nullptr;
-        uint hour = 0;
-        uint minute = 0;
-        uint second = 0;
-        bool state = false;
-        std::array<bool, 7> weekdays = {false, false, false, false, false, false, false}; // Sunday, Monday, Tuesday, Wednesday, Thursday, Friday, Saturday
+    public:
+        Alarm() {};
+        Alarm(uint id, uint16_t slot) : id(id), slot(slot) {};
 
-        DateTime calculateLastAlarm() const;
+        // Create a new alarm in the AlarmTable
+        static Alarm create(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, Relay* relay, bool state, uint id = ALARM_FREE_ID);
 
-    public:
-        Alarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, Relay* relay, bool state);
-        Alarm(String json, Relay *relay);
+        bool isValid() const;
+        uint16_t getSlot() const;
 
         // get methods
-        uint getId();
+        uint getId() const;
         uint getHour() const;
         uint getMinute() const;
         uint getSecond() const;
@@ -49,12 +50,12 @@ class Alarm {
         void setMinute(const uint minute);
         void setSecond(const uint second);
         void setWeekdays(const std::array<bool, 7> weekdays);
-        void setRelay(Relay* relay);
         void setState(bool state);
 
-        bool checkAlarm(DateTime now) const; // This will check if the alarm should be executed now or in the past 24 hours
+        uint32_t getNextAlarmUnixtime(uint32_t now) const; // This will return the unix time of the next execution at or after now
 
         uint getNextAlarminSeconds(DateTime now) const; // This will return seconds from rtc now until this alarm will be executed
 
         String toJson() const;
+        void toJson(JsonWriter& json) const; // Write the alarm as an object
 };
@@ -0,0 +1,177 @@
+#pragma once
+#include "alarm.h"
+#include "alarmTable.h"
+#include "mpscQueue.h"
+#include "relaySnapshot.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Forward declaration of RelayManager
+class RelayManager;
+
+// Late alarms are still executed if they are at most this many seconds overdue
+#define ALARM_LATE_TOLERANCE 60
+
+#define SCHEDULER_TASK_STACK 6144
+#define SCHEDULER_TASK_PRIORITY 2
+#define SCHEDULER_MAX_SLEEP 60000 // in ms, bounds tick drift against the RTC
+#define SCHEDULER_COMMAND_QUEUE 16 // pending commands from other tasks, power of two
+#define SCHEDULER_FIRE_BATCH 16    // alarms fired per table lock, the rest follow right after
+
+// Copy of a fired alarm, logged and handed to the fire listener after the table is unlocked
+struct FiredAlarm
+{
+    uint relayId;
+    uint alarmId;
+    bool state;
+    uint32_t unixtime;
+};
+
+// A change handed to the scheduler task. It lives on the stack of the submitting
+// task, which waits until the scheduler task has executed it.
+struct SchedulerCommand
+{
+    enum Type : uint8_t
+    {
+        SET_RELAY,    // relayId, state
+        ADD_ALARM,    // relayId, state, hour, minute, second, weekdays. Sets alarmId
+        UPDATE_ALARM, // relayId, alarmId, state, hour, minute, second, weekdays
+        DELETE_ALARM, // relayId, alarmId
+        SET_TIME,     // unixtime
+        CALL,         // call, for rare changes without a command of their own
+        BATCH         // batch of ADD_ALARM, UPDATE_ALARM and DELETE_ALARM, applied all or nothing
+    };
+
+    enum Result : uint8_t
+    {
+        OK,
+        RELAY_NOT_FOUND,
+        ALARM_NOT_FOUND,
+        TABLE_FULL,   // the alarm would exceed MAX_ALARMS
+        REJECTED,     // batch not applied because one of its operations failed
+        NOT_EXECUTED  // batch operation skipped because another one failed
+    };
+
+    Type type;
+    uint relayId = 0;
+    uint alarmId = 0;
+    bool state = false;
+    uint8_t hour = 0;
+    uint8_t minute = 0;
+    uint8_t second = 0;
+    std::array<bool, 7> weekdays = {false, false, false, false, false, false, false};
+    uint32_t unixtime = 0;
+    const std::function<void()> *call = nullptr;
+    std::vector<SchedulerCommand> *batch = nullptr; // Each operation gets its own result
+
+    Result result = OK;
+    TaskHandle_t caller = nullptr;
+    std::atomic<bool> *done = nullptr; // Set by the scheduler task before it notifies the caller
+    std::exception_ptr error;
+
+    SchedulerCommand(Type type) : type(type) {}
+};
+
+// Keeps every alarm in a binary min-heap ordered by its next absolute fire time
+// (unix seconds). Insert, remove and reschedule are O(log n), so editing one
+// alarm does not touch the others. Shares the lock of the AlarmTable.
+class AlarmScheduler
+{
+private:
+    struct Entry
+    {
+        uint32_t fireAt;
+        uint16_t slot; // AlarmTable slot
+    };
+
+    std::vector<Entry> heap;
+    std::vector<uint16_t> positions; // AlarmTable slot -> index in heap, ALARM_NO_SLOT if not scheduled
+
+    AlarmTable *table;
+    TaskHandle_t task = nullptr;
+    RelayManager *relays = nullptr;
+    MpscQueue<SchedulerCommand *, SCHEDULER_COMMAND_QUEUE> commands;
+
+    std::shared_ptr<const RelaySnapshot> snapshot; // Only accessed through std::atomic_load/store
+    volatile int64_t lastFireMicros = -1; // esp_timer time of the last fired group
+    void (*fireListener)(const FiredAlarm &alarm) = nullptr;
+
+    // Private constructor
+    AlarmScheduler();
+
+    // Disable copy constructor and assignment operator
+    AlarmScheduler(const AlarmScheduler &) = delete;
+    AlarmScheduler &operator=(const AlarmScheduler &) = delete;
+
+    // Private static instance pointer
+    static AlarmScheduler *instance;
+
+    void place(size_t index, const Entry &entry);
+    void siftUp(size_t index);
+    void siftDown(size_t index);
+    void erase(size_t index);
+
+    void fire(Alarm alarm);
+    void execute(SchedulerCommand &command);
+    void apply(SchedulerCommand &command);
+    void executeBatch(SchedulerCommand &command);
+    SchedulerCommand::Result check(const SchedulerCommand &operation, std::vector<uint> &deleted, size_t &alarms) const;
+    bool runCommands();
+    void publish();
+    static void taskLoop(void *param);
+
+public:
+    // Get the singleton instance
+    static AlarmScheduler *getInstance()
+    {
+        if (instance == nullptr)
+        {
+            instance = new AlarmScheduler();
+        }
+        return instance;
+    }
+
+    // Start the scheduler task. It sleeps until the next alarm is due and is
+    // woken early whenever the schedule or the clock changes.
+    void begin(RelayManager *relays);
+    void wake();
+
+    // Execute a command on the scheduler task, under the table lock, and wait until
+    // it is done. Exceptions are rethrown in the calling task. Task notifications
+    // the caller receives while it waits are given back to it afterwards.
+    SchedulerCommand::Result submit(SchedulerCommand &command);
+    // Submit a CALL command
+    void run(const std::function<void()> &command);
+
+    // Latest published state of all relays and alarms. Never blocks
+    std::shared_ptr<const RelaySnapshot> getSnapshot() const;
+
+    // Insert or reschedule an alarm relative to now (or the given unix time)
+    void schedule(const Alarm &alarm);
+    void schedule(const Alarm &alarm, uint32_t now);
+    void remove(const Alarm &alarm);
+
+    // Recompute every fire time, e.g. after the clock was changed. O(n)
+    void rebuild(uint32_t now);
+
+    // Unix time of the earliest pending alarm or ALARM_NEVER
+    uint32_t peekTime() const;
+
+    // Pop up to capacity alarms that are due at now and move them to their next occurrence.
+    // Only alarms that are at most ALARM_LATE_TOLERANCE seconds overdue are returned.
+    size_t takeDue(uint32_t now, Alarm *due, size_t capacity);
+
+    size_t size() const;
+
+    int64_t getLastFireMicros() const;
+
+    // Called on the scheduler task after each fired alarm, once the table is unlocked.
+    // The listener must not block. Set it before begin()
+    void setFireListener(void (*listener)(const FiredAlarm &alarm));
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <Arduino.h>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Forward declaration of Relay
+class Relay;
+
+// Packed 32 bit alarm record
+//   bits  0-16  second of the day (0 - 86399)
+//   bits 17-23  weekday mask, bit 17 = Sunday ... bit 23 = Saturday
+//   bit  24     state (relay on/off)
+//   bits 25-31  relay index
+#define ALARM_SECOND_MASK 0x1FFFFUL
+#define ALARM_WEEKDAY_SHIFT 17
+#define ALARM_STATE_SHIFT 24
+#define ALARM_RELAY_SHIFT 25
+#define ALARM_MAX_RELAYS 128
+
+#define ALARM_NO_SLOT 0xFFFF
+#define ALARM_FREE_ID 0xFFFFFFFFUL
+
+// Maximum number of alarms, set with -D MAX_ALARMS in platformio.ini. All alarm
+// storage is reserved for this many at boot and never grows afterwards
+#ifndef MAX_ALARMS
+#define MAX_ALARMS 1024
+#endif
+static_assert(MAX_ALARMS < ALARM_NO_SLOT, "MAX_ALARMS must fit into a 16 bit slot");
+
+// Returned by nextFireTime if the alarm has no weekday selected
+#define ALARM_NEVER 0xFFFFFFFFUL
+
+// All alarms of all relays stored contiguously as struct of arrays. A slot keeps
+// its position for the lifetime of an alarm; freed slots are reused. The alarm
+// ids stay stable and are resolved through an index of slots sorted by id.
+class AlarmTable
+{
+private:
+    std::vector<uint32_t> records; // packed record by slot
+    std::vector<uint> ids;         // alarm id by slot, ALARM_FREE_ID if unused
+    std::vector<uint16_t> byId;    // used slots sorted by id
+    std::vector<uint16_t> freeSlots;
+    std::vector<Relay *> relays; // Relay by relay index
+
+    uint idCounter = 0;
+    size_t count = 0;
+
+    SemaphoreHandle_t mutex = nullptr;
+
+    // Private constructor
+    AlarmTable();
+
+    // Disable copy constructor and assignment operator
+    AlarmTable(const AlarmTable &) = delete;
+    AlarmTable &operator=(const AlarmTable &) = delete;
+
+    // Private static instance pointer
+    static AlarmTable *instance;
+
+    size_t lowerBound(uint id) const;
+
+public:
+    // Get the singleton instance
+    static AlarmTable *getInstance()
+    {
+        if (instance == nullptr)
+        {
+            instance = new AlarmTable();
+        }
+        return instance;
+    }
+
+    // Structural changes (add/remove) and readers on other tasks hold this lock
+    void lock();
+    void unlock();
+
+    // Relays register to get the index stored in their alarm records
+    uint8_t registerRelay(Relay *relay);
+    void unregisterRelay(uint8_t index);
+    Relay *getRelay(uint8_t index) const;
+
+    // Add a record. A missing id or one already in use is replaced by a new one. Returns the slot
+    uint16_t add(uint32_t record, uint id = ALARM_FREE_ID);
+    void remove(uint16_t slot);
+
+    // Slot of an alarm id or ALARM_NO_SLOT. O(log n)
+    uint16_t find(uint id) const;
+
+    uint32_t getRecord(uint16_t slot) const { return records[slot]; }
+    void setRecord(uint16_t slot, uint32_t record) { records[slot] = record; }
+    uint getId(uint16_t slot) const { return ids[slot]; }
+    bool isUsed(uint16_t slot) const { return slot < ids.size() && ids[slot] != ALARM_FREE_ID; }
+
+    size_t size() const { return count; }
+    size_t slotCount() const { return records.size(); }
+
+    // Visit the slots of one relay in ascending id order
+    template <typename F>
+    void forEach(uint8_t relayIndex, F visit) const
+    {
+        for (uint16_t slot : byId)
+        {
+            if (relayOf(records[slot]) == relayIndex)
+            {
+                visit(slot);
+            }
+        }
+    }
+
+    // Record helpers
+    static uint32_t pack(uint32_t secondOfDay, uint8_t weekdayMask, bool state, uint8_t relayIndex);
+    static uint32_t secondOf(uint32_t record) { return record & ALARM_SECOND_MASK; }
+    static uint8_t weekdaysOf(uint32_t record) { return (record >> ALARM_WEEKDAY_SHIFT) & 0x7F; }
+    static bool stateOf(uint32_t record) { return (record >> ALARM_STATE_SHIFT) & 1; }
+    static uint8_t relayOf(uint32_t record) { return record >> ALARM_RELAY_SHIFT; }
+
+    static uint8_t weekdayMask(const std::array<bool, 7> &weekdays);
+    static std::array<bool, 7> weekdayArray(uint8_t mask);
+
+    // Unix time of the first execution at or after now, or ALARM_NEVER
+    static uint32_t nextFireTime(uint32_t record, uint32_t now);
+    // Unix time of the last execution before now, or 0
+    static uint32_t lastFireTime(uint32_t record, uint32_t now);
+};
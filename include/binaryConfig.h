@@ -0,0 +1,61 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// Binary config blobs stored in NVS
+//   u16 magic, u8 version, u8 type, payload, u32 CRC32 of all bytes before it
+// Integers are little endian, strings are a u8 length followed by the characters
+#define CONFIG_MAGIC 0x5253
+#define CONFIG_VERSION 1
+#define CONFIG_TYPE_RELAYS 1
+#define CONFIG_TYPE_ALARMS 2
+
+// Relay list: system name, u16 alarm page count, u8 relay count, per relay u32 id, u8 pin, name
+#define CONFIG_RELAYS_KEY "relays"
+// Alarm pages, the key is followed by the page number. Page n holds the alarm table slots
+// n * CONFIG_ALARMS_PER_PAGE and up: u8 count, per alarm u8 slot in page, u32 id, u32 relay id, u32 record
+#define CONFIG_ALARMS_KEY "alarms"
+#define CONFIG_ALARMS_PER_PAGE 32
+
+// The JSON config of older firmware
+#define CONFIG_LEGACY_KEY "config"
+
+class BinaryWriter
+{
+private:
+    std::vector<uint8_t> data;
+
+public:
+    BinaryWriter(uint8_t type);
+
+    void writeU8(uint8_t value);
+    void writeU16(uint16_t value);
+    void writeU32(uint32_t value);
+    void writeString(const String &value); // Truncated to 255 characters
+
+    // Append the CRC and return the blob
+    const std::vector<uint8_t> &finish();
+};
+
+class BinaryReader
+{
+private:
+    const std::vector<uint8_t> &data;
+    size_t position;
+    size_t end;
+    bool valid;
+
+    bool take(size_t length);
+
+public:
+    // Checks magic, version, type and CRC
+    BinaryReader(const std::vector<uint8_t> &data, uint8_t type);
+
+    // False if the header or CRC did not match or a read ran past the payload
+    bool isValid() const;
+
+    uint8_t readU8();
+    uint16_t readU16();
+    uint32_t readU32();
+    String readString();
+};
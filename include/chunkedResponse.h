@@ -0,0 +1,34 @@
+#pragma once
+#include <Arduino.h>
+#include <WebServer.h>
+
+#define CHUNKED_RESPONSE_BUFFER 512
+
+// Response body sent with HTTP chunked transfer encoding while it is written.
+// Output collects in a fixed buffer that goes out as one chunk whenever it is
+// full, so the memory needed does not depend on the size of the body.
+class ChunkedResponse : public Print
+{
+private:
+    WebServer &server;
+    char buffer[CHUNKED_RESPONSE_BUFFER];
+    size_t length = 0;
+    bool ended = false;
+
+    void sendChunk();
+
+public:
+    // Sends the status line and headers
+    ChunkedResponse(WebServer &server, int status = 200, const char *contentType = "application/json");
+    ~ChunkedResponse();
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *data, size_t size) override;
+
+    // Send the rest of the buffer and the terminating chunk
+    void end();
+
+    // Close the connection without ending the body, for errors after the headers went out
+    void abort();
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include "alarmScheduler.h"
+#include "clusterNode.h"
+#include "clusterTransport.h"
+#include "rtc.h"
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <memory>
+#include <vector>
+
+#define CLUSTER_TASK_STACK 4096
+#define CLUSTER_TASK_PRIORITY 3
+#define CLUSTER_POLL 10                // in ms, longest wait for packets
+#define CLUSTER_BEACON_INTERVAL 1000000 // in us
+#define CLUSTER_COMMAND_LEAD 50000     // in us, group commands are applied this long after they are sent
+#define CLUSTER_MAX_GROUPS 8
+
+// Runs this unit as a ClusterNode over multicast. Alarms fire on cluster time: the
+// offset of the master's clock is applied to the RTC, so the alarms of all units
+// fire together. Relay groups are named the same on every unit and each unit lists
+// its own relays in a group; a group command switches them on all units at once.
+//
+// The cluster runs while the wifi is on, it is enabled and the UDP key is set,
+// which also signs the cluster packets.
+class Cluster
+{
+public:
+    struct Group
+    {
+        String name;
+        std::vector<uint> relays;
+    };
+
+    struct Status
+    {
+        bool enabled;
+        bool running;
+        uint32_t nodeId;
+        uint32_t master;
+        bool synced;
+        int64_t offset; // in us, of the cluster time to the DS3231
+        std::vector<ClusterNode::Peer> peers;
+        uint64_t now; // Local time the peers were last seen relative to
+    };
+
+private:
+    AlarmScheduler *scheduler = nullptr;
+    RTC *rtc = nullptr;
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t mutex = nullptr; // Guards everything below
+
+    MulticastTransport transport;
+    std::unique_ptr<ClusterNode> node; // Only while a key is set
+    uint32_t nodeId = 0;
+    bool enabled = false;
+    bool networkUp = false;
+    std::vector<Group> groups;
+    int64_t lastBeacon = 0; // esp_timer time
+
+    // Private constructor
+    Cluster();
+
+    // Disable copy constructor and assignment operator
+    Cluster(const Cluster &) = delete;
+    Cluster &operator=(const Cluster &) = delete;
+
+    // Private static instance pointer
+    static Cluster *instance;
+
+    void lock() const;
+    void unlock() const;
+    void notify();
+    // RTC time without the cluster offset
+    uint64_t localMicros();
+    bool isActive() const;
+    void loadGroups();
+    void apply(const ClusterNode::Command &command);
+    void poll();
+    static void taskLoop(void *param);
+
+public:
+    // Get the singleton instance
+    static Cluster *getInstance()
+    {
+        if (instance == nullptr)
+        {
+            instance = new Cluster();
+        }
+        return instance;
+    }
+
+    // Load the settings and start the task
+    void begin(AlarmScheduler *scheduler, RTC *rtc, uint32_t nodeId);
+
+    void setKey(const uint8_t *key);
+    void setNetwork(bool up);
+
+    void setEnabled(bool enabled);
+    void setGroups(const std::vector<Group> &groups);
+    std::vector<Group> getGroups() const;
+    // Turn the cluster off and remove its stored settings
+    void eraseConfig();
+    // 1 to CLUSTER_GROUP_SIZE - 1 characters, letters, digits, '-' and '_'
+    static bool isValidGroupName(const char *name);
+
+    // Switch the relays of a group on all units. False if the cluster is not running
+    bool sendGroupCommand(const char *group, bool state, uint64_t &at);
+
+    Status getStatus();
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include "clusterTransport.h"
+#include "udpProtocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define CLUSTER_PACKET_SIZE 56
+#define CLUSTER_SIGNED_SIZE 40
+#define CLUSTER_GROUP_SIZE 16 // Group names have at most 15 characters
+
+#define CLUSTER_MAX_PEERS 16            // the longest silent peer is replaced
+#define CLUSTER_PEER_TIMEOUT 5000000    // in us, a unit without packets for this long is gone
+#define CLUSTER_SYNC_SAMPLES 8          // beacons of the master the offset is estimated from
+#define CLUSTER_STEP 100000             // in us, larger corrections are applied at once
+#define CLUSTER_MAX_LEAD 10000000       // in us, commands may be scheduled at most this far ahead
+#define CLUSTER_LATE_TOLERANCE 1000000  // in us, commands this late are still applied
+#define CLUSTER_MAX_PENDING 16          // commands waiting for their time
+#define CLUSTER_COMMAND_REPEATS 3       // copies of each command, against lost packets
+
+// Protocol of a unit in a cluster, without sockets or tasks: it sends through a
+// ClusterTransport and is handed the packets and the time, so several nodes can
+// be simulated in one process.
+//
+// Each unit sends a beacon with its cluster time every second. The unit with the
+// lowest id is the master; the others estimate the offset of their own clock to
+// the master's from its beacons. One-way delays only make a beacon look older, so
+// the largest offset of the last beacons is the best estimate. Group commands
+// carry the cluster time they are applied at, so all units switch together.
+//
+// Packets are signed like UDP control packets. Big endian:
+//
+//   0  u8   magic 0xA6
+//   1  u8   version
+//   2  u8   type
+//   3  u8   state of a command
+//   4  u32  node id of the sender
+//   8  u64  cluster time of the sender in us, increases with every packet
+//  16  u64  cluster time a command is applied at
+//  24  16   group name of a command, zero padded
+//  40  16   first bytes of the HMAC-SHA256 of bytes 0-39 with the shared key
+class ClusterNode
+{
+public:
+    enum Type : uint8_t
+    {
+        BEACON = 1,
+        GROUP_COMMAND = 2
+    };
+
+    struct Command
+    {
+        char group[CLUSTER_GROUP_SIZE];
+        bool state;
+        uint64_t at; // Cluster time in us
+        uint32_t from;
+    };
+
+    struct Peer
+    {
+        uint32_t nodeId;
+        uint64_t lastSent; // Its cluster time of its last packet, older packets are replays
+        uint64_t lastSeen; // Local time
+    };
+
+private:
+    ClusterTransport &transport;
+    uint32_t nodeId;
+    uint8_t key[UDP_KEY_SIZE];
+
+    int64_t offset = 0; // Cluster time minus local time, in us
+    bool synced = false;
+    uint32_t master;
+    int64_t samples[CLUSTER_SYNC_SAMPLES];
+    size_t sampleCount = 0;
+    size_t nextSample = 0;
+    uint64_t lastSent = 0;
+
+    std::vector<Peer> peers;
+    std::vector<Command> pending; // Ordered by time
+
+    Peer *findPeer(uint32_t id, uint64_t local);
+    void updateMaster();
+    void sync(int64_t sample);
+    void queue(const Command &command);
+    void encode(Type type, const Command *command, uint64_t local, uint8_t *out);
+
+public:
+    ClusterNode(ClusterTransport &transport, uint32_t nodeId, const uint8_t *key, int64_t offset = 0);
+
+    // Time is passed in us of the local clock, without the offset
+    uint64_t clusterTime(uint64_t local) const { return local + offset; }
+
+    void sendBeacon(uint64_t local);
+
+    // Send a command to all units and queue it here as well. Returns the cluster time it is applied at
+    uint64_t sendCommand(const char *group, bool state, uint64_t local, uint32_t lead);
+
+    // Read a received packet. Unsigned, replayed and out of time packets are ignored
+    void handle(const uint8_t *data, size_t length, uint64_t local);
+
+    // Forget peers that went silent, another master may take over
+    void expire(uint64_t local);
+
+    // Take the next command that is due
+    bool takeDue(uint64_t local, Command &command);
+    // Cluster time of the next pending command, UINT64_MAX if there is none
+    uint64_t nextDue() const;
+
+    int64_t getOffset() const { return offset; }
+    uint32_t getNodeId() const { return nodeId; }
+    uint32_t getMaster() const { return master; }
+    bool isMaster() const { return master == nodeId; }
+    // True if this node follows a master, or is the master
+    bool isSynced() const { return synced || isMaster(); }
+    const std::vector<Peer> &getPeers() const { return peers; }
+};
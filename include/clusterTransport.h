@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define CLUSTER_PORT 4211
+#define CLUSTER_MULTICAST_GROUP "239.255.42.42" // Administratively scoped, stays in the local network
+
+// Carries cluster packets between units. Every packet goes to all other units,
+// never back to the sender. The device uses UDP multicast; a simulation can
+// connect several ClusterNodes in memory instead.
+class ClusterTransport
+{
+public:
+    virtual ~ClusterTransport() {}
+
+    virtual void send(const uint8_t *data, size_t length) = 0;
+
+    // Wait up to timeout ms for a packet and copy it into data. Returns its length, 0 if none came
+    virtual size_t receive(uint8_t *data, size_t size, uint32_t timeout) = 0;
+};
+
+// UDP multicast on CLUSTER_MULTICAST_GROUP, reaches the units in the same network
+class MulticastTransport : public ClusterTransport
+{
+private:
+    int sock = -1;
+
+public:
+    ~MulticastTransport() override { close(); }
+
+    bool open();
+    void close();
+    bool isOpen() const { return sock >= 0; }
+
+    void send(const uint8_t *data, size_t length) override;
+    size_t receive(uint8_t *data, size_t size, uint32_t timeout) override;
+};
@@ -2,9 +2,40 @@
 #include <nvs_flash.h>
 #include <nvs.h>
 #include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <map>
+#include <vector>
+
+// Dirty values are committed once no change happened for this long (ms)
+#define CONFIG_FLUSH_IDLE 2000
+// and at the latest this long after the first unsaved change (ms)
+#define CONFIG_FLUSH_MAX_DELAY 10000
 
 class ConfigManager {
 private:
+    struct Entry {
+        String value;
+        std::vector<uint8_t> blob;
+        bool isBlob;
+        bool erased;
+        bool dirty;
+    };
+
+    nvs_handle_t handle;
+    bool opened = false;
+
+    // Config is written by the scheduler task and flushed from the main loop
+    SemaphoreHandle_t mutex = nullptr;
+    void lock() const;
+    void unlock() const;
+
+    // Values read from or waiting to be written to NVS
+    mutable std::map<String, Entry> cache;
+    bool dirty = false;
+    unsigned long firstChange = 0;
+    unsigned long lastChange = 0;
+
     // Private constructor
     ConfigManager();
 
@@ -15,6 +46,11 @@ private:
     // Private static instance pointer
     static ConfigManager* instance;
 
+    void markDirty();
+
+    // Registered with esp_register_shutdown_handler, runs on esp_restart
+    static void onShutdown();
+
 public:
     // Get the singleton instance
     static ConfigManager* getInstance() {
@@ -24,9 +60,26 @@ public:
         return instance;
     }
 
-    // Store a string value
+    // Store a string value. It is written to flash by the next flush
     void setConfig(const String& key, const String& value);
 
     // Retrieve a string value
     String getConfig(const String& key, const String& default_value = "") const;
-};
\ No newline at end of file
+
+    // Store a binary value. Writing the bytes that are already stored does nothing
+    void setBlob(const String& key, const std::vector<uint8_t>& data);
+
+    // Retrieve a binary value. Returns false if the key does not exist
+    bool getBlob(const String& key, std::vector<uint8_t>& data) const;
+
+    // Remove a string or binary value
+    void eraseConfig(const String& key);
+
+    // Write all dirty values and commit. Returns false if NVS rejected a value
+    bool flush();
+
+    // Call from loop(), flushes once the changes settled
+    void loop();
+
+    bool isDirty() const;
+};
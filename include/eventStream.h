@@ -0,0 +1,45 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <vector>
+
+#define EVENT_STREAM_MAX_CLIENTS 4
+#define EVENT_STREAM_CLIENT_BUFFER 2048 // bytes of pending events per client
+#define EVENT_STREAM_WRITE_CHUNK 512    // bytes written per client and loop
+#define EVENT_STREAM_KEEPALIVE 15000    // in ms, comment sent to idle clients
+#define EVENT_STREAM_RETRY 2000         // in ms, reconnect delay for browsers
+
+// Server-Sent Events (text/event-stream) to a few long lived clients. Each client
+// has a bounded buffer of pending events; a client that falls behind loses them
+// and gets a resync event instead, so a slow client never holds up the others.
+// Not thread safe, only used from the web task.
+class EventStream
+{
+private:
+    struct Subscriber
+    {
+        WiFiClient client;
+        String pending;
+    };
+
+    std::vector<Subscriber> subscribers;
+    unsigned long lastWrite = 0;
+
+    void queue(Subscriber &subscriber, const String &message);
+
+public:
+    // Take over the client of the current request and send the stream headers.
+    // Returns false if all subscriber slots are taken.
+    bool subscribe(WiFiClient client);
+
+    // Queue an event for every subscriber
+    void send(const char *event, const String &data, uint32_t id);
+
+    // Write pending events and drop disconnected clients
+    void loop();
+
+    // Close all clients, e.g. when wifi is turned off
+    void clear();
+
+    size_t size() const { return subscribers.size(); }
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Sorted vector with a std::map like interface for small maps with integer keys.
+// One contiguous allocation instead of one heap node per entry; lookups are a
+// binary search, inserts and erases move the tail.
+template <typename K, typename V>
+class FlatMap
+{
+public:
+    typedef std::pair<K, V> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+    std::vector<value_type> entries;
+
+    static bool keyLess(const value_type &entry, const K &key) { return entry.first < key; }
+
+public:
+    void reserve(size_t capacity) { entries.reserve(capacity); }
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    iterator find(const K &key)
+    {
+        iterator it = std::lower_bound(entries.begin(), entries.end(), key, keyLess);
+        return (it != entries.end() && it->first == key) ? it : entries.end();
+    }
+
+    const_iterator find(const K &key) const
+    {
+        const_iterator it = std::lower_bound(entries.begin(), entries.end(), key, keyLess);
+        return (it != entries.end() && it->first == key) ? it : entries.end();
+    }
+
+    V &operator[](const K &key)
+    {
+        iterator it = std::lower_bound(entries.begin(), entries.end(), key, keyLess);
+        if (it == entries.end() || it->first != key)
+        {
+            it = entries.insert(it, value_type(key, V()));
+        }
+        return it->second;
+    }
+
+    iterator erase(iterator it) { return entries.erase(it); }
+    void clear() { entries.clear(); }
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <Arduino.h>
+
+#define JSON_READER_DEPTH 16 // Deepest nesting skipValue() walks through, deeper input is invalid
+
+// Pull parser that walks JSON from a Stream one value at a time. Nothing but the
+// values asked for is kept in memory, so documents of any size can be read.
+// After the first syntax error isValid() is false and all reads return empty values.
+class JsonReader
+{
+private:
+    Stream &input;
+    bool valid = true;
+    bool first = false;  // No member or element of the current object or array was read yet
+    uint8_t depth = 0;   // Of skipValue(), it recurses for nested values
+
+    int peekChar(); // Next character after whitespace, -1 at the end
+    bool consume(char c);
+    bool consumeLiteral(const char *literal);
+    size_t readStringInto(String *value, char *buffer, size_t size); // Returns the full length
+    bool next(char close); // Step to the next member or element, false at the end
+
+public:
+    JsonReader(Stream &input);
+
+    bool isValid() const;
+
+    // Iterate an object: if (beginObject()) while (nextKey(key, sizeof(key))) { read or skip the value }
+    bool beginObject();
+    bool nextKey(char *key, size_t size); // Longer keys are truncated
+
+    // Iterate an array: if (beginArray()) while (nextElement()) { read or skip the value }
+    bool beginArray();
+    bool nextElement();
+
+    long readInt(); // Fractions are dropped
+    bool readBool();
+    String readString();
+    size_t readString(char *buffer, size_t size); // Returns the full length, longer strings are truncated
+    void skipValue();
+};
+
+// Stream over a buffer in memory, e.g. a config string read from NVS
+class BufferStream : public Stream
+{
+private:
+    const char *data;
+    size_t length;
+    size_t position = 0;
+
+public:
+    BufferStream(const char *data, size_t length) : data(data), length(length) {}
+
+    int available() override { return length - position; }
+    int read() override { return position < length ? (uint8_t)data[position++] : -1; }
+    int peek() override { return position < length ? (uint8_t)data[position] : -1; }
+    size_t write(uint8_t) override { return 0; }
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <Arduino.h>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#define JSON_WRITER_DEPTH 8
+
+// Writes JSON straight to a Print, without building a document first. Commas
+// between members and elements are inserted automatically. Nesting deeper than
+// JSON_WRITER_DEPTH throws.
+//
+// The same calls can write MessagePack instead. A MessagePack map or array starts
+// with its number of members or elements, so such a document is written twice:
+// once to count them and once with the counts. Both runs must make the same calls.
+class JsonWriter
+{
+private:
+    enum Format : uint8_t
+    {
+        JSON,
+        MSGPACK_COUNT,
+        MSGPACK
+    };
+
+    Print &out;
+    Format format = JSON;
+    bool first[JSON_WRITER_DEPTH];
+    uint8_t depth = 0;
+    bool afterKey = false;
+
+    std::vector<uint32_t> *counts = nullptr; // Members or elements of each container, in the order they begin
+    size_t containers[JSON_WRITER_DEPTH];    // Counting: index in counts of each open container
+    size_t nextCount = 0;                    // Writing: index in counts of the next container
+
+    void separate();
+    void open(char bracket);
+    void close(char bracket);
+    void writeString(const char *value);
+    void writeBigEndian(uint64_t value, uint8_t bytes);
+    void writeSigned(int64_t value);
+    void writeUnsigned(uint64_t value);
+
+public:
+    // Write JSON
+    JsonWriter(Print &out);
+    // Count the containers of a MessagePack document, nothing is written
+    JsonWriter(std::vector<uint32_t> &counts);
+    // Write MessagePack with the counts of a previous run
+    JsonWriter(Print &out, std::vector<uint32_t> &counts);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    // Start a member of the current object, followed by a value, object or array
+    void key(const char *name);
+
+    void value(const char *value);
+    void value(const String &value) { this->value(value.c_str()); }
+    void value(bool value);
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type value(T value)
+    {
+        separate();
+        if (format == JSON)
+        {
+            out.print(value);
+        }
+        else if (format == MSGPACK && std::is_signed<T>::value)
+        {
+            writeSigned(value);
+        }
+        else if (format == MSGPACK)
+        {
+            writeUnsigned(value);
+        }
+    }
+
+    template <typename T>
+    void member(const char *name, const T &value)
+    {
+        key(name);
+        this->value(value);
+    }
+};
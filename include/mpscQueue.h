@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for many producers and a single consumer. Every cell
+// carries a sequence number that tells producers and the consumer whose turn it
+// is, so neither side ever waits on a lock. N must be a power of two.
+template <typename T, size_t N>
+class MpscQueue
+{
+private:
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "MpscQueue size must be a power of two");
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell cells[N];
+    std::atomic<size_t> enqueuePosition;
+    size_t dequeuePosition; // Only touched by the consumer
+
+public:
+    MpscQueue() : enqueuePosition(0), dequeuePosition(0)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Any task. Returns false if the queue is full
+    bool push(const T &value)
+    {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells[position & (N - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if (difference == 0)
+            {
+                // The cell is free, claim it
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                // The consumer has not taken this cell yet
+                return false;
+            }
+            else
+            {
+                // Another producer claimed it first
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the queue is empty
+    bool pop(T &value)
+    {
+        Cell *cell = &cells[dequeuePosition & (N - 1)];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)sequence - (intptr_t)(dequeuePosition + 1) < 0)
+        {
+            return false;
+        }
+
+        value = cell->value;
+        cell->sequence.store(dequeuePosition + N, std::memory_order_release);
+        dequeuePosition++;
+        return true;
+    }
+};
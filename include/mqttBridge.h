@@ -0,0 +1,138 @@
+#pragma once
+#include "alarm.h"
+#include "alarmScheduler.h"
+#include "mpscQueue.h"
+#include "relaySnapshot.h"
+#include <Arduino.h>
+#include <deque>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <memory>
+#include <mqtt_client.h>
+#include <vector>
+
+#define MQTT_TASK_STACK 4096
+#define MQTT_TASK_PRIORITY 1
+#define MQTT_POLL 10           // in ms, how often relay states are compared with the last published ones
+#define MQTT_QOS 1
+#define MQTT_KEEPALIVE 30      // in s
+#define MQTT_BUFFER 64         // messages kept until the broker acknowledges them, the oldest is dropped
+#define MQTT_FIRED_QUEUE 16    // fired alarms waiting for the task, power of two
+#define MQTT_MAX_PAYLOAD 1024  // longer commands are ignored
+
+// Connects the relays to an MQTT broker. Topics are below a prefix:
+//
+//   <prefix>/status            "online" or "offline", retained, offline is the last will
+//   <prefix>/relays/<id>       {"id", "name", "state"} of every relay, retained
+//   <prefix>/alarm-fired       {"relayId", "alarmId", "state", "time"} for every fired alarm
+//   <prefix>/relays/<id>/set   command: ON, OFF, true, false, 1 or 0
+//   <prefix>/alarms/<op>       command: create, update or delete an alarm, see API.md
+//   <command topic>/result     {"status", ...} of a command that has a result
+//
+// Everything is published with QoS 1. Messages wait in an outbox until the broker
+// acknowledges them, also while it can not be reached; a newer retained message
+// replaces a waiting one of the same topic. After a reconnect unacknowledged
+// messages are sent again, so a message may arrive twice.
+//
+// A task of its own compares the relay states of each new snapshot with the last
+// published ones, so every change is pushed within MQTT_POLL ms. Commands are
+// handed to the command handler on the task of the MQTT client.
+class MqttBridge
+{
+public:
+    // Handle a command topic below the prefix, e.g. "relays/0/set". Returns the result to publish, empty for none
+    typedef String (*CommandHandler)(const String &topic, const char *payload, size_t length);
+
+    struct Settings
+    {
+        String uri; // mqtt://host:1883 or mqtts://host:8883, empty turns the bridge off
+        String username;
+        String password;
+        String prefix;
+    };
+
+    struct Status
+    {
+        bool connected;
+        size_t queued;
+        uint32_t dropped;
+    };
+
+private:
+    struct Message
+    {
+        String topic;
+        String payload;
+        bool retain;
+        int id; // Of the PUBLISH waiting for its acknowledgement, -1 if not sent yet
+    };
+
+    AlarmScheduler *scheduler = nullptr;
+    CommandHandler handler = nullptr;
+    TaskHandle_t task = nullptr;
+    SemaphoreHandle_t mutex = nullptr; // Guards everything below. Never held while calling the MQTT client
+
+    esp_mqtt_client_handle_t client = nullptr;
+    Settings settings;
+    String defaultPrefix;
+    bool settingsChanged = false;
+    bool networkUp = false;
+    volatile bool connected = false;
+    std::deque<Message> outbox;
+    std::vector<int> earlyAcks; // Acknowledged before the id was stored
+    uint32_t dropped = 0;
+
+    std::shared_ptr<const RelaySnapshot> published; // Relay states in the outbox, nullptr to publish all
+    MpscQueue<FiredAlarm, MQTT_FIRED_QUEUE> fired;
+
+    // Private constructor
+    MqttBridge();
+
+    // Disable copy constructor and assignment operator
+    MqttBridge(const MqttBridge &) = delete;
+    MqttBridge &operator=(const MqttBridge &) = delete;
+
+    // Private static instance pointer
+    static MqttBridge *instance;
+
+    void lock() const;
+    void unlock() const;
+    void notify();
+    void enqueue(const String &topic, const String &payload, bool retain);
+    void connect();
+    void disconnect();
+    void queueRelays();
+    void queueFired();
+    void flush();
+    void onEvent(esp_mqtt_event_handle_t event);
+    static void eventHandler(void *arg, esp_event_base_t base, int32_t id, void *data);
+    static void taskLoop(void *param);
+
+public:
+    // Get the singleton instance
+    static MqttBridge *getInstance()
+    {
+        if (instance == nullptr)
+        {
+            instance = new MqttBridge();
+        }
+        return instance;
+    }
+
+    // Load the settings and start the task. The prefix is used until one is set
+    void begin(AlarmScheduler *scheduler, CommandHandler handler, const String &defaultPrefix);
+
+    void setSettings(const Settings &settings);
+    Settings getSettings() const;
+    // Stop the client, drop the queued messages and remove the stored settings
+    void eraseConfig();
+
+    // The client only runs while the network is up
+    void setNetwork(bool up);
+
+    // Publish a fired alarm. Called on the scheduler task, never blocks
+    void alarmFired(const FiredAlarm &alarm);
+
+    Status getStatus() const;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Fixed capacity storage for N objects of type T. The memory is part of the
+// owning object, so creating and destroying objects never touches the heap.
+template <typename T, size_t N>
+class ObjectPool
+{
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage[N];
+    bool used[N] = {};
+
+public:
+    ObjectPool() {};
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    ~ObjectPool()
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            if (used[i])
+            {
+                reinterpret_cast<T *>(&storage[i])->~T();
+            }
+        }
+    }
+
+    template <typename... Args>
+    T *create(Args &&...args)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            if (!used[i])
+            {
+                T *object = new (&storage[i]) T(std::forward<Args>(args)...);
+                used[i] = true;
+                return object;
+            }
+        }
+        throw std::runtime_error("Object pool is full");
+    }
+
+    void destroy(T *object)
+    {
+        size_t i = reinterpret_cast<decltype(&storage[0])>(object) - storage;
+        if (i < N && used[i])
+        {
+            object->~T();
+            used[i] = false;
+        }
+    }
+
+    size_t capacity() const { return N; }
+};
@@ -1,10 +1,8 @@
 #pragma once
 #include "alarm.h"
 #include <Arduino.h>
-#include <map>
+#include <array>
 #include <vector>
-#include <ArduinoJson.h>
-
 
 // Forward declaration of Relay
 class Alarm;
@@ -18,14 +16,19 @@ class Relay {
         uint id;
         String name;
         uint8_t pin;
+        uint8_t index; // relay index in the AlarmTable records
 
-        std::map<uint, Alarm*> alarms;
+        // Packed records of this relay's alarms, sorted by second of the day
+        vector<uint32_t> transitions;
+        bool transitionsDirty = true;
+        void buildTransitions();
 
     public:
         Relay(const uint8_t pin, const String& name);
-        Relay(String json);
+        Relay(uint id, const uint8_t pin, const String& name); // An id already in use is replaced by a new one
         ~Relay();
         uint getId();
+        uint8_t getIndex() const;
         String getName();
         void setName(const String& name);
         uint8_t getPin();
@@ -33,10 +36,15 @@ class Relay {
         void On();
         void Off();
 
-        Alarm* addAlarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, bool state);
+        Alarm addAlarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, bool state);
         void removeAlarm(const uint id);
         vector<uint> getAlarmIDs() const;
-        Alarm* getAlarmByID(const uint id) const;
+        Alarm getAlarmByID(const uint id) const; // Invalid Alarm if not found
+
+        // Mark the transition table as outdated after an alarm changed
+        void invalidateSchedule();
+        // State the alarms put this relay in at the given unix time. Returns false without alarms
+        bool getScheduledState(uint32_t unixtime, bool& state);
 
         String toJson() const;
 };
@@ -1,23 +1,51 @@
 #pragma once
 #include "relay.h"
 #include "rtc.h"
-#include <map>
+#include "flatMap.h"
+#include "objectPool.h"
+#include "jsonReader.h"
+#include "relaySnapshot.h"
+#include <memory>
 #include <vector>
 #include <tuple>
-#include <algorithm>
-#include <queue>
+
+// Maximum number of relays, set with -D MAX_RELAYS in platformio.ini
+#ifndef MAX_RELAYS
+#define MAX_RELAYS 16
+#endif
+
+// Removed relays and alarms remembered for clients fetching changes, each
+#define RELAY_MANAGER_REMOVALS 64
 
 using std::vector;
 
 class RelayManager
 {
 private:
-    std::map<uint, Relay *> relays; // Add the std:: namespace qualifier
+    ObjectPool<Relay, MAX_RELAYS> relayPool;
+    FlatMap<uint, Relay *> relays;
     String name = "Smart-Relay";
 
+    void loadRelayJson(JsonReader &reader);
+    void loadAlarmJson(JsonReader &reader, Relay *relay);
+
+    // Number of alarm pages in NVS, pages beyond the table are erased on save
+    mutable uint16_t storedPages = 0;
+
+    // Change tracking of snapshot()
+    std::shared_ptr<const RelaySnapshot> lastSnapshot;
+    uint32_t generation = 0;
+    uint32_t nameChanged = 0;
+    uint32_t relaysChanged = 0;
+    uint32_t alarmsChanged = 0;
+    std::vector<RelaySnapshot::Removal> removedRelays;
+    std::vector<RelaySnapshot::Removal> removedAlarms;
+    uint32_t removalsSince = 0;
+
+    void addRemoval(std::vector<RelaySnapshot::Removal> &removals, const RelaySnapshot::Removal &removal);
+
 public:
     RelayManager();
-    RelayManager(String json);
     ~RelayManager();
 
     Relay *addRelay(const uint8_t pin, const String &name);
@@ -25,10 +53,24 @@ public:
     Relay *getRelayByID(const uint id) const;
     void removeRelayByID(const uint id);
 
+    // Put every relay in the state its most recent alarm demands, e.g. after boot or a clock change
+    void applySchedule(uint32_t unixtime);
+
     String getName() const;
     void setName(const String &name);
 
-    std::queue<std::vector<Alarm *>> getNextAlarm() const;
+    // Copy of all relays and alarms for readers on other tasks. Compared with the
+    // previous one to stamp what changed, the previous one is returned if nothing did
+    std::shared_ptr<const RelaySnapshot> snapshot();
+
+    // Add the relays and alarms of a JSON config of older firmware in a single pass.
+    // Memory use does not depend on the number of alarms. Returns false on a syntax error
+    bool loadJson(Stream &input);
 
-    String toJson() const;
+    // Binary config in NVS, see binaryConfig.h. Returns false if no valid config is stored
+    bool loadConfig();
+    // Only blobs whose bytes changed are written by the ConfigManager
+    void saveConfig() const;
+    // Remove the binary and the legacy JSON config
+    void eraseConfig();
 };
\ No newline at end of file
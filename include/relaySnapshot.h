@@ -0,0 +1,70 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// Immutable copy of the relays and alarms for readers on other tasks. The scheduler
+// task publishes a new one after every change and never modifies a published one,
+// so readers can use theirs for as long as they hold the shared_ptr.
+//
+// Every entry carries the generation it was last changed in, and removed entries
+// are remembered for a while, so clients can fetch only what changed since a
+// generation they have seen.
+struct RelaySnapshot
+{
+    struct RelayInfo
+    {
+        uint id;
+        String name;
+        uint8_t pin;
+        bool state;
+        uint32_t changed; // Generation of the last change
+    };
+
+    struct AlarmInfo
+    {
+        uint id;
+        uint relayId;
+        uint32_t record; // Packed as in the AlarmTable
+        uint32_t changed;
+    };
+
+    struct Removal
+    {
+        uint id;
+        uint relayId; // Relay of a removed alarm
+        uint32_t generation;
+    };
+
+    uint32_t generation = 0; // Increases with every change, never for an identical state
+    uint32_t nameChanged = 0;
+    uint32_t relaysChanged = 0; // Last generation a relay was added, removed or changed
+    uint32_t alarmsChanged = 0;
+    String systemName;
+    std::vector<RelayInfo> relays; // Ascending id
+    std::vector<AlarmInfo> alarms; // Grouped by relay in relay order, ascending id within a relay
+
+    // Recent removals in generation order. Removals up to removalsSince may be
+    // missing, a client that saw an older generation has to reload everything
+    std::vector<Removal> removedRelays;
+    std::vector<Removal> removedAlarms;
+    uint32_t removalsSince = 0;
+
+    // True if the changes since a generation can be told with the changed
+    // generations and the removals of this snapshot
+    bool hasChangesSince(uint32_t since) const
+    {
+        return since >= removalsSince && since <= generation;
+    }
+
+    const RelayInfo *findRelay(uint id) const
+    {
+        for (const RelayInfo &relay : relays)
+        {
+            if (relay.id == id)
+            {
+                return &relay;
+            }
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,218 @@
+#pragma once
+#include "jsonReader.h"
+#include <Arduino.h>
+#include <array>
+#include <climits>
+#include <cstring>
+
+// Fields are tracked in a bit mask while decoding
+#define SCHEMA_MAX_FIELDS 32
+// Longer keys in a body are truncated and never match a field
+#define SCHEMA_KEY_SIZE 24
+
+// Request bodies are declared once as a constant table of fields, each bound to
+// a member of the struct the body decodes into, with its range:
+//
+//   struct RelayControlBody { uint relayId; bool state; };
+//   constexpr SchemaField<RelayControlBody> relayControlSchema[] = {
+//       SCHEMA_INT(RelayControlBody, relayId, 0, LONG_MAX),
+//       SCHEMA_BOOL(RelayControlBody, state)};
+//
+// decodeSchema() streams the body through a JsonReader and stores each value
+// after checking its type and range. No JSON document is built and nothing is
+// allocated except for String members. Unknown keys are skipped.
+template <typename T>
+struct SchemaField
+{
+    const char *key;
+    bool (*read)(JsonReader &reader, T &target, const SchemaField &field);
+    long min; // Numbers: value, strings: length
+    long max;
+    bool required;
+};
+
+// Why decoding failed. The message is followed by the key if there is one
+struct SchemaError
+{
+    const char *message;
+    const char *key;
+
+    SchemaError(const char *message = nullptr, const char *key = nullptr) : message(message), key(key) {}
+
+    bool isError() const { return message != nullptr; }
+};
+
+// Array of objects with up to N elements, see SCHEMA_LIST
+template <typename E, size_t N>
+struct SchemaList
+{
+    typedef E Item;
+    std::array<E, N> items;
+    size_t count = 0;
+};
+
+template <typename T, size_t N>
+SchemaError decodeSchema(JsonReader &reader, const SchemaField<T> (&schema)[N], T &target);
+
+template <typename T, typename V, V T::*Member>
+bool schemaReadInt(JsonReader &reader, T &target, const SchemaField<T> &field)
+{
+    long value = reader.readInt();
+    // Also rejects values the member can not hold, whatever range was declared
+    if (!reader.isValid() || value < field.min || value > field.max || (long)(V)value != value)
+    {
+        return false;
+    }
+    target.*Member = value;
+    return true;
+}
+
+template <typename T, typename V, V T::*Member>
+bool schemaReadBool(JsonReader &reader, T &target, const SchemaField<T> &)
+{
+    bool value = reader.readBool();
+    target.*Member = value;
+    return reader.isValid();
+}
+
+// Exactly as many booleans as the std::array member holds
+template <typename T, typename A, A T::*Member>
+bool schemaReadBools(JsonReader &reader, T &target, const SchemaField<T> &)
+{
+    A &values = target.*Member;
+    size_t count = 0;
+    if (!reader.beginArray())
+    {
+        return false;
+    }
+    while (reader.nextElement())
+    {
+        bool value = reader.readBool();
+        if (count < values.size())
+        {
+            values[count] = value;
+        }
+        count++;
+    }
+    return reader.isValid() && count == values.size();
+}
+
+// Up to as many integers as the SchemaList member holds, each in the range of the field
+template <typename T, typename L, L T::*Member>
+bool schemaReadInts(JsonReader &reader, T &target, const SchemaField<T> &field)
+{
+    L &list = target.*Member;
+    list.count = 0;
+    if (!reader.beginArray())
+    {
+        return false;
+    }
+    while (reader.nextElement())
+    {
+        long value = reader.readInt();
+        if (!reader.isValid() || value < field.min || value > field.max ||
+            (long)(typename L::Item)value != value || list.count >= list.items.size())
+        {
+            return false;
+        }
+        list.items[list.count++] = value;
+    }
+    return reader.isValid();
+}
+
+inline bool schemaStoreString(JsonReader &reader, String &value, const long min, const long max)
+{
+    value = reader.readString();
+    return reader.isValid() && (long)value.length() >= min && (long)value.length() <= max;
+}
+
+template <size_t N>
+bool schemaStoreString(JsonReader &reader, char (&buffer)[N], const long min, const long max)
+{
+    size_t length = reader.readString(buffer, N);
+    return reader.isValid() && length < N && (long)length >= min && (long)length <= max;
+}
+
+// Into a String or a char array, which also bounds the length
+template <typename T, typename S, S T::*Member>
+bool schemaReadString(JsonReader &reader, T &target, const SchemaField<T> &field)
+{
+    return schemaStoreString(reader, target.*Member, field.min, field.max);
+}
+
+template <typename T, typename L, L T::*Member, size_t F, const SchemaField<typename L::Item> (&Schema)[F]>
+bool schemaReadList(JsonReader &reader, T &target, const SchemaField<T> &field)
+{
+    L &list = target.*Member;
+    list.count = 0;
+    if (!reader.beginArray())
+    {
+        return false;
+    }
+    while (reader.nextElement())
+    {
+        if (list.count >= list.items.size() || decodeSchema(reader, Schema, list.items[list.count]).isError())
+        {
+            return false;
+        }
+        list.count++;
+    }
+    return reader.isValid() && (long)list.count >= field.min;
+}
+
+#define SCHEMA_FIELD(T, member, read, min, max, required) {#member, &read<T, decltype(T::member), &T::member>, min, max, required}
+
+#define SCHEMA_INT(T, member, min, max) SCHEMA_FIELD(T, member, schemaReadInt, min, max, true)
+#define SCHEMA_OPTIONAL_INT(T, member, min, max) SCHEMA_FIELD(T, member, schemaReadInt, min, max, false)
+#define SCHEMA_BOOL(T, member) SCHEMA_FIELD(T, member, schemaReadBool, 0, 1, true)
+#define SCHEMA_OPTIONAL_BOOL(T, member) SCHEMA_FIELD(T, member, schemaReadBool, 0, 1, false)
+#define SCHEMA_BOOLS(T, member) SCHEMA_FIELD(T, member, schemaReadBools, 0, 0, true)
+#define SCHEMA_OPTIONAL_BOOLS(T, member) SCHEMA_FIELD(T, member, schemaReadBools, 0, 0, false)
+#define SCHEMA_INTS(T, member, min, max) SCHEMA_FIELD(T, member, schemaReadInts, min, max, true)
+#define SCHEMA_STRING(T, member, minLength, maxLength) SCHEMA_FIELD(T, member, schemaReadString, minLength, maxLength, true)
+// Elements are decoded with the schema of the element type, a constant array
+#define SCHEMA_LIST(T, member, schema) \
+    {#member, &schemaReadList<T, decltype(T::member), &T::member, sizeof(schema) / sizeof(schema[0]), schema>, 0, 0, true}
+
+template <typename T, size_t N>
+SchemaError decodeSchema(JsonReader &reader, const SchemaField<T> (&schema)[N], T &target)
+{
+    static_assert(N <= SCHEMA_MAX_FIELDS, "Too many fields in schema");
+
+    uint32_t seen = 0;
+    char key[SCHEMA_KEY_SIZE];
+    if (reader.beginObject())
+    {
+        while (reader.nextKey(key, sizeof(key)))
+        {
+            size_t i = 0;
+            while (i < N && strcmp(schema[i].key, key) != 0)
+            {
+                i++;
+            }
+            if (i == N)
+            {
+                reader.skipValue();
+                continue;
+            }
+            if (!schema[i].read(reader, target, schema[i]))
+            {
+                return SchemaError("Invalid value for key: ", schema[i].key);
+            }
+            seen |= 1UL << i;
+        }
+    }
+    if (!reader.isValid())
+    {
+        return SchemaError("Failed to parse JSON");
+    }
+
+    for (size_t i = 0; i < N; i++)
+    {
+        if (schema[i].required && !(seen & (1UL << i)))
+        {
+            return SchemaError("Missing key: ", schema[i].key);
+        }
+    }
+    return SchemaError();
+}
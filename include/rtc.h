@@ -2,24 +2,58 @@
 #include "RTClib.h"
 #include <Wire.h>
 #include <Arduino.h>
+#include <esp_timer.h>
 
+#define RTC_RESYNC_INTERVAL 600 // in s, how often the software clock is checked against the DS3231
+#define RTC_SQW_TIMEOUT 1500000 // in us, without an edge for this long the clock is extrapolated
+#define RTC_TASK_STACK 3072
+#define RTC_TASK_PRIORITY 1
+
+// Software clock on top of the DS3231. The seconds are counted by an interrupt on the
+// 1 Hz square wave, the fraction comes from esp_timer scaled by the measured edge period.
+// now() therefore never touches the I2C bus; the DS3231 is only read on periodic resyncs.
 class RTC
 {
 private:
-    uint8_t sdaPin, sclPin;
+    uint8_t sdaPin, sclPin, sqwPin;
     RTC_DS3231 rtc;
     static RTC* instance; // Singleton instance
 
+    // Updated by the SQW interrupt
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    volatile uint32_t edgeSecond = 0;      // unix time that started at the last edge
+    volatile int64_t edgeMicros = 0;       // esp_timer time of the last edge
+    volatile int64_t periodMicros = 1000000; // measured SQW period in esp_timer microseconds
+    volatile bool locked = false;          // edgeMicros is a real edge and not the time of a read
+    volatile int64_t offsetMicros = 0;     // added to the DS3231 time, see setOffsetMicros
+    bool sqwEnabled = false;
+
     // Private constructor
-    RTC(uint8_t sdaPin, uint8_t sclPin) : sdaPin(sdaPin), sclPin(sclPin) {};
+    RTC(uint8_t sdaPin, uint8_t sclPin, uint8_t sqwPin) : sdaPin(sdaPin), sclPin(sclPin), sqwPin(sqwPin) {};
+
+    void enableSquareWave();
+    void disableSquareWave();
+    void resync();
+    static void IRAM_ATTR onSquareWave();
+    static void resyncTask(void* param);
 
 public:
     RTC(const RTC& other) = delete; // Disable copy constructor
     void operator=(const RTC&) = delete; // Disable assignment operator
 
-    static RTC* getInstance(uint8_t sdaPin = 21, uint8_t sclSclPin = 22); // Method to get the instance
+    static RTC* getInstance(uint8_t sdaPin = 21, uint8_t sclSclPin = 22, uint8_t sqwPin = 4); // Method to get the instance
 
     DateTime now();
+    uint64_t nowMicros(); // unix time in microseconds
 
     void setDateTime(const DateTime& dt);
+
+    // Run the clock ahead of the DS3231 by an offset, e.g. to follow the time of other
+    // units. The DS3231 keeps its own time; setDateTime clears the offset
+    void setOffsetMicros(int64_t offset);
+    int64_t getOffsetMicros();
+
+    // Program Alarm1 to pull the INT/SQW pin low at the given time
+    void setWakeAlarm(const DateTime& dt);
+    void clearWakeAlarm();
 };
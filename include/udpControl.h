@@ -0,0 +1,122 @@
+#pragma once
+#include "alarm.h"
+#include "alarmScheduler.h"
+#include "mpscQueue.h"
+#include "udpProtocol.h"
+#include <Arduino.h>
+#include <array>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define UDP_CONTROL_PORT 4210
+#define UDP_CONTROL_TASK_STACK 4096
+#define UDP_CONTROL_TASK_PRIORITY 3  // above the scheduler and web tasks
+#define UDP_CONTROL_POLL 10          // in ms, socket wait between checks for events to send
+#define UDP_CONTROL_MAX_CLIENTS 8    // the least recently seen client is replaced
+#define UDP_CONTROL_LEASE 60         // in s, alarm events are sent this long after SUBSCRIBE
+#define UDP_CONTROL_PENDING_EVENTS 8 // unacknowledged events per client, the oldest is dropped
+#define UDP_CONTROL_RETRY 100        // in ms, until an unacknowledged event is sent again
+#define UDP_CONTROL_RETRIES 5
+#define UDP_CONTROL_FIRED_QUEUE 16 // fired alarms waiting for the task, power of two
+
+// Relay control over UDP with small signed packets (see udpProtocol.h), for clients
+// that need lower latency than HTTP. A task of its own waits on the socket and
+// hands requests to the scheduler task as commands, like the web server does.
+//
+// Each client (address and port) numbers its requests. A request that repeats the
+// last sequence gets the last reply again without being executed, so clients resend
+// until they see an acknowledgement. Lower sequences are rejected, and new clients
+// start above every sequence accepted so far in this session. Together with the
+// session, which changes every boot, this keeps recorded packets from being replayed.
+class UdpControl
+{
+private:
+    struct Event
+    {
+        UdpPacket packet;
+        uint8_t sent;    // Times sent
+        uint32_t sentAt; // millis
+    };
+
+    struct Client
+    {
+        bool used = false;
+        uint32_t address = 0; // IPv4 in network order
+        uint16_t port = 0;    // Network order
+        uint32_t lastSequence = 0;
+        bool hasReply = false;
+        uint8_t reply[UDP_PACKET_SIZE];
+        uint32_t lastSeen = 0;   // millis
+        uint32_t leaseUntil = 0; // millis, subscribed to alarm events until then
+        uint32_t eventSequence = 0;
+        Event events[UDP_CONTROL_PENDING_EVENTS];
+        uint8_t eventCount = 0;
+    };
+
+    AlarmScheduler *scheduler = nullptr;
+    TaskHandle_t task = nullptr;
+    int sock = -1;
+    uint32_t session = 0;
+    uint32_t highestSequence = 0; // Of all clients in this session
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED; // Guards key and hasKey
+    uint8_t key[UDP_KEY_SIZE];
+    bool keySet = false;
+    volatile bool networkUp = false;
+
+    std::array<Client, UDP_CONTROL_MAX_CLIENTS> clients;
+    MpscQueue<FiredAlarm, UDP_CONTROL_FIRED_QUEUE> fired;
+
+    volatile uint32_t lastLatency = 0; // in us, receive to GPIO of the last SET_RELAY
+    volatile uint32_t maxLatency = 0;
+
+    // Private constructor
+    UdpControl() {}
+
+    // Disable copy constructor and assignment operator
+    UdpControl(const UdpControl &) = delete;
+    UdpControl &operator=(const UdpControl &) = delete;
+
+    // Private static instance pointer
+    static UdpControl *instance;
+
+    bool open();
+    void close();
+    void receive();
+    void handle(const uint8_t *data, size_t length, uint32_t address, uint16_t port, int64_t receivedAt);
+    UdpPacket execute(const UdpPacket &request, Client &client, int64_t receivedAt);
+    Client &findClient(uint32_t address, uint16_t port);
+    void send(const uint8_t *data, uint32_t address, uint16_t port);
+    void sendEvents();
+    void acknowledge(Client &client, uint32_t sequence);
+    bool copyKey(uint8_t *out);
+    static void taskLoop(void *param);
+
+public:
+    // Get the singleton instance
+    static UdpControl *getInstance()
+    {
+        if (instance == nullptr)
+        {
+            instance = new UdpControl();
+        }
+        return instance;
+    }
+
+    // Start the task. Packets are only served while a key is set and the network is up
+    void begin(AlarmScheduler *scheduler, uint32_t session);
+
+    // Shared key of all clients, nullptr turns UDP control off
+    void setKey(const uint8_t *key);
+    bool hasKey();
+
+    // Open or close the socket with the wifi
+    void setNetwork(bool up);
+
+    // Queue an alarm event for subscribed clients. Called on the scheduler task, never blocks
+    void alarmFired(const FiredAlarm &alarm);
+
+    uint32_t getLastLatency() const { return lastLatency; }
+    uint32_t getMaxLatency() const { return maxLatency; }
+    uint32_t getSession() const { return session; }
+};
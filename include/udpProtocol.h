@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Packets of the UDP control protocol. Every packet has the same size and layout,
+// fields are big endian:
+//
+//   0  u8   magic 0xA5
+//   1  u8   version
+//   2  u8   type, replies have UDP_REPLY set
+//   3  u8   status of a reply, 0 in requests
+//   4  u32  sequence, increasing per client; events count their own
+//   8  u32  session of the device, changes with every boot
+//  12  u32  relay id
+//  16  u32  alarm id
+//  20  u8   state
+//  21  3    reserved, 0
+//  24  u32  value, depends on the type
+//  28  16   first bytes of the HMAC-SHA256 of bytes 0-27 with the shared key
+#define UDP_MAGIC 0xA5
+#define UDP_VERSION 1
+#define UDP_PACKET_SIZE 44
+#define UDP_SIGNED_SIZE 28
+#define UDP_TAG_SIZE 16
+#define UDP_KEY_SIZE 32
+
+#define UDP_REPLY 0x80
+
+struct UdpPacket
+{
+    enum Type : uint8_t
+    {
+        HELLO = 0x01,       // Reply: session, value = lowest sequence accepted from this client
+        SET_RELAY = 0x02,   // relayId, state. Reply: state, value = receive to GPIO in us
+        GET_RELAY = 0x03,   // relayId. Reply: state
+        SUBSCRIBE = 0x04,   // Reply: value = lease in s, alarm events are sent until it ends
+        ALARM_FIRED = 0x10, // Sent by the device: relayId, alarmId, state, value = unix time
+        EVENT_ACK = 0x11    // sequence of the acknowledged event, not answered
+    };
+
+    enum Status : uint8_t
+    {
+        OK = 0,
+        BAD_SESSION = 1,    // Reply carries the current session, send HELLO
+        STALE_SEQUENCE = 2, // Reply value is the lowest sequence accepted
+        RELAY_NOT_FOUND = 3,
+        UNKNOWN_TYPE = 4
+    };
+
+    uint8_t type = 0;
+    uint8_t status = OK;
+    uint32_t sequence = 0;
+    uint32_t session = 0;
+    uint32_t relayId = 0;
+    uint32_t alarmId = 0;
+    bool state = false;
+    uint32_t value = 0;
+
+    // Reply to this request, with the same type, sequence and relay
+    UdpPacket reply(Status status) const;
+};
+
+// First UDP_TAG_SIZE bytes of the HMAC-SHA256 of data with the key. Also signs cluster packets
+void signUdpData(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], uint8_t *tag);
+// Compare a tag with the signature of data in constant time
+bool checkUdpTag(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], const uint8_t *tag);
+
+// Write a signed packet into out, which holds UDP_PACKET_SIZE bytes
+void encodeUdpPacket(const UdpPacket &packet, const uint8_t key[UDP_KEY_SIZE], uint8_t *out);
+
+// Read a packet. False if the size, magic, version or signature do not match
+bool decodeUdpPacket(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], UdpPacket &packet);
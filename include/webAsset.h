@@ -0,0 +1,31 @@
+#pragma once
+#include <Arduino.h>
+
+// Marks an empty slot of the web asset hash table
+#define WEB_ASSET_NONE 0xFF
+
+// Gzipped file of the web UI, embedded into the firmware at build time by
+// scripts/embed_data.py
+struct WebAsset
+{
+    const char *path;
+    const char *contentType;
+    const char *etag;
+    const uint8_t *data;
+    size_t length;
+};
+
+constexpr uint32_t webAssetHashStep(const char *path, uint32_t hash)
+{
+    return *path ? webAssetHashStep(path + 1, (uint32_t)((hash ^ (uint8_t)*path) * 16777619UL)) : hash;
+}
+
+// FNV-1a with a seed, the build script picks the seed that maps every path of
+// the UI to its own slot. constexpr so the generated table is checked at compile time
+constexpr uint32_t webAssetHash(const char *path, uint32_t seed)
+{
+    return webAssetHashStep(path, 2166136261UL ^ seed);
+}
+
+// Embedded asset for a request path or nullptr. One hash and one string compare
+const WebAsset *findWebAsset(const char *path);
@@ -0,0 +1,38 @@
+# Writes a gzip copy next to every static file in data/ so the web server can
+# send it to clients that accept gzip. Runs before every PlatformIO build, so
+# "pio run -t uploadfs" always ships up to date copies.
+import gzip
+import os
+
+Import("env")
+
+COMPRESSIBLE = (".html", ".htm", ".css", ".js", ".ico", ".xml", ".json", ".svg")
+
+
+def compress_data(data_dir):
+    for root, _, files in os.walk(data_dir):
+        for name in files:
+            if not name.endswith(COMPRESSIBLE):
+                continue
+
+            source = os.path.join(root, name)
+            target = source + ".gz"
+            if os.path.exists(target) and os.path.getmtime(target) >= os.path.getmtime(source):
+                continue
+
+            with open(source, "rb") as f:
+                content = f.read()
+            compressed = gzip.compress(content, compresslevel=9, mtime=0)
+
+            # Not worth it for tiny files, the server falls back to the plain file
+            if len(compressed) >= len(content):
+                if os.path.exists(target):
+                    os.remove(target)
+                continue
+
+            with open(target, "wb") as f:
+                f.write(compressed)
+            print("Compressed %s: %d -> %d bytes" % (source, len(content), len(compressed)))
+
+
+compress_data(os.path.join(env.subst("$PROJECT_DIR"), "data"))
@@ -0,0 +1,145 @@
+# Bundles the web UI from data/ into the firmware. Every file is minified where
+# that is safe, gzipped and written as a byte array into include/webAssetData.h
+# together with a perfect hash table of the request paths, so the UI is served
+# from flash without touching SPIFFS and always matches the firmware.
+import gzip
+import os
+import re
+import zlib
+
+Import("env")
+
+CONTENT_TYPES = {
+    ".htm": "text/html",
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".png": "image/png",
+    ".gif": "image/gif",
+    ".jpg": "image/jpeg",
+    ".ico": "image/x-icon",
+    ".xml": "text/xml",
+    ".svg": "image/svg+xml",
+    ".json": "application/json",
+}
+
+FNV_OFFSET = 2166136261
+FNV_PRIME = 16777619
+MAX_SEED = 1000000
+NO_ASSET = 0xFF
+
+
+def fnv1a(path, seed):
+    h = FNV_OFFSET ^ seed
+    for c in path.encode():
+        h = ((h ^ c) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def minify(name, content):
+    # Only whitespace and comments are removed. JavaScript is left as is since
+    # template literals make line based stripping unsafe, gzip covers the rest
+    if name.endswith(".css"):
+        text = re.sub(r"/\*.*?\*/", "", content.decode("utf-8"), flags=re.S)
+    elif name.endswith((".html", ".htm")):
+        text = re.sub(r"<!--.*?-->", "", content.decode("utf-8"), flags=re.S)
+    else:
+        return content
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line).encode("utf-8")
+
+
+def collect_assets(data_dir):
+    assets = []
+    for root, _, files in os.walk(data_dir):
+        for name in sorted(files):
+            extension = os.path.splitext(name)[1]
+            if extension not in CONTENT_TYPES:
+                continue
+
+            source = os.path.join(root, name)
+            with open(source, "rb") as f:
+                content = minify(name, f.read())
+            compressed = gzip.compress(content, compresslevel=9, mtime=0)
+            etag = '"%x-%x"' % (zlib.crc32(compressed), len(compressed))
+
+            path = "/" + os.path.relpath(source, data_dir).replace(os.sep, "/")
+            paths = [path]
+            # handleFileRead resolves /dir to /dir/index.html
+            if name == "index.html" and path != "/index.html":
+                paths.append(path[: -len("/index.html")])
+
+            assets.append((paths, CONTENT_TYPES[extension], etag, compressed))
+    return sorted(assets)
+
+
+def build_table(paths):
+    for size in range(max(len(paths), 1), 4 * len(paths) + 2):
+        for seed in range(MAX_SEED):
+            slots = set(fnv1a(path, seed) % size for path in paths)
+            if len(slots) == len(paths):
+                return seed, size
+    raise Exception("No perfect hash found for the web assets")
+
+
+def write_header(target, assets):
+    entries = []  # (path, asset index)
+    for index, (paths, _, _, _) in enumerate(assets):
+        entries += [(path, index) for path in paths]
+    if len(entries) >= NO_ASSET:
+        raise Exception("Too many web assets for an 8 bit table")
+    seed, size = build_table([path for path, _ in entries])
+
+    table = [NO_ASSET] * size
+    for number, (path, _) in enumerate(entries):
+        table[fnv1a(path, seed) % size] = number
+
+    out = []
+    out.append("// Generated by scripts/embed_data.py from data/, do not edit")
+    out.append("#pragma once")
+    out.append('#include "webAsset.h"')
+    out.append("")
+    out.append("#define WEB_ASSET_COUNT %d" % len(entries))
+    out.append("#define WEB_ASSET_SEED 0x%XUL" % seed)
+    out.append("#define WEB_ASSET_TABLE_SIZE %d" % size)
+    out.append("")
+    for index, (paths, _, _, data) in enumerate(assets):
+        out.append("// %s, %d bytes" % (paths[0], len(data)))
+        out.append("static const uint8_t webAssetData%d[] PROGMEM = {" % index)
+        for i in range(0, len(data), 16):
+            out.append("    " + ", ".join("0x%02x" % b for b in data[i : i + 16]) + ",")
+        out.append("};")
+        out.append("")
+
+    if entries:
+        out.append("static const WebAsset webAssets[WEB_ASSET_COUNT] = {")
+        for path, index in entries:
+            _, content_type, etag, data = assets[index]
+            etag = etag.replace('"', '\\"')
+            out.append('    {"%s", "%s", "%s", webAssetData%d, %d},' % (path, content_type, etag, index, len(data)))
+        out.append("};")
+        out.append("")
+
+    out.append("// Index into webAssets by hash slot, WEB_ASSET_NONE if the slot is empty")
+    out.append("static const uint8_t webAssetTable[WEB_ASSET_TABLE_SIZE] = {%s};" % ", ".join(
+        "WEB_ASSET_NONE" if number == NO_ASSET else str(number) for number in table))
+    out.append("")
+    for number, (path, _) in enumerate(entries):
+        out.append('static_assert(webAssetHash("%s", WEB_ASSET_SEED) %% WEB_ASSET_TABLE_SIZE == %d, "Web asset table is out of date");'
+                   % (path, fnv1a(path, seed) % size))
+    out.append("")
+
+    content = "\n".join(out)
+    # Keep the timestamp when nothing changed to avoid rebuilding
+    if os.path.exists(target):
+        with open(target) as f:
+            if f.read() == content:
+                return
+    with open(target, "w") as f:
+        f.write(content)
+    print("Embedded %d web assets, %d bytes" % (len(assets), sum(len(a[3]) for a in assets)))
+
+
+project_dir = env.subst("$PROJECT_DIR")
+write_header(os.path.join(project_dir, "include", "webAssetData.h"),
+             collect_assets(os.path.join(project_dir, "data")))
@@ -1,229 +1,161 @@
 #include "alarm.h"
-#include <iostream>
-#include <fstream>
+#include "alarmScheduler.h"
+#include "jsonWriter.h"
+#include <StreamString.h>
 
-DateTime Alarm::calculateLastAlarm() const {
-    DateTime lastA = DateTime(0, 0, 0, 0, 0, 0);
-
-    // get last weeeks alarm
-    DateTime now = RTC::getInstance()->now();
-    // get weekday
-    uint8_t weekday = now.dayOfTheWeek();
-
-    for (int i = 0; i < 8; i++)
-    {
-        int day = ((weekday - i) % 7 + 7) % 7;
-        // Serial.println("Checking day last: " + String(day) + " " + String(this->weekdays[day]));
-        if (this->weekdays[day]) {
-            // Calculate the last alarm time
-            DateTime la = DateTime(now.year(), now.month(), now.day(), this->hour, this->minute, this->second);
-            la = la - TimeSpan(i, 0, 0, 0);
-
-            if (la < now) {
-                lastA = la;
-                break;
-            }
-        }
-    }
-
-    // Serial.println("Last alarm: " + String(lastA.year()) + "-" + String(lastA.month()) + "-" + String(lastA.day()) + " " + String(lastA.hour()) + ":" + String(lastA.minute()) + ":" + String(lastA.second()));
-    return lastA;
+Alarm Alarm::create(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, Relay *relay, bool state, uint id)
+{
+    uint32_t record = AlarmTable::pack(hour * 3600 + minute * 60 + second, AlarmTable::weekdayMask(weekdays), state, relay->getIndex());
+    AlarmTable *table = AlarmTable::getInstance();
+    uint16_t slot = table->add(record, id);
+    return Alarm(table->getId(slot), slot);
 }
 
-uint Alarm::idCounter = 0;
-
-Alarm::Alarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, Relay *relay, bool state)
-    : hour(hour), minute(minute), second(second), weekdays(weekdays), relay(relay), state(state)
+uint32_t Alarm::record() const
 {
-    this->id = Alarm::idCounter++;
-
-    this->lastAlarm = this->calculateLastAlarm();
+    return AlarmTable::getInstance()->getRecord(slot);
 }
 
-Alarm::Alarm(String json, Relay *relay)
+void Alarm::update(uint32_t record)
 {
-    DynamicJsonDocument doc(256);
-    DeserializationError error = deserializeJson(doc, json);
-    if (error)
-    {
-        std::cerr << "Failed to deserialize alarm json: " << error.c_str() << std::endl;
-        return;
-    }
-
-    uint id = doc["id"].as<uint>();
-    if (id < idCounter)
-    {
-        id = idCounter++;
-    } else {
-        idCounter = id + 1;
-    }
+    AlarmTable::getInstance()->setRecord(slot, record);
+    AlarmScheduler::getInstance()->schedule(*this);
+    this->getRelay()->invalidateSchedule();
+}
 
-    id = id;
-    hour = doc["hour"];
-    minute = doc["minute"];
-    second = doc["second"];
-    JsonArray weekdaysArray = doc["weekdays"].as<JsonArray>();
-    int counter = 0;
-    for(JsonVariant v : weekdaysArray) {
-        weekdays[counter++] = v.as<bool>();
-    }
-    this->relay = relay;
-    state = doc["state"].as<bool>();
+bool Alarm::isValid() const
+{
+    AlarmTable *table = AlarmTable::getInstance();
+    return table->isUsed(slot) && table->getId(slot) == id;
+}
 
-    // Set last alarm to 0
-    this->lastAlarm = this->calculateLastAlarm();
+uint16_t Alarm::getSlot() const
+{
+    return slot;
 }
 
-uint Alarm::getId()
+uint Alarm::getId() const
 {
     return id;
 }
 
 uint Alarm::getHour() const
 {
-    return hour;
+    return AlarmTable::secondOf(record()) / 3600;
 }
 
 uint Alarm::getMinute() const
 {
-    return minute;
+    return AlarmTable::secondOf(record()) / 60 % 60;
 }
 
 uint Alarm::getSecond() const
 {
-    return second;
+    return AlarmTable::secondOf(record()) % 60;
 }
 
 std::array<bool, 7> Alarm::getWeekdays() const
 {
-    return weekdays;
+    return AlarmTable::weekdayArray(AlarmTable::weekdaysOf(record()));
 }
 
 Relay *Alarm::getRelay() const
 {
-    return relay;
+    return AlarmTable::getInstance()->getRelay(AlarmTable::relayOf(record()));
 }
 
 bool Alarm::getState() const
 {
-    return state;
+    return AlarmTable::stateOf(record());
 }
 
 DateTime Alarm::lastTimeTriggert() const
 {
-    return this->lastAlarm;
+    return DateTime(AlarmTable::lastFireTime(record(), RTC::getInstance()->now().unixtime()));
 }
 
 void Alarm::turnOn()
 {
-    relay->On();
-    this->lastAlarm = RTC::getInstance()->now();
+    this->getRelay()->On();
 }
 
 void Alarm::turnOff()
 {
-    relay->Off();
-    this->lastAlarm = RTC::getInstance()->now();
+    this->getRelay()->Off();
 }
 
 void Alarm::setHour(const uint hour)
 {
-    this->hour = hour;
-    this->lastAlarm = this->calculateLastAlarm();
+    uint32_t r = record();
+    uint32_t second = AlarmTable::secondOf(r) % 3600;
+    this->update((r & ~ALARM_SECOND_MASK) | (hour * 3600 + second));
 }
 
 void Alarm::setMinute(const uint minute)
 {
-    this->minute = minute;
-    this->lastAlarm = this->calculateLastAlarm();
+    uint32_t r = record();
+    uint32_t second = AlarmTable::secondOf(r);
+    this->update((r & ~ALARM_SECOND_MASK) | (second - second % 3600 + minute * 60 + second % 60));
 }
 
 void Alarm::setSecond(const uint second)
 {
-    this->second = second;
-    this->lastAlarm = this->calculateLastAlarm();
+    uint32_t r = record();
+    uint32_t current = AlarmTable::secondOf(r);
+    this->update((r & ~ALARM_SECOND_MASK) | (current - current % 60 + second));
 }
 
 void Alarm::setWeekdays(const std::array<bool, 7> weekdays)
 {
-    this->weekdays = weekdays;
-    this->lastAlarm = this->calculateLastAlarm();
-}
-
-void Alarm::setRelay(Relay *relay)
-{
-    this->relay = relay;
+    uint32_t r = record();
+    this->update(AlarmTable::pack(AlarmTable::secondOf(r), AlarmTable::weekdayMask(weekdays), AlarmTable::stateOf(r), AlarmTable::relayOf(r)));
 }
 
 void Alarm::setState(bool state)
 {
-    this->state = state;
+    uint32_t r = record();
+    this->update(AlarmTable::pack(AlarmTable::secondOf(r), AlarmTable::weekdaysOf(r), state, AlarmTable::relayOf(r)));
 }
 
-// This will check if alarm is in time range between now and the past 24h from now
-bool Alarm::checkAlarm(DateTime now) const {
-
-    uint sec = this->getNextAlarminSeconds(now);
-    DateTime last = this->lastAlarm;
-
-    Serial.println("if ((" + String(sec) + " == 0 || (" + String(sec) + " > 594720 && " + String(sec) + " <= 604800)) && " + String(last < (now - TimeSpan(0, 0, 1, 0))) + "))");
-    if ((sec == 0 || ((sec > (7*24*60*60-60)) && (sec <= (7*24*60*60)))) && (last < (now - TimeSpan(0, 0, 1, 0)))) {
-        Serial.println("Alarm is in time range");
-        return true;
-    }
-    // Serial.println("Alarm is not in time range");
-
-    return false;
+uint32_t Alarm::getNextAlarmUnixtime(uint32_t now) const
+{
+    return AlarmTable::nextFireTime(record(), now);
 }
 
-
-
 uint Alarm::getNextAlarminSeconds(DateTime now) const
 {
-    // get weekday
-    uint8_t weekday = now.dayOfTheWeek();
-
-    for (int i = 0; i < 8; i++)
+    uint32_t nextAlarm = this->getNextAlarmUnixtime(now.unixtime());
+    if (nextAlarm == ALARM_NEVER)
     {
-        int day = (weekday + i) % 7;
-        // Serial.println("Checking day: " + String(day) + " " + String(weekdays[day]));
-        if (weekdays[day])
-        {
-            // Calculate the next alarm time
-            DateTime nextAlarm = DateTime(now.year(), now.month(), now.day(), hour, minute, second);
-            nextAlarm = nextAlarm + TimeSpan(i, 0, 0, 0);
-
-            // Check if the alarm is in the past
-            if (nextAlarm < now)
-            {
-                continue;
-            }
-
-            Serial.println("Now:        " + String(now.year()) + "-" + String(now.month()) + "-" + String(now.day()) + " " + String(now.hour()) + ":" + String(now.minute()) + ":" + String(now.second()));
-            Serial.println("Next alarm: " + String(nextAlarm.year()) + "-" + String(nextAlarm.month()) + "-" + String(nextAlarm.day()) + " " + String(nextAlarm.hour()) + ":" + String(nextAlarm.minute()) + ":" + String(nextAlarm.second()));
-
-            return (nextAlarm - now).totalseconds();
-        }
+        return -1;
     }
 
-    return -1;
+    return nextAlarm - now.unixtime();
 }
 
 String Alarm::toJson() const
 {
-    JsonDocument doc;
-    doc["id"] = id;
-    doc["hour"] = hour;
-    doc["minute"] = minute;
-    doc["second"] = second;
-    doc.createNestedArray("weekdays");
-    for (bool weekday : weekdays)
+    StreamString output;
+    JsonWriter json(output);
+    toJson(json);
+    return output;
+}
+
+void Alarm::toJson(JsonWriter &json) const
+{
+    json.beginObject();
+    json.member("id", id);
+    json.member("hour", getHour());
+    json.member("minute", getMinute());
+    json.member("second", getSecond());
+    json.key("weekdays");
+    json.beginArray();
+    for (bool weekday : getWeekdays())
     {
-        doc["weekdays"].add(weekday);
+        json.value(weekday);
     }
-    doc["relay"] = relay->getId();
-    doc["state"] = state;
-    String jsonString;
-    serializeJson(doc, jsonString);
-    return jsonString;
-}
\ No newline at end of file
+    json.endArray();
+    json.member("relay", getRelay()->getId());
+    json.member("state", getState());
+    json.endObject();
+}
@@ -0,0 +1,552 @@
+#include "alarmScheduler.h"
+#include "relayManager.h"
+#include <esp_timer.h>
+#include <algorithm>
+
+AlarmScheduler *AlarmScheduler::instance = nullptr;
+
+AlarmScheduler::AlarmScheduler()
+{
+    this->table = AlarmTable::getInstance();
+
+    heap.reserve(MAX_ALARMS);
+    positions.reserve(MAX_ALARMS);
+}
+
+void AlarmScheduler::place(size_t index, const Entry &entry)
+{
+    heap[index] = entry;
+    positions[entry.slot] = index;
+}
+
+void AlarmScheduler::siftUp(size_t index)
+{
+    Entry entry = heap[index];
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent].fireAt <= entry.fireAt)
+        {
+            break;
+        }
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, entry);
+}
+
+void AlarmScheduler::siftDown(size_t index)
+{
+    Entry entry = heap[index];
+    size_t count = heap.size();
+    while (true)
+    {
+        size_t child = 2 * index + 1;
+        if (child >= count)
+        {
+            break;
+        }
+        if (child + 1 < count && heap[child + 1].fireAt < heap[child].fireAt)
+        {
+            child++;
+        }
+        if (entry.fireAt <= heap[child].fireAt)
+        {
+            break;
+        }
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, entry);
+}
+
+void AlarmScheduler::erase(size_t index)
+{
+    positions[heap[index].slot] = ALARM_NO_SLOT;
+
+    Entry last = heap.back();
+    heap.pop_back();
+    if (index == heap.size())
+    {
+        return;
+    }
+
+    place(index, last);
+    siftUp(index);
+    siftDown(positions[last.slot]);
+}
+
+void AlarmScheduler::schedule(const Alarm &alarm)
+{
+    this->schedule(alarm, RTC::getInstance()->now().unixtime());
+}
+
+void AlarmScheduler::schedule(const Alarm &alarm, uint32_t now)
+{
+    uint16_t slot = alarm.getSlot();
+    uint32_t fireAt = alarm.getNextAlarmUnixtime(now);
+
+    table->lock();
+    if (positions.size() <= slot)
+    {
+        positions.resize(slot + 1, ALARM_NO_SLOT);
+    }
+
+    if (positions[slot] == ALARM_NO_SLOT)
+    {
+        if (fireAt != ALARM_NEVER)
+        {
+            heap.push_back({fireAt, slot});
+            siftUp(heap.size() - 1);
+        }
+    }
+    else if (fireAt == ALARM_NEVER)
+    {
+        erase(positions[slot]);
+    }
+    else
+    {
+        size_t index = positions[slot];
+        heap[index].fireAt = fireAt;
+        siftUp(index);
+        siftDown(positions[slot]);
+    }
+    table->unlock();
+
+    this->wake();
+}
+
+void AlarmScheduler::remove(const Alarm &alarm)
+{
+    uint16_t slot = alarm.getSlot();
+
+    table->lock();
+    if (slot < positions.size() && positions[slot] != ALARM_NO_SLOT)
+    {
+        erase(positions[slot]);
+    }
+    table->unlock();
+
+    this->wake();
+}
+
+void AlarmScheduler::rebuild(uint32_t now)
+{
+    table->lock();
+    for (Entry &entry : heap)
+    {
+        entry.fireAt = AlarmTable::nextFireTime(table->getRecord(entry.slot), now);
+    }
+    for (size_t i = heap.size() / 2; i-- > 0;)
+    {
+        siftDown(i);
+    }
+    table->unlock();
+
+    this->wake();
+}
+
+uint32_t AlarmScheduler::peekTime() const
+{
+    table->lock();
+    uint32_t fireAt = heap.empty() ? ALARM_NEVER : heap[0].fireAt;
+    table->unlock();
+    return fireAt;
+}
+
+size_t AlarmScheduler::takeDue(uint32_t now, Alarm *due, size_t capacity)
+{
+    size_t count = 0;
+    table->lock();
+    while (!heap.empty() && heap[0].fireAt <= now && count < capacity)
+    {
+        Entry entry = heap[0];
+        uint32_t record = table->getRecord(entry.slot);
+        if (now - entry.fireAt <= ALARM_LATE_TOLERANCE)
+        {
+            due[count++] = Alarm(table->getId(entry.slot), entry.slot);
+        }
+
+        // Move the alarm to its next occurrence after now
+        heap[0].fireAt = AlarmTable::nextFireTime(record, now + 1);
+        siftDown(0);
+    }
+    table->unlock();
+    return count;
+}
+
+size_t AlarmScheduler::size() const
+{
+    table->lock();
+    size_t count = heap.size();
+    table->unlock();
+    return count;
+}
+
+int64_t AlarmScheduler::getLastFireMicros() const
+{
+    return lastFireMicros;
+}
+
+void AlarmScheduler::setFireListener(void (*listener)(const FiredAlarm &alarm))
+{
+    fireListener = listener;
+}
+
+void AlarmScheduler::begin(RelayManager *relays)
+{
+    if (task != nullptr)
+    {
+        return;
+    }
+    this->relays = relays;
+    publish();
+    xTaskCreatePinnedToCore(AlarmScheduler::taskLoop, "scheduler", SCHEDULER_TASK_STACK, this, SCHEDULER_TASK_PRIORITY, &task, APP_CPU_NUM);
+}
+
+void AlarmScheduler::wake()
+{
+    if (task != nullptr)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+SchedulerCommand::Result AlarmScheduler::submit(SchedulerCommand &command)
+{
+    // Before the task started, or from within a command, there is nobody to hand it to
+    if (task == nullptr || xTaskGetCurrentTaskHandle() == task)
+    {
+        table->lock();
+        try
+        {
+            execute(command);
+        }
+        catch (...)
+        {
+            table->unlock();
+            throw;
+        }
+        table->unlock();
+        if (task == nullptr)
+        {
+            publish();
+        }
+        return command.result;
+    }
+
+    std::atomic<bool> done(false);
+    command.caller = xTaskGetCurrentTaskHandle();
+    command.done = &done;
+    SchedulerCommand *pointer = &command;
+    while (!commands.push(pointer))
+    {
+        // Full, give the scheduler task a moment to drain it
+        wake();
+        vTaskDelay(1);
+    }
+    wake();
+
+    // Other tasks may notify the caller for its own loop while it waits here.
+    // Such a notification does not end the wait and is given back afterwards
+    bool stray = false;
+    while (!done.load(std::memory_order_acquire))
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        stray = stray || !done.load(std::memory_order_acquire);
+    }
+    if (stray)
+    {
+        xTaskNotifyGive(command.caller);
+    }
+
+    if (command.error)
+    {
+        std::rethrow_exception(command.error);
+    }
+    return command.result;
+}
+
+void AlarmScheduler::run(const std::function<void()> &call)
+{
+    SchedulerCommand command(SchedulerCommand::CALL);
+    command.call = &call;
+    submit(command);
+}
+
+void AlarmScheduler::execute(SchedulerCommand &command)
+{
+    if (command.type == SchedulerCommand::BATCH)
+    {
+        executeBatch(command);
+        return;
+    }
+
+    apply(command);
+    bool alarmChanged = command.type == SchedulerCommand::ADD_ALARM || command.type == SchedulerCommand::UPDATE_ALARM || command.type == SchedulerCommand::DELETE_ALARM;
+    if (alarmChanged && command.result == SchedulerCommand::OK)
+    {
+        relays->saveConfig();
+    }
+}
+
+void AlarmScheduler::apply(SchedulerCommand &command)
+{
+    if (command.type == SchedulerCommand::CALL)
+    {
+        (*command.call)();
+        return;
+    }
+
+    if (command.type == SchedulerCommand::SET_TIME)
+    {
+        RTC *rtc = RTC::getInstance();
+        rtc->setDateTime(DateTime(command.unixtime));
+        uint32_t now = rtc->now().unixtime();
+        rebuild(now);
+        relays->applySchedule(now);
+        return;
+    }
+
+    Relay *relay = relays->getRelayByID(command.relayId);
+    if (relay == nullptr)
+    {
+        command.result = SchedulerCommand::RELAY_NOT_FOUND;
+        return;
+    }
+
+    if (command.type == SchedulerCommand::SET_RELAY)
+    {
+        if (command.state)
+        {
+            relay->On();
+        }
+        else
+        {
+            relay->Off();
+        }
+        return;
+    }
+
+    if (command.type == SchedulerCommand::ADD_ALARM)
+    {
+        Alarm alarm = relay->addAlarm(command.hour, command.minute, command.second, command.weekdays, command.state);
+        command.alarmId = alarm.getId();
+        return;
+    }
+
+    Alarm alarm = relay->getAlarmByID(command.alarmId);
+    if (!alarm.isValid())
+    {
+        command.result = SchedulerCommand::ALARM_NOT_FOUND;
+        return;
+    }
+
+    if (command.type == SchedulerCommand::UPDATE_ALARM)
+    {
+        alarm.setHour(command.hour);
+        alarm.setMinute(command.minute);
+        alarm.setSecond(command.second);
+        alarm.setWeekdays(command.weekdays);
+        alarm.setState(command.state);
+    }
+    else if (command.type == SchedulerCommand::DELETE_ALARM)
+    {
+        relay->removeAlarm(command.alarmId);
+    }
+}
+
+SchedulerCommand::Result AlarmScheduler::check(const SchedulerCommand &operation, std::vector<uint> &deleted, size_t &alarms) const
+{
+    Relay *relay = relays->getRelayByID(operation.relayId);
+    if (relay == nullptr)
+    {
+        return SchedulerCommand::RELAY_NOT_FOUND;
+    }
+
+    if (operation.type == SchedulerCommand::ADD_ALARM)
+    {
+        if (alarms >= MAX_ALARMS)
+        {
+            return SchedulerCommand::TABLE_FULL;
+        }
+        alarms++;
+        return SchedulerCommand::OK;
+    }
+
+    if (operation.type != SchedulerCommand::UPDATE_ALARM && operation.type != SchedulerCommand::DELETE_ALARM)
+    {
+        return SchedulerCommand::REJECTED;
+    }
+
+    // Alarms added earlier in the batch have no id yet, so they can not be referenced
+    bool wasDeleted = std::find(deleted.begin(), deleted.end(), operation.alarmId) != deleted.end();
+    if (wasDeleted || !relay->getAlarmByID(operation.alarmId).isValid())
+    {
+        return SchedulerCommand::ALARM_NOT_FOUND;
+    }
+
+    if (operation.type == SchedulerCommand::DELETE_ALARM)
+    {
+        deleted.push_back(operation.alarmId);
+        alarms--;
+    }
+    return SchedulerCommand::OK;
+}
+
+// Every operation is checked against the current alarms before the first one is
+// applied, so either all of them take effect or none. The heap is updated per
+// alarm in O(log n) and the configuration is saved once for the whole batch.
+void AlarmScheduler::executeBatch(SchedulerCommand &command)
+{
+    std::vector<SchedulerCommand> &operations = *command.batch;
+    std::vector<uint> deleted;
+    size_t alarms = table->size();
+    bool valid = true;
+    for (SchedulerCommand &operation : operations)
+    {
+        operation.result = check(operation, deleted, alarms);
+        valid = valid && operation.result == SchedulerCommand::OK;
+    }
+
+    if (!valid)
+    {
+        for (SchedulerCommand &operation : operations)
+        {
+            if (operation.result == SchedulerCommand::OK)
+            {
+                operation.result = SchedulerCommand::NOT_EXECUTED;
+            }
+        }
+        command.result = SchedulerCommand::REJECTED;
+        return;
+    }
+
+    for (SchedulerCommand &operation : operations)
+    {
+        apply(operation);
+    }
+    if (!operations.empty())
+    {
+        relays->saveConfig();
+    }
+}
+
+bool AlarmScheduler::runCommands()
+{
+    bool executed = false;
+    SchedulerCommand *command;
+    while (commands.pop(command))
+    {
+        table->lock();
+        try
+        {
+            execute(*command);
+        }
+        catch (...)
+        {
+            command->error = std::current_exception();
+        }
+        table->unlock();
+
+        // The command lives on the stack of the caller, which may return as soon as done is set
+        TaskHandle_t caller = command->caller;
+        command->done->store(true, std::memory_order_release);
+        xTaskNotifyGive(caller);
+        executed = true;
+    }
+    return executed;
+}
+
+void AlarmScheduler::publish()
+{
+    if (relays != nullptr)
+    {
+        std::shared_ptr<const RelaySnapshot> next = relays->snapshot();
+        std::atomic_store(&snapshot, next);
+    }
+}
+
+std::shared_ptr<const RelaySnapshot> AlarmScheduler::getSnapshot() const
+{
+    return std::atomic_load(&snapshot);
+}
+
+void AlarmScheduler::fire(Alarm alarm)
+{
+    if (alarm.getState())
+    {
+        alarm.turnOn();
+    }
+    else
+    {
+        alarm.turnOff();
+    }
+}
+
+void AlarmScheduler::taskLoop(void *param)
+{
+    AlarmScheduler *scheduler = static_cast<AlarmScheduler *>(param);
+
+    while (true)
+    {
+        // Changes from the web server and the main loop, they may move the clock or the alarms
+        bool changed = scheduler->runCommands();
+
+        uint64_t nowMicros = RTC::getInstance()->nowMicros();
+        uint32_t now = nowMicros / 1000000;
+
+        // Switch under the lock so a concurrently deleted alarm can not be freed mid-way. The serial
+        // and network output only needs the copies, so other tasks do not wait for it
+        bool anyFired = false;
+        size_t count;
+        do
+        {
+            Alarm due[SCHEDULER_FIRE_BATCH];
+            FiredAlarm fired[SCHEDULER_FIRE_BATCH];
+            scheduler->table->lock();
+            count = scheduler->takeDue(now, due, SCHEDULER_FIRE_BATCH);
+            for (size_t i = 0; i < count; i++)
+            {
+                scheduler->fire(due[i]);
+                fired[i] = {due[i].getRelay()->getId(), due[i].getId(), due[i].getState(), now};
+            }
+            if (count > 0)
+            {
+                scheduler->lastFireMicros = esp_timer_get_time();
+                anyFired = true;
+            }
+            scheduler->table->unlock();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                Serial.printf("Relay %u turned %s by alarm %u\n", fired[i].relayId, fired[i].state ? "on" : "off", fired[i].alarmId);
+                if (scheduler->fireListener != nullptr)
+                {
+                    scheduler->fireListener(fired[i]);
+                }
+            }
+        } while (count == SCHEDULER_FIRE_BATCH);
+
+        uint32_t next = scheduler->peekTime();
+
+        // Readers see relay states and alarms from the snapshot
+        if (changed || anyFired)
+        {
+            scheduler->publish();
+        }
+
+        // Sleep until the second boundary of the next alarm, rounded up to the next tick
+        TickType_t wait = portMAX_DELAY;
+        if (next != ALARM_NEVER)
+        {
+            uint64_t ms = next > now ? ((uint64_t)next * 1000000 - nowMicros + 999) / 1000 : 1;
+            wait = pdMS_TO_TICKS((uint32_t)std::min(ms, (uint64_t)SCHEDULER_MAX_SLEEP));
+            if (wait == 0)
+            {
+                wait = 1;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
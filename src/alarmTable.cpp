@@ -0,0 +1,226 @@
+#include "alarmTable.h"
+
+AlarmTable *AlarmTable::instance = nullptr;
+
+AlarmTable::AlarmTable()
+{
+    this->mutex = xSemaphoreCreateRecursiveMutex();
+
+    records.reserve(MAX_ALARMS);
+    ids.reserve(MAX_ALARMS);
+    byId.reserve(MAX_ALARMS);
+    freeSlots.reserve(MAX_ALARMS);
+    relays.reserve(ALARM_MAX_RELAYS);
+}
+
+void AlarmTable::lock()
+{
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+void AlarmTable::unlock()
+{
+    xSemaphoreGiveRecursive(mutex);
+}
+
+uint8_t AlarmTable::registerRelay(Relay *relay)
+{
+    for (size_t i = 0; i < relays.size(); i++)
+    {
+        if (relays[i] == nullptr)
+        {
+            relays[i] = relay;
+            return i;
+        }
+    }
+    if (relays.size() >= ALARM_MAX_RELAYS)
+    {
+        throw std::runtime_error("Too many relays");
+    }
+    relays.push_back(relay);
+    return relays.size() - 1;
+}
+
+void AlarmTable::unregisterRelay(uint8_t index)
+{
+    if (index < relays.size())
+    {
+        relays[index] = nullptr;
+    }
+}
+
+Relay *AlarmTable::getRelay(uint8_t index) const
+{
+    if (index < relays.size())
+    {
+        return relays[index];
+    }
+    return nullptr;
+}
+
+size_t AlarmTable::lowerBound(uint id) const
+{
+    size_t low = 0;
+    size_t high = byId.size();
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (ids[byId[mid]] < id)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+uint16_t AlarmTable::add(uint32_t record, uint id)
+{
+    lock();
+    if (count >= MAX_ALARMS)
+    {
+        unlock();
+        throw std::runtime_error("Alarm table is full");
+    }
+
+    size_t position = lowerBound(id);
+    if (id == ALARM_FREE_ID || (position < byId.size() && ids[byId[position]] == id))
+    {
+        // The counter is above every id in the table, so the new id sorts last
+        id = idCounter++;
+        position = byId.size();
+    }
+    else if (id >= idCounter)
+    {
+        idCounter = id + 1;
+    }
+
+    uint16_t slot;
+    if (!freeSlots.empty())
+    {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        records[slot] = record;
+        ids[slot] = id;
+    }
+    else
+    {
+        slot = records.size();
+        records.push_back(record);
+        ids.push_back(id);
+    }
+
+    byId.insert(byId.begin() + position, slot);
+    count++;
+    unlock();
+
+    return slot;
+}
+
+void AlarmTable::remove(uint16_t slot)
+{
+    lock();
+    if (!isUsed(slot))
+    {
+        unlock();
+        return;
+    }
+
+    byId.erase(byId.begin() + lowerBound(ids[slot]));
+    ids[slot] = ALARM_FREE_ID;
+    records[slot] = 0;
+    freeSlots.push_back(slot);
+    count--;
+    unlock();
+}
+
+uint16_t AlarmTable::find(uint id) const
+{
+    size_t position = lowerBound(id);
+    if (position < byId.size() && ids[byId[position]] == id)
+    {
+        return byId[position];
+    }
+    return ALARM_NO_SLOT;
+}
+
+uint32_t AlarmTable::pack(uint32_t secondOfDay, uint8_t weekdayMask, bool state, uint8_t relayIndex)
+{
+    return (secondOfDay & ALARM_SECOND_MASK) | ((uint32_t)(weekdayMask & 0x7F) << ALARM_WEEKDAY_SHIFT) | ((uint32_t)state << ALARM_STATE_SHIFT) | ((uint32_t)relayIndex << ALARM_RELAY_SHIFT);
+}
+
+uint8_t AlarmTable::weekdayMask(const std::array<bool, 7> &weekdays)
+{
+    uint8_t mask = 0;
+    for (int i = 0; i < 7; i++)
+    {
+        if (weekdays[i])
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+std::array<bool, 7> AlarmTable::weekdayArray(uint8_t mask)
+{
+    std::array<bool, 7> weekdays;
+    for (int i = 0; i < 7; i++)
+    {
+        weekdays[i] = mask & (1 << i);
+    }
+    return weekdays;
+}
+
+uint32_t AlarmTable::nextFireTime(uint32_t record, uint32_t now)
+{
+    uint32_t alarmSecond = secondOf(record);
+    uint8_t mask = weekdaysOf(record);
+    uint32_t dayStart = now - now % 86400;
+    uint8_t weekday = (now / 86400 + 4) % 7; // 1970-01-01 was a Thursday
+
+    for (int i = 0; i < 8; i++)
+    {
+        int day = (weekday + i) % 7;
+        if (mask & (1 << day))
+        {
+            uint32_t nextAlarm = dayStart + i * 86400 + alarmSecond;
+
+            // Check if the alarm is in the past
+            if (nextAlarm < now)
+            {
+                continue;
+            }
+
+            return nextAlarm;
+        }
+    }
+
+    return ALARM_NEVER;
+}
+
+uint32_t AlarmTable::lastFireTime(uint32_t record, uint32_t now)
+{
+    uint32_t alarmSecond = secondOf(record);
+    uint8_t mask = weekdaysOf(record);
+    uint32_t dayStart = now - now % 86400;
+    uint8_t weekday = (now / 86400 + 4) % 7;
+
+    for (int i = 0; i < 8; i++)
+    {
+        int day = (weekday + 7 - i) % 7;
+        if (mask & (1 << day))
+        {
+            uint32_t lastAlarm = dayStart - i * 86400 + alarmSecond;
+            if (lastAlarm < now)
+            {
+                return lastAlarm;
+            }
+        }
+    }
+
+    return 0;
+}
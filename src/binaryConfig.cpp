@@ -0,0 +1,110 @@
+#include "binaryConfig.h"
+#include "esp_crc.h"
+
+BinaryWriter::BinaryWriter(uint8_t type)
+{
+    writeU16(CONFIG_MAGIC);
+    writeU8(CONFIG_VERSION);
+    writeU8(type);
+}
+
+void BinaryWriter::writeU8(uint8_t value)
+{
+    data.push_back(value);
+}
+
+void BinaryWriter::writeU16(uint16_t value)
+{
+    writeU8(value & 0xFF);
+    writeU8(value >> 8);
+}
+
+void BinaryWriter::writeU32(uint32_t value)
+{
+    writeU16(value & 0xFFFF);
+    writeU16(value >> 16);
+}
+
+void BinaryWriter::writeString(const String &value)
+{
+    size_t length = min(value.length(), (unsigned int)255);
+    writeU8(length);
+    data.insert(data.end(), value.c_str(), value.c_str() + length);
+}
+
+const std::vector<uint8_t> &BinaryWriter::finish()
+{
+    writeU32(esp_crc32_le(0, data.data(), data.size()));
+    return data;
+}
+
+BinaryReader::BinaryReader(const std::vector<uint8_t> &data, uint8_t type) : data(data), position(0), end(0), valid(false)
+{
+    if (data.size() < 8)
+    {
+        return;
+    }
+
+    end = data.size() - 4;
+    uint32_t crc = data[end] | (data[end + 1] << 8) | (data[end + 2] << 16) | ((uint32_t)data[end + 3] << 24);
+    if (crc != esp_crc32_le(0, data.data(), end))
+    {
+        return;
+    }
+
+    valid = true;
+    if (readU16() != CONFIG_MAGIC || readU8() != CONFIG_VERSION || readU8() != type)
+    {
+        valid = false;
+    }
+}
+
+bool BinaryReader::isValid() const
+{
+    return valid;
+}
+
+bool BinaryReader::take(size_t length)
+{
+    if (!valid || end - position < length)
+    {
+        valid = false;
+        return false;
+    }
+    position += length;
+    return true;
+}
+
+uint8_t BinaryReader::readU8()
+{
+    return take(1) ? data[position - 1] : 0;
+}
+
+uint16_t BinaryReader::readU16()
+{
+    uint16_t low = readU8();
+    return low | (readU8() << 8);
+}
+
+uint32_t BinaryReader::readU32()
+{
+    uint32_t low = readU16();
+    return low | ((uint32_t)readU16() << 16);
+}
+
+String BinaryReader::readString()
+{
+    size_t length = readU8();
+    if (!take(length))
+    {
+        return String();
+    }
+
+    String value;
+    value.reserve(length);
+    for (size_t i = position - length; i < position; i++)
+    {
+        value += (char)data[i];
+    }
+    return value;
+}
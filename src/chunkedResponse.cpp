@@ -0,0 +1,75 @@
+#include "chunkedResponse.h"
+
+ChunkedResponse::ChunkedResponse(WebServer &server, int status, const char *contentType) : server(server)
+{
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(status, contentType, "");
+}
+
+ChunkedResponse::~ChunkedResponse()
+{
+    end();
+}
+
+size_t ChunkedResponse::write(uint8_t c)
+{
+    if (length == sizeof(buffer))
+    {
+        sendChunk();
+    }
+    buffer[length++] = c;
+    return 1;
+}
+
+size_t ChunkedResponse::write(const uint8_t *data, size_t size)
+{
+    size_t remaining = size;
+    while (remaining > 0)
+    {
+        if (length == sizeof(buffer))
+        {
+            sendChunk();
+        }
+        size_t part = std::min(remaining, sizeof(buffer) - length);
+        memcpy(buffer + length, data, part);
+        length += part;
+        data += part;
+        remaining -= part;
+    }
+    return size;
+}
+
+void ChunkedResponse::sendChunk()
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    server.sendContent(buffer, length);
+    length = 0;
+}
+
+void ChunkedResponse::end()
+{
+    if (ended)
+    {
+        return;
+    }
+    ended = true;
+
+    sendChunk();
+    server.sendContent(""); // Terminating chunk
+}
+
+void ChunkedResponse::abort()
+{
+    if (ended)
+    {
+        return;
+    }
+    ended = true;
+
+    // Without the terminating chunk the client sees the body is incomplete
+    server.client().stop();
+}
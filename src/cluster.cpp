@@ -0,0 +1,358 @@
+#include "cluster.h"
+#include "configManager.h"
+#include <algorithm>
+#include <esp_timer.h>
+
+Cluster *Cluster::instance = nullptr;
+
+Cluster::Cluster()
+{
+    mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void Cluster::lock() const
+{
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+void Cluster::unlock() const
+{
+    xSemaphoreGiveRecursive(mutex);
+}
+
+void Cluster::notify()
+{
+    if (task != nullptr)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+uint64_t Cluster::localMicros()
+{
+    return rtc->nowMicros() - rtc->getOffsetMicros();
+}
+
+bool Cluster::isActive() const
+{
+    return networkUp && enabled && node != nullptr;
+}
+
+void Cluster::begin(AlarmScheduler *scheduler, RTC *rtc, uint32_t nodeId)
+{
+    if (task != nullptr)
+    {
+        return;
+    }
+    this->scheduler = scheduler;
+    this->rtc = rtc;
+
+    lock();
+    this->nodeId = nodeId;
+    enabled = ConfigManager::getInstance()->getConfig("cluster", "0") == "1";
+    loadGroups();
+    unlock();
+
+    xTaskCreatePinnedToCore(Cluster::taskLoop, "cluster", CLUSTER_TASK_STACK, this, CLUSTER_TASK_PRIORITY, &task, PRO_CPU_NUM);
+}
+
+void Cluster::setKey(const uint8_t *key)
+{
+    // A new node forgets the peers, they are heard again within a beacon interval.
+    // It starts from the current offset, so the clock does not jump
+    lock();
+    if (key != nullptr)
+    {
+        node.reset(new ClusterNode(transport, nodeId, key, rtc != nullptr ? rtc->getOffsetMicros() : 0));
+    }
+    else
+    {
+        node.reset();
+    }
+    unlock();
+    notify();
+}
+
+void Cluster::setNetwork(bool up)
+{
+    lock();
+    networkUp = up;
+    unlock();
+    notify();
+}
+
+void Cluster::setEnabled(bool enabled)
+{
+    lock();
+    this->enabled = enabled;
+    ConfigManager::getInstance()->setConfig("cluster", enabled ? "1" : "0");
+    unlock();
+    notify();
+}
+
+// Stored as "name=0,1;other=2"
+void Cluster::loadGroups()
+{
+    String config = ConfigManager::getInstance()->getConfig("clusterGroups", "");
+    groups.clear();
+    int start = 0;
+    while (start < (int)config.length())
+    {
+        int end = config.indexOf(';', start);
+        if (end < 0)
+        {
+            end = config.length();
+        }
+        String entry = config.substring(start, end);
+        start = end + 1;
+
+        int equals = entry.indexOf('=');
+        if (equals <= 0)
+        {
+            continue;
+        }
+        Group group;
+        group.name = entry.substring(0, equals);
+        int position = equals + 1;
+        while (position < (int)entry.length())
+        {
+            int comma = entry.indexOf(',', position);
+            if (comma < 0)
+            {
+                comma = entry.length();
+            }
+            group.relays.push_back(entry.substring(position, comma).toInt());
+            position = comma + 1;
+        }
+        groups.push_back(group);
+    }
+}
+
+void Cluster::setGroups(const std::vector<Group> &groups)
+{
+    String config;
+    for (const Group &group : groups)
+    {
+        if (config.length() > 0)
+        {
+            config += ';';
+        }
+        config += group.name + "=";
+        for (size_t i = 0; i < group.relays.size(); i++)
+        {
+            if (i > 0)
+            {
+                config += ',';
+            }
+            config += String(group.relays[i]);
+        }
+    }
+
+    lock();
+    this->groups = groups;
+    ConfigManager::getInstance()->setConfig("clusterGroups", config);
+    unlock();
+}
+
+void Cluster::eraseConfig()
+{
+    ConfigManager *config = ConfigManager::getInstance();
+    lock();
+    enabled = false;
+    groups.clear();
+    config->eraseConfig("cluster");
+    config->eraseConfig("clusterGroups");
+    unlock();
+    notify();
+}
+
+std::vector<Cluster::Group> Cluster::getGroups() const
+{
+    lock();
+    std::vector<Group> result = groups;
+    unlock();
+    return result;
+}
+
+bool Cluster::isValidGroupName(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length >= CLUSTER_GROUP_SIZE)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = name[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Cluster::sendGroupCommand(const char *group, bool state, uint64_t &at)
+{
+    lock();
+    bool running = isActive() && transport.isOpen();
+    if (running)
+    {
+        at = node->sendCommand(group, state, localMicros(), CLUSTER_COMMAND_LEAD);
+    }
+    unlock();
+
+    // The task waits for the command from now on
+    notify();
+    return running;
+}
+
+Cluster::Status Cluster::getStatus()
+{
+    lock();
+    Status status = {};
+    status.enabled = enabled;
+    status.running = isActive() && transport.isOpen();
+    status.nodeId = nodeId;
+    status.master = nodeId;
+    status.now = localMicros();
+    if (node != nullptr)
+    {
+        status.master = node->getMaster();
+        status.synced = node->isSynced();
+        status.offset = node->getOffset();
+        status.peers = node->getPeers();
+    }
+    unlock();
+    return status;
+}
+
+void Cluster::apply(const ClusterNode::Command &command)
+{
+    std::vector<uint> relays;
+    lock();
+    for (const Group &group : groups)
+    {
+        if (group.name == command.group)
+        {
+            relays = group.relays;
+        }
+    }
+    unlock();
+
+    for (uint relayId : relays)
+    {
+        SchedulerCommand set(SchedulerCommand::SET_RELAY);
+        set.relayId = relayId;
+        set.state = command.state;
+        scheduler->submit(set);
+    }
+    if (!relays.empty())
+    {
+        Serial.println("Cluster group " + String(command.group) + " turned " + (command.state ? "on" : "off"));
+    }
+}
+
+void Cluster::poll()
+{
+    // Wake up in time for the next command
+    lock();
+    if (node == nullptr)
+    {
+        unlock();
+        return;
+    }
+    uint64_t next = node->nextDue();
+    uint64_t now = node->clusterTime(localMicros());
+    unlock();
+    uint32_t wait = CLUSTER_POLL;
+    if (next != UINT64_MAX)
+    {
+        wait = next > now ? std::min((uint64_t)CLUSTER_POLL, (next - now) / 1000) : 0;
+    }
+
+    uint8_t data[CLUSTER_PACKET_SIZE + 1]; // One more to tell longer packets apart
+    size_t length = transport.receive(data, sizeof(data), wait);
+
+    std::vector<ClusterNode::Command> commands;
+    lock();
+    if (node == nullptr)
+    {
+        unlock();
+        return;
+    }
+    uint64_t local = localMicros();
+    if (length > 0)
+    {
+        node->handle(data, length, local);
+    }
+
+    int64_t time = esp_timer_get_time();
+    if (time - lastBeacon >= CLUSTER_BEACON_INTERVAL)
+    {
+        node->expire(local);
+        node->sendBeacon(local);
+        lastBeacon = time;
+    }
+
+    ClusterNode::Command command;
+    while (node->takeDue(local, command))
+    {
+        commands.push_back(command);
+    }
+    int64_t offset = node->getOffset();
+    unlock();
+
+    // Alarms follow the cluster time
+    if (offset != rtc->getOffsetMicros())
+    {
+        rtc->setOffsetMicros(offset);
+        scheduler->wake();
+    }
+
+    for (const ClusterNode::Command &due : commands)
+    {
+        apply(due);
+    }
+}
+
+void Cluster::taskLoop(void *param)
+{
+    Cluster *cluster = static_cast<Cluster *>(param);
+
+    while (true)
+    {
+        cluster->lock();
+        bool active = cluster->isActive();
+        bool open = cluster->transport.isOpen();
+        if (!active && open)
+        {
+            cluster->transport.close();
+            Serial.println("Cluster stopped");
+        }
+        else if (active && !open)
+        {
+            open = cluster->transport.open();
+            if (open)
+            {
+                Serial.println("Cluster started, node " + String(cluster->nodeId, HEX));
+            }
+        }
+        cluster->unlock();
+
+        if (!active)
+        {
+            // Until the settings or the network change
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (!open)
+        {
+            // Retried on the next change or after a while
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        cluster->poll();
+    }
+}
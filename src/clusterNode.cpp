@@ -0,0 +1,267 @@
+#include "clusterNode.h"
+#include <algorithm>
+#include <cstring>
+
+#define CLUSTER_MAGIC 0xA6
+#define CLUSTER_VERSION 1
+
+static void writeU32(uint8_t *out, uint32_t value)
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        out[i] = value;
+        value >>= 8;
+    }
+}
+
+static void writeU64(uint8_t *out, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        out[i] = value;
+        value >>= 8;
+    }
+}
+
+static uint64_t readBigEndian(const uint8_t *data, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+ClusterNode::ClusterNode(ClusterTransport &transport, uint32_t nodeId, const uint8_t *key, int64_t offset) : transport(transport), nodeId(nodeId), offset(offset), master(nodeId)
+{
+    memcpy(this->key, key, UDP_KEY_SIZE);
+}
+
+void ClusterNode::encode(Type type, const Command *command, uint64_t local, uint8_t *out)
+{
+    // Receivers drop packets that are not newer than the last one. Small corrections of
+    // the offset must not make them look old; after a large step back peers time out
+    uint64_t sent = clusterTime(local);
+    if (sent <= lastSent && lastSent - sent < CLUSTER_STEP)
+    {
+        sent = lastSent + 1;
+    }
+    lastSent = sent;
+
+    memset(out, 0, CLUSTER_PACKET_SIZE);
+    out[0] = CLUSTER_MAGIC;
+    out[1] = CLUSTER_VERSION;
+    out[2] = type;
+    writeU32(out + 4, nodeId);
+    writeU64(out + 8, sent);
+    if (command != nullptr)
+    {
+        out[3] = command->state;
+        writeU64(out + 16, command->at);
+        memcpy(out + 24, command->group, CLUSTER_GROUP_SIZE);
+    }
+    signUdpData(out, CLUSTER_SIGNED_SIZE, key, out + CLUSTER_SIGNED_SIZE);
+}
+
+void ClusterNode::sendBeacon(uint64_t local)
+{
+    uint8_t out[CLUSTER_PACKET_SIZE];
+    encode(BEACON, nullptr, local, out);
+    transport.send(out, sizeof(out));
+}
+
+uint64_t ClusterNode::sendCommand(const char *group, bool state, uint64_t local, uint32_t lead)
+{
+    Command command = {};
+    strncpy(command.group, group, CLUSTER_GROUP_SIZE - 1);
+    command.state = state;
+    command.at = clusterTime(local) + lead;
+    command.from = nodeId;
+
+    // The copies are identical, receivers apply the first and drop the others as replays
+    uint8_t out[CLUSTER_PACKET_SIZE];
+    encode(GROUP_COMMAND, &command, local, out);
+    for (int i = 0; i < CLUSTER_COMMAND_REPEATS; i++)
+    {
+        transport.send(out, sizeof(out));
+    }
+    queue(command);
+    return command.at;
+}
+
+void ClusterNode::handle(const uint8_t *data, size_t length, uint64_t local)
+{
+    if (length != CLUSTER_PACKET_SIZE || data[0] != CLUSTER_MAGIC || data[1] != CLUSTER_VERSION ||
+        !checkUdpTag(data, CLUSTER_SIGNED_SIZE, key, data + CLUSTER_SIGNED_SIZE))
+    {
+        return;
+    }
+
+    uint32_t sender = readBigEndian(data + 4, 4);
+    uint64_t sent = readBigEndian(data + 8, 8);
+    if (sender == nodeId)
+    {
+        return;
+    }
+
+    Peer *peer = findPeer(sender, local);
+    if (sent <= peer->lastSent)
+    {
+        return;
+    }
+    peer->lastSent = sent;
+    peer->lastSeen = local;
+    updateMaster();
+
+    if (data[2] == BEACON)
+    {
+        if (sender == master)
+        {
+            sync((int64_t)(sent - local));
+        }
+        return;
+    }
+
+    if (data[2] == GROUP_COMMAND && isSynced())
+    {
+        Command command;
+        command.state = data[3] != 0;
+        command.at = readBigEndian(data + 16, 8);
+        memcpy(command.group, data + 24, CLUSTER_GROUP_SIZE);
+        command.group[CLUSTER_GROUP_SIZE - 1] = '\0';
+        command.from = sender;
+
+        // Also stops commands recorded earlier from being sent again
+        uint64_t now = clusterTime(local);
+        if (command.at + CLUSTER_LATE_TOLERANCE >= now && command.at <= now + CLUSTER_MAX_LEAD)
+        {
+            queue(command);
+        }
+    }
+}
+
+void ClusterNode::expire(uint64_t local)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        if (local - peers[i].lastSeen <= CLUSTER_PEER_TIMEOUT)
+        {
+            peers[kept++] = peers[i];
+        }
+    }
+    peers.resize(kept);
+    updateMaster();
+}
+
+ClusterNode::Peer *ClusterNode::findPeer(uint32_t id, uint64_t local)
+{
+    Peer *oldest = nullptr;
+    for (Peer &peer : peers)
+    {
+        if (peer.nodeId == id)
+        {
+            return &peer;
+        }
+        if (oldest == nullptr || peer.lastSeen < oldest->lastSeen)
+        {
+            oldest = &peer;
+        }
+    }
+
+    Peer peer = {id, 0, local};
+    if (peers.size() < CLUSTER_MAX_PEERS)
+    {
+        peers.push_back(peer);
+        return &peers.back();
+    }
+    *oldest = peer;
+    return oldest;
+}
+
+void ClusterNode::updateMaster()
+{
+    uint32_t lowest = nodeId;
+    for (const Peer &peer : peers)
+    {
+        if (peer.nodeId < lowest)
+        {
+            lowest = peer.nodeId;
+        }
+    }
+
+    // Keep the offset until the new master's beacons arrive, so the clock does not jump back
+    if (lowest != master)
+    {
+        master = lowest;
+        synced = false;
+        sampleCount = 0;
+        nextSample = 0;
+    }
+}
+
+void ClusterNode::sync(int64_t sample)
+{
+    int64_t estimate = sample;
+    for (size_t i = 0; i < sampleCount; i++)
+    {
+        estimate = std::max(estimate, samples[i]);
+    }
+    // The master's clock was set, older samples no longer apply
+    if (estimate - sample > CLUSTER_STEP)
+    {
+        sampleCount = 0;
+        nextSample = 0;
+        estimate = sample;
+    }
+
+    samples[nextSample] = sample;
+    nextSample = (nextSample + 1) % CLUSTER_SYNC_SAMPLES;
+    if (sampleCount < CLUSTER_SYNC_SAMPLES)
+    {
+        sampleCount++;
+    }
+
+    // Small errors are halved with every beacon, so the clock moves smoothly
+    int64_t error = estimate - offset;
+    if (!synced || error > CLUSTER_STEP || error < -CLUSTER_STEP)
+    {
+        offset = estimate;
+    }
+    else
+    {
+        offset += error / 2;
+    }
+    synced = true;
+}
+
+void ClusterNode::queue(const Command &command)
+{
+    if (pending.size() >= CLUSTER_MAX_PENDING)
+    {
+        return;
+    }
+    auto position = pending.begin();
+    while (position != pending.end() && position->at <= command.at)
+    {
+        position++;
+    }
+    pending.insert(position, command);
+}
+
+bool ClusterNode::takeDue(uint64_t local, Command &command)
+{
+    if (pending.empty() || pending.front().at > clusterTime(local))
+    {
+        return false;
+    }
+    command = pending.front();
+    pending.erase(pending.begin());
+    return true;
+}
+
+uint64_t ClusterNode::nextDue() const
+{
+    return pending.empty() ? UINT64_MAX : pending.front().at;
+}
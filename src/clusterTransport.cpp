@@ -0,0 +1,77 @@
+#include "clusterTransport.h"
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+bool MulticastTransport::open()
+{
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        Serial.println("Cluster: failed to create socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(CLUSTER_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr *)&address, sizeof(address)) < 0)
+    {
+        Serial.println("Cluster: failed to bind port " + String(CLUSTER_PORT));
+        close();
+        return false;
+    }
+
+    ip_mreq membership = {};
+    membership.imr_multiaddr.s_addr = inet_addr(CLUSTER_MULTICAST_GROUP);
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+    {
+        Serial.println("Cluster: failed to join " + String(CLUSTER_MULTICAST_GROUP));
+        close();
+        return false;
+    }
+
+    // Units do not hear their own packets
+    uint8_t loop = 0;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    uint8_t ttl = 1;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    return true;
+}
+
+void MulticastTransport::close()
+{
+    if (sock >= 0)
+    {
+        ::close(sock);
+        sock = -1;
+    }
+}
+
+void MulticastTransport::send(const uint8_t *data, size_t length)
+{
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(CLUSTER_PORT);
+    to.sin_addr.s_addr = inet_addr(CLUSTER_MULTICAST_GROUP);
+    sendto(sock, data, length, 0, (sockaddr *)&to, sizeof(to));
+}
+
+size_t MulticastTransport::receive(uint8_t *data, size_t size, uint32_t timeout)
+{
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    timeval wait = {(long)(timeout / 1000), (long)(timeout % 1000) * 1000};
+    if (select(sock + 1, &readable, nullptr, nullptr, &wait) <= 0)
+    {
+        return 0;
+    }
+
+    int length = recv(sock, data, size, 0);
+    return length > 0 ? length : 0;
+}
@@ -1,52 +1,230 @@
 #include "configManager.h"
+#include <esp_system.h>
 
 ConfigManager *ConfigManager::instance = nullptr;
 
 void ConfigManager::setConfig(const String &key, const String &value)
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err == ESP_OK)
+    if (!opened)
     {
-        nvs_set_str(handle, key.c_str(), value.c_str());
-        nvs_commit(handle);
-        nvs_close(handle);
+        throw std::runtime_error("Failed to set config");
     }
-    if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+
+    lock();
+    auto it = cache.find(key);
+    if (it == cache.end() || it->second.isBlob || it->second.erased || it->second.value != value)
     {
-        nvs_close(handle);
-        throw std::runtime_error("NVS storage is full");
+        cache[key] = {value, {}, false, false, true};
+        markDirty();
     }
-    if (err != ESP_OK)
+    unlock();
+}
+
+void ConfigManager::setBlob(const String &key, const std::vector<uint8_t> &data)
+{
+    if (!opened)
     {
-        nvs_close(handle);
         throw std::runtime_error("Failed to set config");
     }
+
+    lock();
+    auto it = cache.find(key);
+    if (it == cache.end() || !it->second.isBlob || it->second.erased || it->second.blob != data)
+    {
+        cache[key] = {String(), data, true, false, true};
+        markDirty();
+    }
+    unlock();
+}
+
+void ConfigManager::eraseConfig(const String &key)
+{
+    lock();
+    auto it = cache.find(key);
+    if (it == cache.end() || !it->second.erased)
+    {
+        cache[key] = {String(), {}, false, true, true};
+        markDirty();
+    }
+    unlock();
+}
+
+void ConfigManager::markDirty()
+{
+    unsigned long now = millis();
+    if (!dirty)
+    {
+        firstChange = now;
+        dirty = true;
+    }
+    lastChange = now;
 }
 
 String ConfigManager::getConfig(const String &key, const String &default_value) const
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
     String value = default_value;
-    if (err == ESP_OK)
+
+    lock();
+    auto it = cache.find(key);
+    if (it != cache.end())
+    {
+        if (!it->second.erased && !it->second.isBlob)
+        {
+            value = it->second.value;
+        }
+    }
+    else if (opened)
     {
         size_t required_size;
-        err = nvs_get_str(handle, key.c_str(), nullptr, &required_size);
+        esp_err_t err = nvs_get_str(handle, key.c_str(), nullptr, &required_size);
         if (err == ESP_OK)
         {
             char *buffer = new char[required_size];
             nvs_get_str(handle, key.c_str(), buffer, &required_size);
             value = String(buffer);
             delete[] buffer;
+
+            cache[key] = {value, {}, false, false, false};
         }
-        nvs_close(handle);
     }
+    unlock();
+
     return value;
 }
 
+bool ConfigManager::getBlob(const String &key, std::vector<uint8_t> &data) const
+{
+    bool found = false;
+
+    lock();
+    auto it = cache.find(key);
+    if (it != cache.end())
+    {
+        if (!it->second.erased && it->second.isBlob)
+        {
+            data = it->second.blob;
+            found = true;
+        }
+    }
+    else if (opened)
+    {
+        size_t required_size;
+        esp_err_t err = nvs_get_blob(handle, key.c_str(), nullptr, &required_size);
+        if (err == ESP_OK)
+        {
+            data.resize(required_size);
+            nvs_get_blob(handle, key.c_str(), data.data(), &required_size);
+
+            cache[key] = {String(), data, true, false, false};
+            found = true;
+        }
+    }
+    unlock();
+
+    return found;
+}
+
+bool ConfigManager::flush()
+{
+    lock();
+    if (!dirty || !opened)
+    {
+        unlock();
+        return true;
+    }
+
+    bool ok = true;
+    for (auto &element : cache)
+    {
+        if (!element.second.dirty)
+        {
+            continue;
+        }
+
+        esp_err_t err;
+        if (element.second.erased)
+        {
+            err = nvs_erase_key(handle, element.first.c_str());
+            if (err == ESP_ERR_NVS_NOT_FOUND)
+            {
+                err = ESP_OK;
+            }
+        }
+        else if (element.second.isBlob)
+        {
+            err = nvs_set_blob(handle, element.first.c_str(), element.second.blob.data(), element.second.blob.size());
+        }
+        else
+        {
+            err = nvs_set_str(handle, element.first.c_str(), element.second.value.c_str());
+        }
+
+        if (err == ESP_OK)
+        {
+            element.second.dirty = false;
+        }
+        else
+        {
+            ok = false;
+            Serial.println("Failed to write config " + element.first + (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? ": NVS storage is full" : ""));
+        }
+    }
+    nvs_commit(handle);
+
+    // Values that failed stay dirty and are retried once the flush delay passed again
+    dirty = !ok;
+    if (!ok)
+    {
+        firstChange = lastChange = millis();
+    }
+    unlock();
+
+    return ok;
+}
+
+void ConfigManager::loop()
+{
+    lock();
+    unsigned long now = millis();
+    bool due = dirty && (now - lastChange >= CONFIG_FLUSH_IDLE || now - firstChange >= CONFIG_FLUSH_MAX_DELAY);
+    unlock();
+
+    if (due)
+    {
+        flush();
+    }
+}
+
+bool ConfigManager::isDirty() const
+{
+    lock();
+    bool result = dirty;
+    unlock();
+    return result;
+}
+
+void ConfigManager::lock() const
+{
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+void ConfigManager::unlock() const
+{
+    xSemaphoreGiveRecursive(mutex);
+}
+
+void ConfigManager::onShutdown()
+{
+    if (instance != nullptr)
+    {
+        instance->flush();
+    }
+}
+
 ConfigManager::ConfigManager()
 {
+    mutex = xSemaphoreCreateRecursiveMutex();
+
     // Initialize NVS
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -54,4 +232,13 @@ ConfigManager::ConfigManager()
         nvs_flash_erase();
         nvs_flash_init();
     }
-}
\ No newline at end of file
+
+    // Keep the handle open for the lifetime of the program
+    opened = nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK;
+    if (!opened)
+    {
+        Serial.println("Failed to open NVS storage");
+    }
+
+    esp_register_shutdown_handler(onShutdown);
+}
@@ -0,0 +1,96 @@
+#include "eventStream.h"
+
+bool EventStream::subscribe(WiFiClient client)
+{
+    if (subscribers.size() >= EVENT_STREAM_MAX_CLIENTS)
+    {
+        return false;
+    }
+
+    client.setNoDelay(true);
+    String header = "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: text/event-stream\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "Connection: keep-alive\r\n"
+                    "\r\n"
+                    "retry: " +
+                    String(EVENT_STREAM_RETRY) + "\n\n";
+    client.write((const uint8_t *)header.c_str(), header.length());
+
+    subscribers.push_back({client, String()});
+    return true;
+}
+
+void EventStream::queue(Subscriber &subscriber, const String &message)
+{
+    if (subscriber.pending.length() + message.length() > EVENT_STREAM_CLIENT_BUFFER)
+    {
+        // The client has to reload everything anyway, drop what it has not received.
+        // The leading newline ends a partially written event line
+        subscriber.pending = "\nevent: resync\ndata: {}\n\n";
+        return;
+    }
+    subscriber.pending += message;
+}
+
+void EventStream::send(const char *event, const String &data, uint32_t id)
+{
+    if (subscribers.empty())
+    {
+        return;
+    }
+
+    String message = "id: " + String(id) + "\nevent: " + event + "\ndata: " + data + "\n\n";
+    for (Subscriber &subscriber : subscribers)
+    {
+        queue(subscriber, message);
+    }
+}
+
+void EventStream::loop()
+{
+    if (subscribers.empty())
+    {
+        return;
+    }
+
+    if (millis() - lastWrite > EVENT_STREAM_KEEPALIVE)
+    {
+        // Lets proxies and browsers know the stream is alive and detects closed sockets
+        for (Subscriber &subscriber : subscribers)
+        {
+            queue(subscriber, ":\n\n");
+        }
+    }
+
+    for (auto it = subscribers.begin(); it != subscribers.end();)
+    {
+        Subscriber &subscriber = *it;
+        if (subscriber.pending.length() > 0)
+        {
+            size_t length = std::min((size_t)subscriber.pending.length(), (size_t)EVENT_STREAM_WRITE_CHUNK);
+            size_t written = subscriber.client.write((const uint8_t *)subscriber.pending.c_str(), length);
+            subscriber.pending.remove(0, written);
+            lastWrite = millis();
+        }
+
+        if (!subscriber.client.connected())
+        {
+            subscriber.client.stop();
+            it = subscribers.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+void EventStream::clear()
+{
+    for (Subscriber &subscriber : subscribers)
+    {
+        subscriber.client.stop();
+    }
+    subscribers.clear();
+}
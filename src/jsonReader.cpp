@@ -0,0 +1,358 @@
+#include "jsonReader.h"
+#include <climits>
+
+JsonReader::JsonReader(Stream &input) : input(input)
+{
+}
+
+bool JsonReader::isValid() const
+{
+    return valid;
+}
+
+int JsonReader::peekChar()
+{
+    if (!valid)
+    {
+        return -1;
+    }
+
+    int c = input.peek();
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+    {
+        input.read();
+        c = input.peek();
+    }
+    return c;
+}
+
+bool JsonReader::consume(char c)
+{
+    if (peekChar() != c)
+    {
+        valid = false;
+        return false;
+    }
+    input.read();
+    return true;
+}
+
+bool JsonReader::consumeLiteral(const char *literal)
+{
+    for (const char *p = literal; *p; p++)
+    {
+        if (input.read() != *p)
+        {
+            valid = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JsonReader::beginObject()
+{
+    first = true;
+    return consume('{');
+}
+
+bool JsonReader::next(char close)
+{
+    int c = peekChar();
+    if (c == close)
+    {
+        // The enclosing object or array is inside one of its values, so it is not at its first one either
+        input.read();
+        first = false;
+        return false;
+    }
+
+    // Members and elements are separated by exactly one comma
+    if (!first && !consume(','))
+    {
+        return false;
+    }
+    if (first && c == ',')
+    {
+        valid = false;
+        return false;
+    }
+    first = false;
+    return true;
+}
+
+bool JsonReader::nextKey(char *key, size_t size)
+{
+    if (!next('}'))
+    {
+        return false;
+    }
+
+    if (peekChar() != '"')
+    {
+        valid = false;
+        return false;
+    }
+    readStringInto(nullptr, key, size);
+    return consume(':');
+}
+
+bool JsonReader::beginArray()
+{
+    first = true;
+    return consume('[');
+}
+
+bool JsonReader::nextElement()
+{
+    if (!next(']'))
+    {
+        return false;
+    }
+
+    int c = peekChar();
+    if (c == -1 || c == ']' || c == '}' || c == ',')
+    {
+        valid = false;
+        return false;
+    }
+    return true;
+}
+
+long JsonReader::readInt()
+{
+    int c = peekChar();
+    bool negative = c == '-';
+    if (negative)
+    {
+        input.read();
+        c = input.peek();
+    }
+    if (c < '0' || c > '9')
+    {
+        valid = false;
+        return 0;
+    }
+
+    // Saturates instead of overflowing, callers check the range anyway
+    long value = 0;
+    while (c >= '0' && c <= '9')
+    {
+        int digit = input.read() - '0';
+        value = value > (LONG_MAX - digit) / 10 ? LONG_MAX : value * 10 + digit;
+        c = input.peek();
+    }
+
+    // Fraction and exponent
+    while ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+    {
+        input.read();
+        c = input.peek();
+    }
+
+    return negative ? -value : value;
+}
+
+bool JsonReader::readBool()
+{
+    int c = peekChar();
+    if (c == 't')
+    {
+        return consumeLiteral("true");
+    }
+    if (c == 'f')
+    {
+        consumeLiteral("false");
+        return false;
+    }
+    return readInt() != 0;
+}
+
+String JsonReader::readString()
+{
+    String value;
+    if (peekChar() != '"')
+    {
+        valid = false;
+        return value;
+    }
+    readStringInto(&value, nullptr, 0);
+    return value;
+}
+
+size_t JsonReader::readString(char *buffer, size_t size)
+{
+    if (peekChar() != '"')
+    {
+        valid = false;
+        if (size > 0)
+        {
+            buffer[0] = '\0';
+        }
+        return 0;
+    }
+    return readStringInto(nullptr, buffer, size);
+}
+
+size_t JsonReader::readStringInto(String *value, char *buffer, size_t size)
+{
+    size_t length = 0;
+    size_t total = 0;
+    input.read(); // Opening quote
+
+    while (valid)
+    {
+        int c = input.read();
+        if (c == '"')
+        {
+            break;
+        }
+        if (c == -1)
+        {
+            valid = false;
+            break;
+        }
+
+        if (c == '\\')
+        {
+            c = input.read();
+            switch (c)
+            {
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'u':
+            {
+                // Only the basic multilingual plane, written as UTF-8
+                uint16_t code = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    int h = input.read();
+                    code <<= 4;
+                    if (h >= '0' && h <= '9')
+                        code |= h - '0';
+                    else if (h >= 'a' && h <= 'f')
+                        code |= h - 'a' + 10;
+                    else if (h >= 'A' && h <= 'F')
+                        code |= h - 'A' + 10;
+                    else
+                        valid = false;
+                }
+                if (code >= 0x80)
+                {
+                    char utf8[3];
+                    int bytes = 0;
+                    if (code < 0x800)
+                    {
+                        utf8[bytes++] = 0xC0 | (code >> 6);
+                    }
+                    else
+                    {
+                        utf8[bytes++] = 0xE0 | (code >> 12);
+                        utf8[bytes++] = 0x80 | ((code >> 6) & 0x3F);
+                    }
+                    for (int i = 0; i < bytes; i++)
+                    {
+                        total++;
+                        if (value != nullptr)
+                        {
+                            *value += utf8[i];
+                        }
+                        else if (length + 1 < size)
+                        {
+                            buffer[length++] = utf8[i];
+                        }
+                    }
+                    c = 0x80 | (code & 0x3F);
+                }
+                else
+                {
+                    c = code;
+                }
+                break;
+            }
+            case -1:
+                valid = false;
+                continue;
+            default:
+                // \" \\ \/
+                break;
+            }
+        }
+
+        total++;
+        if (value != nullptr)
+        {
+            *value += (char)c;
+        }
+        else if (length + 1 < size)
+        {
+            buffer[length++] = c;
+        }
+    }
+
+    if (buffer != nullptr && size > 0)
+    {
+        buffer[length] = '\0';
+    }
+    return total;
+}
+
+void JsonReader::skipValue()
+{
+    // Untrusted input must not recurse deep enough to overflow the stack
+    if (depth >= JSON_READER_DEPTH)
+    {
+        valid = false;
+        return;
+    }
+    depth++;
+
+    char key[1];
+    int c = peekChar();
+    switch (c)
+    {
+    case '{':
+        beginObject();
+        while (nextKey(key, sizeof(key)))
+        {
+            skipValue();
+        }
+        break;
+    case '[':
+        beginArray();
+        while (nextElement())
+        {
+            skipValue();
+        }
+        break;
+    case '"':
+        readStringInto(nullptr, key, sizeof(key));
+        break;
+    case 't':
+        consumeLiteral("true");
+        break;
+    case 'f':
+        consumeLiteral("false");
+        break;
+    case 'n':
+        consumeLiteral("null");
+        break;
+    default:
+        readInt();
+        break;
+    }
+    depth--;
+}
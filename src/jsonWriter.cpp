@@ -0,0 +1,285 @@
+#include "jsonWriter.h"
+
+// Output of the counting run
+class NullPrint : public Print
+{
+public:
+    size_t write(uint8_t) override { return 1; }
+};
+static NullPrint nullPrint;
+
+JsonWriter::JsonWriter(Print &out) : out(out)
+{
+    first[0] = true;
+}
+
+JsonWriter::JsonWriter(std::vector<uint32_t> &counts) : out(nullPrint), format(MSGPACK_COUNT), counts(&counts)
+{
+    first[0] = true;
+    counts.clear();
+}
+
+JsonWriter::JsonWriter(Print &out, std::vector<uint32_t> &counts) : out(out), format(MSGPACK), counts(&counts)
+{
+    first[0] = true;
+}
+
+void JsonWriter::separate()
+{
+    if (afterKey)
+    {
+        afterKey = false;
+        return;
+    }
+    if (format == MSGPACK_COUNT && depth > 0)
+    {
+        (*counts)[containers[depth]]++;
+    }
+    if (format == JSON && !first[depth])
+    {
+        out.write(',');
+    }
+    first[depth] = false;
+}
+
+void JsonWriter::open(char bracket)
+{
+    separate();
+    if (depth + 1 >= JSON_WRITER_DEPTH)
+    {
+        throw std::runtime_error("JSON nesting too deep");
+    }
+    first[++depth] = true;
+
+    if (format == JSON)
+    {
+        out.write(bracket);
+    }
+    else if (format == MSGPACK_COUNT)
+    {
+        containers[depth] = counts->size();
+        counts->push_back(0);
+    }
+    else
+    {
+        if (nextCount >= counts->size())
+        {
+            throw std::runtime_error("MessagePack document changed while writing");
+        }
+        uint32_t count = (*counts)[nextCount++];
+        bool map = bracket == '{';
+        if (count < 16)
+        {
+            out.write((map ? 0x80 : 0x90) | count);
+        }
+        else if (count <= 0xFFFF)
+        {
+            out.write(map ? 0xDE : 0xDC);
+            writeBigEndian(count, 2);
+        }
+        else
+        {
+            out.write(map ? 0xDF : 0xDD);
+            writeBigEndian(count, 4);
+        }
+    }
+}
+
+void JsonWriter::close(char bracket)
+{
+    if (depth > 0)
+    {
+        depth--;
+    }
+    if (format == JSON)
+    {
+        out.write(bracket);
+    }
+}
+
+void JsonWriter::beginObject()
+{
+    open('{');
+}
+
+void JsonWriter::endObject()
+{
+    close('}');
+}
+
+void JsonWriter::beginArray()
+{
+    open('[');
+}
+
+void JsonWriter::endArray()
+{
+    close(']');
+}
+
+void JsonWriter::key(const char *name)
+{
+    separate();
+    writeString(name);
+    if (format == JSON)
+    {
+        out.write(':');
+    }
+    afterKey = true;
+}
+
+void JsonWriter::value(const char *value)
+{
+    separate();
+    writeString(value);
+}
+
+void JsonWriter::value(bool value)
+{
+    separate();
+    if (format == JSON)
+    {
+        out.print(value ? "true" : "false");
+    }
+    else if (format == MSGPACK)
+    {
+        out.write(value ? 0xC3 : 0xC2);
+    }
+}
+
+void JsonWriter::writeBigEndian(uint64_t value, uint8_t bytes)
+{
+    while (bytes-- > 0)
+    {
+        out.write((uint8_t)(value >> (8 * bytes)));
+    }
+}
+
+// Smallest MessagePack integer that holds the value
+void JsonWriter::writeSigned(int64_t value)
+{
+    if (value >= 0)
+    {
+        writeUnsigned(value);
+    }
+    else if (value >= -32)
+    {
+        out.write((uint8_t)value);
+    }
+    else if (value >= INT8_MIN)
+    {
+        out.write(0xD0);
+        writeBigEndian(value, 1);
+    }
+    else if (value >= INT16_MIN)
+    {
+        out.write(0xD1);
+        writeBigEndian(value, 2);
+    }
+    else if (value >= INT32_MIN)
+    {
+        out.write(0xD2);
+        writeBigEndian(value, 4);
+    }
+    else
+    {
+        out.write(0xD3);
+        writeBigEndian(value, 8);
+    }
+}
+
+void JsonWriter::writeUnsigned(uint64_t value)
+{
+    if (value < 0x80)
+    {
+        out.write((uint8_t)value);
+    }
+    else if (value <= 0xFF)
+    {
+        out.write(0xCC);
+        writeBigEndian(value, 1);
+    }
+    else if (value <= 0xFFFF)
+    {
+        out.write(0xCD);
+        writeBigEndian(value, 2);
+    }
+    else if (value <= 0xFFFFFFFFULL)
+    {
+        out.write(0xCE);
+        writeBigEndian(value, 4);
+    }
+    else
+    {
+        out.write(0xCF);
+        writeBigEndian(value, 8);
+    }
+}
+
+void JsonWriter::writeString(const char *value)
+{
+    if (format == MSGPACK_COUNT)
+    {
+        return;
+    }
+    if (format == MSGPACK)
+    {
+        size_t length = strlen(value);
+        if (length < 32)
+        {
+            out.write(0xA0 | length);
+        }
+        else if (length <= 0xFF)
+        {
+            out.write(0xD9);
+            writeBigEndian(length, 1);
+        }
+        else if (length <= 0xFFFF)
+        {
+            out.write(0xDA);
+            writeBigEndian(length, 2);
+        }
+        else
+        {
+            out.write(0xDB);
+            writeBigEndian(length, 4);
+        }
+        out.write((const uint8_t *)value, length);
+        return;
+    }
+
+    out.write('"');
+    for (const char *c = value; *c; c++)
+    {
+        switch (*c)
+        {
+        case '"':
+            out.print("\\\"");
+            break;
+        case '\\':
+            out.print("\\\\");
+            break;
+        case '\n':
+            out.print("\\n");
+            break;
+        case '\r':
+            out.print("\\r");
+            break;
+        case '\t':
+            out.print("\\t");
+            break;
+        default:
+            if ((uint8_t)*c < 0x20)
+            {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+                out.print(escaped);
+            }
+            else
+            {
+                out.write(*c);
+            }
+        }
+    }
+    out.write('"');
+}
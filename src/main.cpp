@@ -1,8 +1,24 @@
 #include "rtc.h"
 #include "relayManager.h"
+#include "alarmScheduler.h"
 #include "configManager.h"
+#include "eventStream.h"
+#include "jsonWriter.h"
+#include "chunkedResponse.h"
+#include "binaryConfig.h"
+#include "webAsset.h"
+#include "requestSchema.h"
+#include "udpControl.h"
+#include "cluster.h"
+#include "mqttBridge.h"
+#include "esp_crc.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
 
 #include <WiFi.h>
 #include <WebServer.h>
@@ -10,7 +26,9 @@
 #include <ArduinoJson.h>
 #include <Update.h>
 #include <DNSServer.h>
+#include <StreamString.h>
 #include <algorithm>
+#include <map>
 
 #define SDA_PIN 15
 #define SCL_PIN 2
@@ -19,6 +37,7 @@
 #define RELAY3_PIN 25
 #define RELAY4_PIN 26
 #define BUTTON_PIN 5
+#define RTC_INT_PIN 4 // DS3231 INT/SQW, must be an RTC GPIO to wake from deep sleep
 #define LONG_PRESS_TIME 10000 // 10 seconds in milliseconds
 #define WIFI_ON_TIME 3600000  // 1 hour in milliseconds
 
@@ -26,6 +45,31 @@
 
 #define LOOP_SPEED 100 // in ms
 
+#define WEB_TASK_STACK 8192
+#define WEB_TASK_PRIORITY 1
+
+// Fields of the listing endpoints, selected with fields=. The id is always sent
+#define FIELDS_ALL 0xFF
+#define RELAY_FIELD_NAME 0x02
+#define RELAY_FIELD_STATE 0x04
+#define ALARM_FIELD_STATE 0x02
+#define ALARM_FIELD_HOUR 0x04
+#define ALARM_FIELD_MINUTE 0x08
+#define ALARM_FIELD_SECOND 0x10
+#define ALARM_FIELD_WEEKDAYS 0x20
+
+#define API_BODY_MAX 16384 // in bytes, larger request bodies are rejected
+#define MSGPACK_CONTENT_TYPE "application/msgpack"
+
+#define BATCH_MAX_OPERATIONS 128 // per /api/relay-alarms/batch request
+
+#define STATIC_MAX_AGE 86400 // in s, browser cache lifetime of static assets
+
+#define LOW_POWER_MIN_SLEEP 5      // in s, stay awake if the next alarm is closer than this
+#define LOW_POWER_BOOT_AWAKE 60000 // in ms, awake time after a cold boot to allow turning on wifi
+
+#define MQTT_DEFAULT_PREFIX "smart-relays/" // followed by the node id
+
 // settings
 const char *APssid = "Smart-Relays-"; // SSID + dynamic part
 const char *APpassword = NULL;
@@ -40,6 +84,10 @@ const String localIPURL = "http://" + APip.toString();
 // Create the WebServer (port 80)
 WebServer server(80);
 
+// Live changes for the web UI, see publishEvents
+EventStream eventStream;
+uint32_t lastEventGeneration = 0;
+
 // RTC
 RTC *rtc = nullptr;
 
@@ -48,7 +96,32 @@ ConfigManager *configManager = nullptr;
 
 // Relay Manager
 RelayManager *relayManager;
-std::queue<std::vector<Alarm *>> alarmQueue;
+
+// Alarm Scheduler
+AlarmScheduler *alarmScheduler = nullptr;
+
+// Relay control over UDP
+UdpControl *udpControl = nullptr;
+
+// Group control and time sync with other units
+Cluster *cluster = nullptr;
+
+// Relay states, fired alarms and commands over MQTT
+MqttBridge *mqttBridge = nullptr;
+
+// Raw body of the current API request, zero terminated when complete
+std::vector<char> requestBody;
+bool requestBodyTooLarge = false;
+
+// Low power mode. Relay levels survive deep sleep in RTC memory and through gpio hold
+bool lowPowerMode = false;
+uint32_t bootId = 0; // Random, tells ETags of different boots apart
+esp_sleep_wakeup_cause_t wakeupCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+bool wakeLatencyReported = false;
+RTC_DATA_ATTR uint64_t heldRelayPins = 0;
+RTC_DATA_ATTR uint64_t heldRelayLevels = 0;
+RTC_DATA_ATTR int64_t lastWakeLatency = -1; // in us, boot to relay switch
+RTC_DATA_ATTR uint32_t wakeAlarmTime = 0;    // unix time the DS3231 wake alarm was programmed for, 0 if none
 
 // Function declarations
 String getContentType(String filename);
@@ -56,22 +129,45 @@ void handleFileRead(String path);
 void handleGetAllRelays();     // - **Endpoint**: `/api/all-relays` GET
 void handleRelayControl();     // - **Endpoint**: `/api/relay-control` POST
 void handleSystemSettings();   // - **Endpoint**: `/api/settings` GET
+void handleDiagnostics();      // - **Endpoint**: `/api/diagnostics` GET
 void handleUpdateSettings();   // - **Endpoint**: `/api/settings` POST
 void handleGetRelayAlarms();   // - **Endpoint**: `/api/relay-alarms?relayId=:relayId` GET
 void handleCreateRelayAlarm(); // - **Endpoint**: `/api/relay-alarm` POST
 void handleUpdateRelayAlarm(); // - **Endpoint**: `/api/relay-alarm?relayId=:relayId&alarmId=:alarmId` PUT
 void handleDeleteRelayAlarm(); // - **Endpoint**: `/api/relay-alarm?relayId=:relayId&alarmId=:alarmId` DELETE
+void handleBatchRelayAlarms(); // - **Endpoint**: `/api/relay-alarms/batch` POST
 void handleServerTime();       // - **Endpoint**: `/api/server-time` GET
 void handleUpdateServerTime(); // - **Endpoint**: `/api/server-time` POST
 void handleFirmwareUpdate();   // - **Endpoint**: `/api/update-firmware` POST
 void handleReset();            // - **Endpoint**: `/api/reset` POST
+void handleEvents();           // - **Endpoint**: `/api/events` GET
+void handleDashboard();        // - **Endpoint**: `/api/dashboard` GET
+void handleUdpControl();       // - **Endpoint**: `/api/udp-control` GET
+void handleUpdateUdpControl(); // - **Endpoint**: `/api/udp-control` POST
+void handleCluster();          // - **Endpoint**: `/api/cluster` GET
+void handleUpdateCluster();    // - **Endpoint**: `/api/cluster` POST
+void handleGroupControl();     // - **Endpoint**: `/api/cluster/group-control` POST
+void handleStation();          // - **Endpoint**: `/api/station` GET
+void handleUpdateStation();    // - **Endpoint**: `/api/station` POST
+void handleMqtt();             // - **Endpoint**: `/api/mqtt` GET
+void handleUpdateMqtt();       // - **Endpoint**: `/api/mqtt` POST
+String handleMqttCommand(const String &topic, const char *payload, size_t length);
+void publishEvents();
+void collectRequestBody();
+bool acceptsMsgPack();
 void sendJsonResponse(int status, const String &message);
 
 void factoryreset();
 void restart();
 void calculateNextAlarm();
 void toggleWifi();
+void startStation();
+void updateNetworkServices();
+bool parseUdpKey(const String &hex, uint8_t *key);
 void IRAM_ATTR handleButtonPress();
+void webTaskLoop(void *param);
+void restoreHeldRelays();
+void enterDeepSleep();
 
 String LoadConfig();
 void SaveConfig();
@@ -83,25 +179,55 @@ void setup()
 
     Serial.println("LETS GOOOOO");
 
+    wakeupCause = esp_sleep_get_wakeup_cause();
+    bootId = esp_random();
+
     // Initialize the RTC
-    rtc = RTC::getInstance(SDA_PIN, SCL_PIN);
+    rtc = RTC::getInstance(SDA_PIN, SCL_PIN, RTC_INT_PIN);
 
     // ConfigManager
     configManager = ConfigManager::getInstance();
 
-    // Load config data
-    String config = LoadConfig();
+    // AlarmScheduler
+    alarmScheduler = AlarmScheduler::getInstance();
 
-    // Initialize the Relay Manager
-    Serial.println(config);
-    if (config != "{}")
+    // UdpControl and MqttBridge, fired alarms are sent to their subscribers
+    udpControl = UdpControl::getInstance();
+    mqttBridge = MqttBridge::getInstance();
+    alarmScheduler->setFireListener([](const FiredAlarm &alarm)
+                                    { udpControl->alarmFired(alarm);
+                                      mqttBridge->alarmFired(alarm); });
+
+    // Cluster
+    cluster = Cluster::getInstance();
+
+    // Load config data
+    int64_t loadStart = esp_timer_get_time();
+    relayManager = new RelayManager();
+    bool configLoaded = relayManager->loadConfig();
+    if (!configLoaded)
     {
-        relayManager = new RelayManager(config);
+        // Migrate the JSON config of older firmware
+        String config = LoadConfig();
+        if (config != "{}")
+        {
+            Serial.println("Migrating JSON config");
+            BufferStream input(config.c_str(), config.length());
+            bool parsed = relayManager->loadJson(input);
+            relayManager->saveConfig();
+            // Keep the JSON of a config that did not parse completely
+            if (parsed)
+            {
+                configManager->eraseConfig(CONFIG_LEGACY_KEY);
+            }
+            configLoaded = true;
+        }
     }
-    else
+    Serial.println("Config loaded in " + String((long)(esp_timer_get_time() - loadStart)) + " us, heap low water mark " + String(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT)) + " bytes");
+
+    if (!configLoaded)
     {
         // Load default relays
-        relayManager = new RelayManager();
         relayManager->addRelay(RELAY1_PIN, "Relay 1");
         relayManager->addRelay(RELAY2_PIN, "Relay 2");
         relayManager->addRelay(RELAY3_PIN, "Relay 3");
@@ -121,8 +247,38 @@ void setup()
         toggleWifi();
     }
 
-    // calculate new alarm queue
+    // Low power mode
+    lowPowerMode = configManager->getConfig("lowPower", "0") == "1";
+    if (wakeupCause == ESP_SLEEP_WAKEUP_EXT0)
+    {
+        rtc->clearWakeAlarm();
+        restoreHeldRelays();
+    }
+    else
+    {
+        // Replay the schedule so a reboot does not leave relays off that should be on
+        relayManager->applySchedule(rtc->now().unixtime());
+    }
+
+    // calculate new alarm queue and start the scheduler task
     calculateNextAlarm();
+    alarmScheduler->begin(relayManager);
+
+    // Key of the UDP control protocol, it stays off without one
+    uint8_t udpKey[UDP_KEY_SIZE];
+    if (parseUdpKey(configManager->getConfig("udpKey", ""), udpKey))
+    {
+        udpControl->setKey(udpKey);
+        cluster->setKey(udpKey);
+    }
+    udpControl->begin(alarmScheduler, bootId);
+    // The unique part of the MAC tells the units apart
+    uint32_t nodeId = (uint32_t)(ESP.getEfuseMac() >> 16);
+    cluster->begin(alarmScheduler, rtc, nodeId);
+    mqttBridge->begin(alarmScheduler, handleMqttCommand, MQTT_DEFAULT_PREFIX + String(nodeId, HEX));
+
+    // Join the configured network, if any
+    startStation();
 
     // Initialize the SPIFFS
     if (!SPIFFS.begin(true))
@@ -134,6 +290,10 @@ void setup()
     // // Start Web services
     dnsServer.setTTL(3600);
 
+    // Headers used by the static file handler and the API content negotiation
+    const char *headerKeys[] = {"Accept-Encoding", "If-None-Match", "Accept", "Content-Type"};
+    server.collectHeaders(headerKeys, 4);
+
     // Define routes for the WebServer
     server.onNotFound([]()
                       { handleFileRead(server.uri()); });
@@ -158,22 +318,38 @@ void setup()
 
     // API
     server.on("/api/all-relays", HTTP_GET, handleGetAllRelays);
-    server.on("/api/relay-control", HTTP_POST, handleRelayControl);
+    server.on("/api/relay-control", HTTP_POST, handleRelayControl, collectRequestBody);
     server.on("/api/settings", HTTP_GET, handleSystemSettings);
-    server.on("/api/settings", HTTP_POST, handleUpdateSettings);
+    server.on("/api/diagnostics", HTTP_GET, handleDiagnostics);
+    server.on("/api/settings", HTTP_POST, handleUpdateSettings, collectRequestBody);
     server.on("/api/relay-alarms", HTTP_GET, handleGetRelayAlarms);
-    server.on("/api/relay-alarm", HTTP_POST, handleCreateRelayAlarm);
-    server.on("/api/relay-alarm", HTTP_PUT, handleUpdateRelayAlarm);
+    server.on("/api/relay-alarm", HTTP_POST, handleCreateRelayAlarm, collectRequestBody);
+    server.on("/api/relay-alarm", HTTP_PUT, handleUpdateRelayAlarm, collectRequestBody);
     server.on("/api/relay-alarm", HTTP_DELETE, handleDeleteRelayAlarm);
+    server.on("/api/relay-alarms/batch", HTTP_POST, handleBatchRelayAlarms, collectRequestBody);
     server.on("/api/server-time", HTTP_GET, handleServerTime);
-    server.on("/api/server-time", HTTP_POST, handleUpdateServerTime);
+    server.on("/api/server-time", HTTP_POST, handleUpdateServerTime, collectRequestBody);
     server.on("/api/update-firmware", HTTP_POST, handleFirmwareUpdate);
     server.on("/api/reset", HTTP_POST, handleReset);
+    server.on("/api/events", HTTP_GET, handleEvents);
+    server.on("/api/dashboard", HTTP_GET, handleDashboard);
+    server.on("/api/udp-control", HTTP_GET, handleUdpControl);
+    server.on("/api/udp-control", HTTP_POST, handleUpdateUdpControl, collectRequestBody);
+    server.on("/api/cluster", HTTP_GET, handleCluster);
+    server.on("/api/cluster", HTTP_POST, handleUpdateCluster, collectRequestBody);
+    server.on("/api/cluster/group-control", HTTP_POST, handleGroupControl, collectRequestBody);
+    server.on("/api/station", HTTP_GET, handleStation);
+    server.on("/api/station", HTTP_POST, handleUpdateStation, collectRequestBody);
+    server.on("/api/mqtt", HTTP_GET, handleMqtt);
+    server.on("/api/mqtt", HTTP_POST, handleUpdateMqtt, collectRequestBody);
 
     // Initialize the button pin as an input
     pinMode(BUTTON_PIN, INPUT_PULLDOWN); // Using pull-up resistor
     // Attach the interrupt to the button pin for both rising and falling edges
     attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), handleButtonPress, CHANGE);
+
+    // Serve HTTP and DNS from the protocol core
+    xTaskCreatePinnedToCore(webTaskLoop, "web", WEB_TASK_STACK, nullptr, WEB_TASK_PRIORITY, nullptr, PRO_CPU_NUM);
 }
 
 // Main loop
@@ -184,79 +360,172 @@ volatile bool buttonPressed = false;
 volatile bool buttonPressedShort = false;
 volatile bool longPressDetected = false;
 unsigned long timeWifiTurnedOn = 0;
-bool wifiOn = false;
+volatile bool wifiOn = false;
+volatile bool wifiToggleRequested = false; // Wifi is switched by the web task
+volatile bool stationMode = false;            // Joined to the network of the station settings
+volatile bool stationChangeRequested = false; // After the response to a change of the station settings
+bool networkServicesUp = false;
 void loop()
 {
-    counter = (counter + 1) % LOOP_SPEED;
+    // Check if a normal press was detected
+    if (buttonPressedShort && !longPressDetected)
+    {
+        Serial.println("Button Pressed briefly. Wifi turned on/off");
+        wifiToggleRequested = true;
+        buttonPressedShort = false;
+    }
 
-    if (wifiOn)
+    // Check if a long press was detected
+    if (longPressDetected)
     {
-        if (counter % 30 == 0)
-        {
-            dnsServer.processNextRequest();
-        }
-        server.handleClient();
+        Serial.println("Button Pressed for more than 10 seconds! Factory reset and restart");
+        alarmScheduler->run(factoryreset);
+        restart();
+        longPressDetected = false; // Reset the long press detection
+    }
+
+    // Write pending config changes once they settled
+    configManager->loop();
+
+    // Report how long it took from waking up to switching the relays
+    if (wakeupCause == ESP_SLEEP_WAKEUP_EXT0 && !wakeLatencyReported && alarmScheduler->getLastFireMicros() >= 0)
+    {
+        lastWakeLatency = alarmScheduler->getLastFireMicros();
+        wakeLatencyReported = true;
+        Serial.println("Wake to relay switch latency: " + String((long)lastWakeLatency) + " us");
     }
 
-    if (counter == 0)
+    // Sleep between alarms in low power mode. After a cold boot stay awake for a while so wifi can be turned on
+    if (lowPowerMode && !wifiOn && !stationMode && !wifiToggleRequested && !buttonPressed && (wakeupCause == ESP_SLEEP_WAKEUP_EXT0 || millis() > LOW_POWER_BOOT_AWAKE))
     {
-        // Serial.println(alarmQueue.size());
-        // Check alarms
-        DateTime now = rtc->now();
+        enterDeepSleep();
+    }
+
+    delay(1);
+}
+
+// HTTP and DNS are served from their own task on the protocol core, so a slow
+// client or a firmware upload can not hold up the main loop or the scheduler
+void webTaskLoop(void *param)
+{
+    while (true)
+    {
+        if (wifiToggleRequested)
+        {
+            wifiToggleRequested = false;
+            toggleWifi();
+        }
+
+        if (wifiOn || stationMode)
+        {
+            server.handleClient();
+            publishEvents();
+            eventStream.loop();
+        }
 
-        if (!alarmQueue.empty())
+        // Applied here, not in the handler, so its response is still sent on the old connection
+        if (stationChangeRequested)
         {
-            std::vector<Alarm *> alarms = alarmQueue.front();
-            if (alarms.size() > 0)
+            stationChangeRequested = false;
+            startStation();
+        }
+
+        if (wifiOn)
+        {
+            counter = (counter + 1) % LOOP_SPEED;
+            if (counter % 30 == 0)
             {
-                Serial.println("Checking alarm(s) at " + String(alarms[0]->getHour()) + ":" + String(alarms[0]->getMinute()) + ":" + String(alarms[0]->getSecond()) + " and next alarm in " + String(alarms[0]->getNextAlarminSeconds(now)) + " seconds from now and there will be " + String(alarms.size()) + " alarm(s) and last calculation was " + String(now.unixtime() - lastAlarmCalculation.unixtime()) + " seconds ago");
-                if (alarms[0]->checkAlarm(now))
-                {
-                    for (Alarm *alarm : alarms)
-                    {
-                        Relay *rel = alarm->getRelay();
-                        if (alarm->getState())
-                        {
-                            alarm->turnOn();
-                            Serial.println("Relay " + rel->getName() + " turned on");
-                        }
-                        else
-                        {
-                            alarm->turnOff();
-                            Serial.println("Relay " + rel->getName() + " turned off");
-                        }
-                    }
-                    alarmQueue.pop();
-                    alarmQueue.push(alarms);
-                }
+                dnsServer.processNextRequest();
+            }
+
+            if (millis() - timeWifiTurnedOn > WIFI_ON_TIME)
+            {
+                Serial.println("Turning off wifi after 1 hour of inactivity");
+                toggleWifi();
             }
         }
+
+        vTaskDelay(1);
     }
+}
 
-    // Check if a normal press was detected
-    if (buttonPressedShort && !longPressDetected)
+void restoreHeldRelays()
+{
+    // The pads kept their level during sleep. Write the same level before releasing them so they do not glitch
+    std::vector<uint> relayIDs = relayManager->getRelayIDs();
+    for (uint id : relayIDs)
     {
-        Serial.println("Button Pressed briefly. Wifi turned on/off");
-        toggleWifi();
-        buttonPressedShort = false;
+        Relay *relay = relayManager->getRelayByID(id);
+        if (relay == nullptr || !(heldRelayPins & (1ULL << relay->getPin())))
+        {
+            continue;
+        }
+
+        if (heldRelayLevels & (1ULL << relay->getPin()))
+        {
+            relay->On();
+        }
+        else
+        {
+            relay->Off();
+        }
+        gpio_hold_dis((gpio_num_t)relay->getPin());
     }
+    gpio_deep_sleep_hold_dis();
+    heldRelayPins = 0;
+    heldRelayLevels = 0;
+}
 
-    // Check if a long press was detected
-    if (longPressDetected)
+void enterDeepSleep()
+{
+    DateTime now = rtc->now();
+    uint32_t next = alarmScheduler->peekTime();
+    if (next != ALARM_NEVER && next <= now.unixtime() + LOW_POWER_MIN_SLEEP)
     {
-        Serial.println("Button Pressed for more than 10 seconds! Factory reset and restart");
-        factoryreset();
-        restart();
-        longPressDetected = false; // Reset the long press detection
+        return;
     }
 
-    if (wifiOn && millis() - timeWifiTurnedOn > WIFI_ON_TIME)
+    // Keep the relay levels while sleeping
+    heldRelayPins = 0;
+    heldRelayLevels = 0;
+    alarmScheduler->run([]()
+                        {
+        std::vector<uint> relayIDs = relayManager->getRelayIDs();
+        for (uint id : relayIDs)
+        {
+            Relay *relay = relayManager->getRelayByID(id);
+            if (relay != nullptr)
+            {
+                heldRelayPins |= 1ULL << relay->getPin();
+                if (relay->getState())
+                {
+                    heldRelayLevels |= 1ULL << relay->getPin();
+                }
+                gpio_hold_en((gpio_num_t)relay->getPin());
+            }
+        } });
+    gpio_deep_sleep_hold_en();
+
+    // Wake up when the DS3231 pulls INT low. Without any alarm only a reset wakes the device
+    if (next != ALARM_NEVER)
     {
-        Serial.println("Turning off wifi after 1 hour of inactivity");
-        toggleWifi();
+        rtc->setWakeAlarm(DateTime(next));
+        wakeAlarmTime = next;
+        rtc_gpio_pullup_en((gpio_num_t)RTC_INT_PIN);
+        esp_sleep_enable_ext0_wakeup((gpio_num_t)RTC_INT_PIN, 0);
+        Serial.println("Entering deep sleep for " + String(next - now.unixtime()) + " seconds");
+    }
+    else
+    {
+        wakeAlarmTime = 0;
+        Serial.println("Entering deep sleep without alarm");
     }
 
-    delay(1);
+    // Deep sleep does not run the shutdown handlers
+    configManager->flush();
+
+    Serial.flush();
+    esp_deep_sleep_start();
 }
 
 void toggleWifi()
@@ -264,18 +533,27 @@ void toggleWifi()
     Serial.println("Toggling wifi. Status: " + String(wifiOn ? "APon" : "APoff"));
     if (wifiOn)
     {
-        // Stop dns and http server
+        // Stop dns server
         dnsServer.stop();
         Serial.println("DNS server stopped");
-        server.stop();
-        Serial.println("HTTP server stopped");
 
-        WiFi.disconnect(true);
-        WiFi.mode(WIFI_OFF);
-        Serial.println("Wifi turned off");
+        // The station stays connected
+        if (stationMode)
+        {
+            WiFi.softAPdisconnect(true);
+            WiFi.mode(WIFI_MODE_STA);
+            Serial.println("Access point turned off");
+        }
+        else
+        {
+            WiFi.disconnect(true);
+            WiFi.mode(WIFI_OFF);
+            Serial.println("Wifi turned off");
+        }
 
         timeWifiTurnedOn = 0;
         wifiOn = false;
+        updateNetworkServices();
     }
     else
     {
@@ -305,13 +583,61 @@ void toggleWifi()
         dnsServer.start(DNS_PORT, "*", APip);
         Serial.println("DNS server started");
 
-        // Start the server
-        server.begin();
-        Serial.println("HTTP server started");
-
         timeWifiTurnedOn = millis();
         wifiOn = true;
+        updateNetworkServices();
+    }
+}
+
+// Join the network of the station settings next to the access point, or leave it
+void startStation()
+{
+    String ssid = configManager->getConfig("staSsid", "");
+    if (ssid != "")
+    {
+        WiFi.mode(wifiOn ? WIFI_MODE_APSTA : WIFI_MODE_STA);
+        WiFi.setAutoReconnect(true);
+        WiFi.begin(ssid.c_str(), configManager->getConfig("staPassword", "").c_str());
+        Serial.println("Connecting to " + ssid);
+        stationMode = true;
+    }
+    else if (stationMode)
+    {
+        if (wifiOn)
+        {
+            WiFi.disconnect();
+        }
+        else
+        {
+            WiFi.disconnect(true);
+            WiFi.mode(WIFI_OFF);
+        }
+        Serial.println("Station disconnected");
+        stationMode = false;
+    }
+    updateNetworkServices();
+}
+
+// HTTP, UDP control, cluster and MQTT run while the access point or the station is up
+void updateNetworkServices()
+{
+    bool up = wifiOn || stationMode;
+    if (up && !networkServicesUp)
+    {
+        server.begin();
+        Serial.println("HTTP server started");
+    }
+    else if (!up && networkServicesUp)
+    {
+        eventStream.clear();
+        server.stop();
+        Serial.println("HTTP server stopped");
     }
+    networkServicesUp = up;
+
+    udpControl->setNetwork(up);
+    cluster->setNetwork(up);
+    mqttBridge->setNetwork(up);
 }
 
 // Interrupt service routine (ISR) for the button press
@@ -347,18 +673,28 @@ void calculateNextAlarm()
 {
     Serial.println("Calculating next alarm");
     DateTime now = rtc->now();
-    alarmQueue = relayManager->getNextAlarm();
+    uint32_t from = now.unixtime();
+
+    // After an alarm wake boot may have crossed the second of the alarm. Start at the
+    // programmed time, so the alarm that woke the device is due instead of next week
+    if (wakeupCause == ESP_SLEEP_WAKEUP_EXT0 && wakeAlarmTime != 0 && wakeAlarmTime <= from && from - wakeAlarmTime <= ALARM_LATE_TOLERANCE)
+    {
+        from = wakeAlarmTime;
+    }
+    wakeAlarmTime = 0;
+
+    alarmScheduler->rebuild(from);
     lastAlarmCalculation = now;
 }
 
 void SaveConfig()
 {
-    configManager->setConfig("config", relayManager->toJson());
+    relayManager->saveConfig();
 }
 
 String LoadConfig()
 {
-    return configManager->getConfig("config", "{}");
+    return configManager->getConfig(CONFIG_LEGACY_KEY, "{}");
 }
 
 // Utility functions
@@ -391,173 +727,656 @@ String getContentType(String filename)
     return "text/plain";
 }
 
-void handleFileRead(String path)
+// Resolved static file, cached per request path so SPIFFS is only searched and
+// hashed once per file and boot
+struct StaticFile
 {
-    Serial.println("Handling file read for: " + path);
-    if (path.endsWith("/"))
-        path += "index.html"; // Default to index.html
+    String path;        // File on SPIFFS, may be the .gz variant
+    String contentType; // Type of the uncompressed file
+    String etag;
+};
+std::map<String, StaticFile> staticFiles;
+
+// Validator from the CRC and size of the file content
+String computeEtag(File &file)
+{
+    uint8_t buffer[512];
+    uint32_t crc = 0;
+    size_t length;
+    while ((length = file.read(buffer, sizeof(buffer))) > 0)
+    {
+        crc = esp_crc32_le(crc, buffer, length);
+    }
+    return "\"" + String(crc, HEX) + "-" + String(file.size(), HEX) + "\"";
+}
 
-    if (SPIFFS.exists(path))
+bool resolveStaticFile(const String &path, bool gzip, StaticFile &result)
+{
+    String key = gzip ? path + "|gz" : path;
+    auto cached = staticFiles.find(key);
+    if (cached != staticFiles.end())
     {
-        File file = SPIFFS.open(path, "r");
-        String contentType = getContentType(path);
-        server.streamFile(file, contentType);
-        file.close();
+        result = cached->second;
+        return true;
     }
-    else if (SPIFFS.exists(path + "/index.html"))
+
+    // Prefer the precompressed variant written by scripts/compress_data.py
+    String candidates[] = {path, path + "/index.html"};
+    for (const String &candidate : candidates)
     {
-        path = path + "/index.html";
-        File file = SPIFFS.open(path, "r");
-        String contentType = getContentType(path);
-        server.streamFile(file, contentType);
+        String found;
+        if (gzip && SPIFFS.exists(candidate + ".gz"))
+            found = candidate + ".gz";
+        else if (SPIFFS.exists(candidate))
+            found = candidate;
+        else
+            continue;
+
+        File file = SPIFFS.open(found, "r");
+        if (!file || file.isDirectory())
+            continue;
+
+        result.path = found;
+        result.contentType = getContentType(candidate);
+        result.etag = computeEtag(file);
         file.close();
+
+        staticFiles[key] = result;
+        return true;
     }
-    else
+    return false;
+}
+
+// Send the ETag of the response. Returns true if the client already has this
+// version and a 304 was sent instead
+bool sendNotModified(const String &etag)
+{
+    server.sendHeader("ETag", etag);
+    if (server.header("If-None-Match").indexOf(etag) >= 0)
     {
-        server.send(404, "text/plain", "404: Not Found");
+        server.send(304);
+        return true;
     }
+    return false;
 }
 
-void sendJsonResponse(int status, const String &message)
+// Conditional GET of API data that changes with the given generation. The boot id
+// keeps a generation counted again after a restart from matching an old ETag
+bool apiNotModified(uint32_t generation, const char *suffix = "")
 {
-    server.send(status, "application/json", message);
+    server.sendHeader("Cache-Control", "no-cache");
+    String etag = "\"" + String(bootId, HEX) + "-" + String(generation) + suffix + (acceptsMsgPack() ? "-m" : "") + "\"";
+    return sendNotModified(etag);
+}
+
+// Cache headers shared by embedded and SPIFFS files. Returns true if the
+// client already has this version and a 304 was sent
+bool sendCacheHeaders(const String &etag, const String &contentType)
+{
+    server.sendHeader("Vary", "Accept-Encoding");
+    // Pages are revalidated so a new UI shows up right after an update. Assets keep
+    // their name across updates, so they are only cached for a limited time
+    if (contentType == "text/html")
+        server.sendHeader("Cache-Control", "no-cache");
+    else
+        server.sendHeader("Cache-Control", "public, max-age=" + String(STATIC_MAX_AGE));
+
+    return sendNotModified(etag);
 }
 
-// Create JSON from string and validate required keys and their types
-String CreateJsonFromString(const String &body, const std::map<String, String> &requiredKeys, StaticJsonDocument<256> &doc)
+void handleFileRead(String path)
 {
-    // Deserialize the JSON document
-    DeserializationError error = deserializeJson(doc, body);
+    Serial.println("Handling file read for: " + path);
+    if (path.endsWith("/"))
+        path += "index.html"; // Default to index.html
+
+    bool gzip = server.header("Accept-Encoding").indexOf("gzip") >= 0;
 
-    // Check if deserialization was successful
-    if (error)
+    // The UI built into the firmware, only stored gzipped. Clients without gzip
+    // support fall through to SPIFFS
+    const WebAsset *asset = gzip ? findWebAsset(path.c_str()) : nullptr;
+    if (asset != nullptr)
     {
-        return "Failed to parse JSON";
+        if (sendCacheHeaders(asset->etag, asset->contentType))
+            return;
+        server.sendHeader("Content-Encoding", "gzip");
+        server.send_P(200, asset->contentType, (const char *)asset->data, asset->length);
+        return;
     }
 
-    // Validate required keys and their types
-    for (const auto &keyTypePair : requiredKeys)
+    StaticFile staticFile;
+    if (!resolveStaticFile(path, gzip, staticFile))
     {
-        const String &key = keyTypePair.first;
-        const String &type = keyTypePair.second;
+        server.send(404, "text/plain", "404: Not Found");
+        return;
+    }
 
-        if (!doc.containsKey(key))
-        {
-            return "Missing key: " + key;
-        }
+    if (sendCacheHeaders(staticFile.etag, staticFile.contentType))
+        return;
 
-        if (type == "uint" && !doc[key].is<uint>())
-        {
-            return "Invalid type for key: " + key;
-        }
-        else if (type == "int" && !doc[key].is<int>())
-        {
-            return "Invalid type for key: " + key;
-        }
-        else if (type == "bool" && !doc[key].is<bool>())
-        {
-            return "Invalid type for key: " + key;
-        }
-        else if (type == "string" && !doc[key].is<String>())
-        {
-            return "Invalid type for key: " + key;
-        }
-        else if (type == "array_bool_7")
-        {
-            if (!doc[key].is<JsonArray>() || doc[key].size() != 7)
-            {
-                return "Invalid array size for key: " + key;
-            }
-            for (int i = 0; i < 7; i++)
-            {
-                if (!doc[key][i].is<bool>())
-                {
-                    return "Invalid array element type for key: " + key;
-                }
-            }
-        }
-    }
+    // streamFile adds Content-Encoding: gzip itself for files ending in .gz
+    File file = SPIFFS.open(staticFile.path, "r");
+    server.streamFile(file, staticFile.contentType);
+    file.close();
+}
 
-    return "";
+// Clients get MessagePack instead of JSON if they accept it
+bool acceptsMsgPack()
+{
+    return server.header("Accept").indexOf("msgpack") >= 0;
 }
 
-// - **Endpoint**: `/api/all-relays` GET
-void handleGetAllRelays()
+bool isMsgPackRequest()
 {
-    try
+    return server.header("Content-Type").indexOf("msgpack") >= 0;
+}
+
+// Collects the raw body of POST and PUT API requests. The WebServer keeps bodies
+// only as text, up to the first zero byte, which MessagePack bodies are full of
+void collectRequestBody()
+{
+    HTTPRaw &raw = server.raw();
+    if (raw.status == RAW_START || raw.status == RAW_ABORTED)
     {
-        StaticJsonDocument<500> doc; // Adjust size as needed
-        doc["systemName"] = relayManager->getName();
-        JsonArray relaysArray = doc.createNestedArray("relays");
-        std::vector<uint> relayIDs = relayManager->getRelayIDs();
-        for (uint id : relayIDs)
+        requestBody.clear();
+        requestBodyTooLarge = false;
+    }
+    else if (raw.status == RAW_WRITE)
+    {
+        if (requestBody.size() + raw.currentSize > API_BODY_MAX)
         {
-            Relay *relay = relayManager->getRelayByID(id);
-            if (relay != nullptr)
-            {
-                JsonObject relayDoc = relaysArray.createNestedObject();
-                relayDoc["id"] = id;
-                relayDoc["name"] = relay->getName();
-                relayDoc["state"] = relay->getState();
-            }
+            requestBodyTooLarge = true;
+            return;
         }
-        String response;
-        serializeJson(doc, response);
-        sendJsonResponse(200, response);
+        requestBody.insert(requestBody.end(), raw.buf, raw.buf + raw.currentSize);
     }
-    catch (const std::exception &e)
+    else if (raw.status == RAW_END)
     {
-        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+        requestBody.push_back('\0');
     }
 }
 
-// - **Endpoint**: `/api/relay-control` POST
-void handleRelayControl()
+void sendJsonResponse(int status, const JsonDocument &doc)
 {
-    try
+    server.sendHeader("Vary", "Accept");
+    if (acceptsMsgPack())
     {
-        // Get body
-        String body = server.arg("plain");
+        size_t length = measureMsgPack(doc);
+        std::unique_ptr<char[]> buffer(new char[length]);
+        serializeMsgPack(doc, buffer.get(), length);
+        server.send_P(status, MSGPACK_CONTENT_TYPE, buffer.get(), length);
+        return;
+    }
 
-        // Define required keys and their types
-        std::map<String, String> requiredKeys = {
-            {"relayId", "uint"},
-            {"state", "bool"}};
+    String response;
+    serializeJson(doc, response);
+    server.send(status, "application/json", response);
+}
+
+void sendJsonResponse(int status, const String &message)
+{
+    if (acceptsMsgPack())
+    {
+        // Messages are small, they are converted through a document
+        JsonDocument doc;
+        deserializeJson(doc, message);
+        sendJsonResponse(status, doc);
+        return;
+    }
+    server.sendHeader("Vary", "Accept");
+    server.send(status, "application/json", message);
+}
 
-        // Allocate memory for the JsonDocument
-        StaticJsonDocument<256> doc; // Adjust size as needed
+// Send a document written by write as JSON, or as MessagePack if the client accepts
+// it. MessagePack runs write twice, the first time to count members and elements.
+// Exceptions thrown before anything is sent are passed on to the caller
+void sendDocument(const std::function<void(JsonWriter &)> &write, int status = 200)
+{
+    bool msgPack = acceptsMsgPack();
+    std::vector<uint32_t> counts;
+    if (msgPack)
+    {
+        JsonWriter counter(counts);
+        write(counter);
+    }
 
-        // Validate and create JSON document from string
-        String validationError = CreateJsonFromString(body, requiredKeys, doc);
-        if (validationError != "")
+    server.sendHeader("Vary", "Accept");
+    ChunkedResponse response(server, status, msgPack ? MSGPACK_CONTENT_TYPE : "application/json");
+    try
+    {
+        if (msgPack)
         {
-            sendJsonResponse(400, "{ \"error\": \"" + validationError + "\"}");
-            return;
+            JsonWriter writer(response, counts);
+            write(writer);
         }
+        else
+        {
+            JsonWriter json(response);
+            write(json);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        // The status line is out, a second response would corrupt the stream
+        Serial.println("Response aborted: " + String(e.what()));
+        response.abort();
+        return;
+    }
+    response.end();
+}
+
+// The body of the current request as JSON text, MessagePack bodies are converted.
+// Sends an error response and returns false if it can not be read
+bool readRequestJson(String &json)
+{
+    bool tooLarge = requestBodyTooLarge;
+    std::vector<char> body;
+    body.swap(requestBody);
+    requestBodyTooLarge = false;
+
+    if (tooLarge)
+    {
+        sendJsonResponse(413, "{ \"error\": \"Request body too large\"}");
+        return false;
+    }
+    if (body.empty() || body.back() != '\0')
+    {
+        json = "";
+        return true;
+    }
+    if (!isMsgPackRequest())
+    {
+        json = body.data();
+        return true;
+    }
+
+    JsonDocument doc;
+    if (deserializeMsgPack(doc, body.data(), body.size() - 1))
+    {
+        sendJsonResponse(400, "{ \"error\": \"Failed to parse MessagePack\"}");
+        return false;
+    }
+    json = "";
+    serializeJson(doc, json);
+    return true;
+}
+
+// Request bodies and their schemas
+struct RelayControlBody
+{
+    uint relayId;
+    bool state;
+};
+constexpr SchemaField<RelayControlBody> relayControlSchema[] = {
+    SCHEMA_INT(RelayControlBody, relayId, 0, LONG_MAX),
+    SCHEMA_BOOL(RelayControlBody, state)};
+
+struct RelayNameBody
+{
+    uint id;
+    String name;
+};
+constexpr SchemaField<RelayNameBody> relayNameSchema[] = {
+    SCHEMA_INT(RelayNameBody, id, 0, LONG_MAX),
+    SCHEMA_STRING(RelayNameBody, name, 0, 255)};
+
+struct SettingsBody
+{
+    String systemName;
+    SchemaList<RelayNameBody, MAX_RELAYS> relays;
+    int8_t lowPower = -1; // -1 if not sent
+};
+constexpr SchemaField<SettingsBody> settingsSchema[] = {
+    SCHEMA_STRING(SettingsBody, systemName, 0, 255),
+    SCHEMA_LIST(SettingsBody, relays, relayNameSchema),
+    SCHEMA_OPTIONAL_BOOL(SettingsBody, lowPower)};
+
+struct RelayAlarmBody
+{
+    uint relayId = 0; // Only sent on creation and over MQTT
+    uint alarmId = 0; // Only sent over MQTT
+    bool state;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    std::array<bool, 7> weekdays;
+};
+constexpr SchemaField<RelayAlarmBody> createRelayAlarmSchema[] = {
+    SCHEMA_INT(RelayAlarmBody, relayId, 0, LONG_MAX),
+    SCHEMA_BOOL(RelayAlarmBody, state),
+    SCHEMA_INT(RelayAlarmBody, hour, 0, 23),
+    SCHEMA_INT(RelayAlarmBody, minute, 0, 59),
+    SCHEMA_INT(RelayAlarmBody, second, 0, 59),
+    SCHEMA_BOOLS(RelayAlarmBody, weekdays)};
+constexpr SchemaField<RelayAlarmBody> updateRelayAlarmSchema[] = {
+    SCHEMA_BOOL(RelayAlarmBody, state),
+    SCHEMA_INT(RelayAlarmBody, hour, 0, 23),
+    SCHEMA_INT(RelayAlarmBody, minute, 0, 59),
+    SCHEMA_INT(RelayAlarmBody, second, 0, 59),
+    SCHEMA_BOOLS(RelayAlarmBody, weekdays)};
+constexpr SchemaField<RelayAlarmBody> mqttUpdateAlarmSchema[] = {
+    SCHEMA_INT(RelayAlarmBody, relayId, 0, LONG_MAX),
+    SCHEMA_INT(RelayAlarmBody, alarmId, 0, LONG_MAX),
+    SCHEMA_BOOL(RelayAlarmBody, state),
+    SCHEMA_INT(RelayAlarmBody, hour, 0, 23),
+    SCHEMA_INT(RelayAlarmBody, minute, 0, 59),
+    SCHEMA_INT(RelayAlarmBody, second, 0, 59),
+    SCHEMA_BOOLS(RelayAlarmBody, weekdays)};
+constexpr SchemaField<RelayAlarmBody> mqttDeleteAlarmSchema[] = {
+    SCHEMA_INT(RelayAlarmBody, relayId, 0, LONG_MAX),
+    SCHEMA_INT(RelayAlarmBody, alarmId, 0, LONG_MAX)};
+
+// The keys an operation needs depend on its op, optional ones are -1 if not sent
+struct BatchOperationBody
+{
+    char op[7]; // create, update or delete
+    uint relayId;
+    long alarmId = -1;
+    int8_t state = -1;
+    int8_t hour = -1;
+    int8_t minute = -1;
+    int8_t second = -1;
+    std::array<int8_t, 7> weekdays = {-1, -1, -1, -1, -1, -1, -1};
+};
+constexpr SchemaField<BatchOperationBody> batchOperationSchema[] = {
+    SCHEMA_STRING(BatchOperationBody, op, 6, 6),
+    SCHEMA_INT(BatchOperationBody, relayId, 0, LONG_MAX),
+    SCHEMA_OPTIONAL_INT(BatchOperationBody, alarmId, 0, LONG_MAX),
+    SCHEMA_OPTIONAL_BOOL(BatchOperationBody, state),
+    SCHEMA_OPTIONAL_INT(BatchOperationBody, hour, 0, 23),
+    SCHEMA_OPTIONAL_INT(BatchOperationBody, minute, 0, 59),
+    SCHEMA_OPTIONAL_INT(BatchOperationBody, second, 0, 59),
+    SCHEMA_OPTIONAL_BOOLS(BatchOperationBody, weekdays)};
+
+struct BatchBody
+{
+    SchemaList<BatchOperationBody, BATCH_MAX_OPERATIONS> operations;
+};
+constexpr SchemaField<BatchBody> batchSchema[] = {
+    SCHEMA_LIST(BatchBody, operations, batchOperationSchema)};
+
+struct ServerTimeBody
+{
+    int hourAdjustment;
+    int minuteAdjustment;
+    int secondAdjustment;
+    char date[11]; // YYYY-MM-DD
+};
+constexpr SchemaField<ServerTimeBody> serverTimeSchema[] = {
+    SCHEMA_INT(ServerTimeBody, hourAdjustment, -23, 23),
+    SCHEMA_INT(ServerTimeBody, minuteAdjustment, -59, 59),
+    SCHEMA_INT(ServerTimeBody, secondAdjustment, -59, 59),
+    SCHEMA_STRING(ServerTimeBody, date, 10, 10)};
+
+struct UdpControlBody
+{
+    char key[2 * UDP_KEY_SIZE + 1]; // Hex, empty to turn UDP control off
+};
+constexpr SchemaField<UdpControlBody> udpControlSchema[] = {
+    SCHEMA_STRING(UdpControlBody, key, 0, 2 * UDP_KEY_SIZE)};
+
+struct ClusterGroupBody
+{
+    char name[CLUSTER_GROUP_SIZE];
+    SchemaList<uint, MAX_RELAYS> relays; // Of this unit
+};
+constexpr SchemaField<ClusterGroupBody> clusterGroupSchema[] = {
+    SCHEMA_STRING(ClusterGroupBody, name, 1, CLUSTER_GROUP_SIZE - 1),
+    SCHEMA_INTS(ClusterGroupBody, relays, 0, LONG_MAX)};
+
+struct ClusterBody
+{
+    bool enabled;
+    SchemaList<ClusterGroupBody, CLUSTER_MAX_GROUPS> groups;
+};
+constexpr SchemaField<ClusterBody> clusterSchema[] = {
+    SCHEMA_BOOL(ClusterBody, enabled),
+    SCHEMA_LIST(ClusterBody, groups, clusterGroupSchema)};
+
+struct GroupControlBody
+{
+    char group[CLUSTER_GROUP_SIZE];
+    bool state;
+};
+constexpr SchemaField<GroupControlBody> groupControlSchema[] = {
+    SCHEMA_STRING(GroupControlBody, group, 1, CLUSTER_GROUP_SIZE - 1),
+    SCHEMA_BOOL(GroupControlBody, state)};
+
+struct StationBody
+{
+    char ssid[33]; // Empty to leave the network
+    char password[64];
+};
+constexpr SchemaField<StationBody> stationSchema[] = {
+    SCHEMA_STRING(StationBody, ssid, 0, 32),
+    SCHEMA_STRING(StationBody, password, 0, 63)};
+
+struct MqttBody
+{
+    String uri; // Empty to turn the bridge off
+    String username;
+    String password;
+    String prefix;
+};
+constexpr SchemaField<MqttBody> mqttSchema[] = {
+    SCHEMA_STRING(MqttBody, uri, 0, 255),
+    SCHEMA_STRING(MqttBody, username, 0, 64),
+    SCHEMA_STRING(MqttBody, password, 0, 64),
+    SCHEMA_STRING(MqttBody, prefix, 1, 64)};
+
+// Decode the request body with a schema. Sends a 400 response and returns false if it does not match
+template <typename T, size_t N>
+bool decodeBody(const SchemaField<T> (&schema)[N], T &body)
+{
+    String plain;
+    if (!readRequestJson(plain))
+    {
+        return false;
+    }
+    BufferStream input(plain.c_str(), plain.length());
+    JsonReader reader(input);
+    SchemaError error = decodeSchema(reader, schema, body);
+    if (error.isError())
+    {
+        sendJsonResponse(400, "{ \"error\": \"" + String(error.message) + (error.key != nullptr ? error.key : "") + "\"}");
+        return false;
+    }
+    return true;
+}
+
+// Members of an alarm as returned by /api/relay-alarms, limited to the selected fields
+void alarmToJson(const RelaySnapshot::AlarmInfo &alarm, JsonWriter &json, uint8_t fields = FIELDS_ALL)
+{
+    json.member("id", alarm.id);
+    if (fields & ALARM_FIELD_STATE)
+        json.member("state", AlarmTable::stateOf(alarm.record));
+
+    uint32_t secondOfDay = AlarmTable::secondOf(alarm.record);
+    char digits[3];
+    if (fields & ALARM_FIELD_HOUR)
+    {
+        snprintf(digits, sizeof(digits), "%02u", (unsigned)(secondOfDay / 3600));
+        json.member("hour", (const char *)digits);
+    }
+    if (fields & ALARM_FIELD_MINUTE)
+    {
+        snprintf(digits, sizeof(digits), "%02u", (unsigned)(secondOfDay / 60 % 60));
+        json.member("minute", (const char *)digits);
+    }
+    if (fields & ALARM_FIELD_SECOND)
+    {
+        snprintf(digits, sizeof(digits), "%02u", (unsigned)(secondOfDay % 60));
+        json.member("second", (const char *)digits);
+    }
+
+    if (fields & ALARM_FIELD_WEEKDAYS)
+    {
+        json.key("weekdays");
+        json.beginArray();
+        std::array<bool, 7> weekdays = AlarmTable::weekdayArray(AlarmTable::weekdaysOf(alarm.record));
+        for (int i = 0; i < 7; i++)
+        {
+            json.value(weekdays[i]);
+        }
+        json.endArray();
+    }
+}
+
+// Members of a relay as returned by /api/all-relays
+void relayToJson(const RelaySnapshot::RelayInfo &relay, JsonWriter &json, uint8_t fields = FIELDS_ALL)
+{
+    json.member("id", relay.id);
+    if (fields & RELAY_FIELD_NAME)
+        json.member("name", relay.name);
+    if (fields & RELAY_FIELD_STATE)
+        json.member("state", relay.state);
+}
 
-        // Get relay id and state
-        uint relayId = doc["relayId"].as<uint>();
-        bool state = doc["state"].as<bool>();
-
-        Relay *relay = relayManager->getRelayByID(relayId);
-        if (relay != nullptr)
+// Parse the fields= argument into a mask of the given names, the first name is
+// bit 0. Returns false on an unknown name
+bool parseFields(const char *const names[], size_t count, uint8_t &fields)
+{
+    fields = FIELDS_ALL;
+    if (!server.hasArg("fields"))
+        return true;
+
+    fields = 0x01; // The id is always sent
+    String list = server.arg("fields");
+    int start = 0;
+    while (start <= (int)list.length())
+    {
+        int end = list.indexOf(',', start);
+        if (end < 0)
+            end = list.length();
+        String field = list.substring(start, end);
+        field.trim();
+        start = end + 1;
+        if (field.length() == 0)
+            continue;
+
+        size_t i = 0;
+        while (i < count && field != names[i])
+            i++;
+        if (i == count)
+            return false;
+        fields |= 1 << i;
+    }
+    return true;
+}
+
+// Parse the since= argument. Returns true if only changes after it are to be sent.
+// reset is set if the snapshot can not tell what changed since then, everything is sent
+bool parseSince(const RelaySnapshot &snapshot, uint32_t &since, bool &reset)
+{
+    since = 0;
+    reset = false;
+    if (!server.hasArg("since"))
+        return false;
+
+    since = strtoul(server.arg("since").c_str(), nullptr, 10);
+    if (!snapshot.hasChangesSince(since))
+    {
+        reset = true;
+        return false;
+    }
+    return true;
+}
+
+// Members describing a delta response: the generation to use as the next since,
+// whether the client has to drop its state and the removed ids
+void removalsToJson(const std::vector<RelaySnapshot::Removal> &removals, JsonWriter &json, uint32_t since, bool reset, const uint *relayId = nullptr)
+{
+    json.member("reset", reset);
+    json.key("removed");
+    json.beginArray();
+    for (const RelaySnapshot::Removal &removal : removals)
+    {
+        if (removal.generation > since && (relayId == nullptr || removal.relayId == *relayId))
+        {
+            json.value(removal.id);
+        }
+    }
+    json.endArray();
+}
+
+// - **Endpoint**: `/api/all-relays` GET
+void handleGetAllRelays()
+{
+    try
+    {
+        static const char *const fieldNames[] = {"id", "name", "state"};
+        uint8_t fields;
+        if (!parseFields(fieldNames, 3, fields))
+        {
+            sendJsonResponse(400, "{ \"error\": \"Unknown field\"}");
+            return;
+        }
+
+        // Nothing is read or serialized if the client has the current relays
+        std::shared_ptr<const RelaySnapshot> snapshot = alarmScheduler->getSnapshot();
+        if (apiNotModified(std::max(snapshot->relaysChanged, snapshot->nameChanged)))
         {
-            if (state)
+            return;
+        }
+
+        uint32_t since;
+        bool reset;
+        bool delta = parseSince(*snapshot, since, reset);
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("systemName", snapshot->systemName);
+            json.member("generation", snapshot->generation);
+            json.key("relays");
+            json.beginArray();
+            for (const RelaySnapshot::RelayInfo &relay : snapshot->relays)
             {
-                relay->On();
+                if (delta && relay.changed <= since)
+                    continue;
+
+                json.beginObject();
+                relayToJson(relay, json, fields);
+                json.endObject();
             }
-            else
+            json.endArray();
+            if (server.hasArg("since"))
             {
-                relay->Off();
+                removalsToJson(snapshot->removedRelays, json, since, reset);
             }
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/relay-control` POST
+void handleRelayControl()
+{
+    try
+    {
+        // Get relay id and state
+        RelayControlBody body;
+        if (!decodeBody(relayControlSchema, body))
+        {
+            return;
+        }
+        uint relayId = body.relayId;
+        bool state = body.state;
+
+        SchedulerCommand command(SchedulerCommand::SET_RELAY);
+        command.relayId = relayId;
+        command.state = state;
+        if (alarmScheduler->submit(command) == SchedulerCommand::OK)
+        {
             StaticJsonDocument<200> responseDoc;
             responseDoc["message"] = "Relay state updated successfully";
             responseDoc["relayId"] = relayId;
             responseDoc["state"] = state;
 
-            String response;
-            serializeJson(responseDoc, response);
-            sendJsonResponse(200, response);
+            sendJsonResponse(200, responseDoc);
         }
         else
         {
@@ -575,36 +1394,47 @@ void handleSystemSettings()
 {
     try
     {
-        DateTime now = rtc->now();
-
-        StaticJsonDocument<200> doc;
-        doc["systemName"] = relayManager->getName();
-
-        // Format month and day with leading zeros
-        String month = String(now.month());
-        if (month.length() == 1)
-            month = "0" + month;
-        String day = String(now.day());
-        if (day.length() == 1)
-            day = "0" + day;
-
-        JsonArray relaysArray = doc.createNestedArray("relays");
-        std::vector<uint> relayIDs = relayManager->getRelayIDs();
-        for (uint id : relayIDs)
+        std::shared_ptr<const RelaySnapshot> snapshot = alarmScheduler->getSnapshot();
+        if (apiNotModified(std::max(snapshot->relaysChanged, snapshot->nameChanged), lowPowerMode ? "-l" : ""))
         {
-            Relay *relay = relayManager->getRelayByID(id);
-            if (relay != nullptr)
+            return;
+        }
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("lowPower", lowPowerMode);
+            json.member("systemName", snapshot->systemName);
+            json.key("relays");
+            json.beginArray();
+            for (const RelaySnapshot::RelayInfo &relay : snapshot->relays)
             {
-                JsonObject relayDoc = relaysArray.createNestedObject();
-                relayDoc["id"] = id;
-                relayDoc["name"] = relay->getName();
-                relayDoc["state"] = relay->getState();
+                json.beginObject();
+                relayToJson(relay, json);
+                json.endObject();
             }
-        }
+            json.endArray();
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
 
-        String response;
-        serializeJson(doc, response);
-        sendJsonResponse(200, response);
+// - **Endpoint**: `/api/diagnostics` GET
+// Live figures, sent without an ETag so they are never answered from a cache
+void handleDiagnostics()
+{
+    try
+    {
+        sendDocument([](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("wakeLatencyUs", lastWakeLatency);
+            json.member("freeHeap", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+            json.member("largestFreeBlock", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+            json.endObject(); });
     }
     catch (const std::exception &e)
     {
@@ -617,48 +1447,41 @@ void handleUpdateSettings()
 {
     try
     {
-        // Get body
-        String body = server.arg("plain");
-
-        // Define required keys and their types
-        std::map<String, String> requiredKeys = {
-            {"systemName", "string"},
-            {"relays", "array"}};
-
-        // Allocate memory for the JsonDocument
-        StaticJsonDocument<256> doc; // Adjust size as needed
-
-        // Validate and create JSON document from string
-        String validationError = CreateJsonFromString(body, requiredKeys, doc);
-        if (validationError != "")
+        SettingsBody body;
+        if (!decodeBody(settingsSchema, body))
         {
-            sendJsonResponse(400, "{ \"error\": \"" + validationError + "\"}");
             return;
         }
 
-        relayManager->setName(doc["systemName"].as<String>());
+        alarmScheduler->run([&]()
+                            {
+            relayManager->setName(body.systemName);
 
-        // Update relays
-        for (auto relay : doc["relays"].as<JsonArray>())
-        {
-            uint id = relay["id"].as<uint>();
-            String name = relay["name"].as<String>();
-            Relay *r = relayManager->getRelayByID(id);
-            if (r != nullptr)
+            // Optional low power mode
+            if (body.lowPower != -1)
             {
-                r->setName(name);
+                lowPowerMode = body.lowPower;
+                configManager->setConfig("lowPower", lowPowerMode ? "1" : "0");
+            }
+
+            // Update relays
+            for (size_t i = 0; i < body.relays.count; i++)
+            {
+                const RelayNameBody &relay = body.relays.items[i];
+                Relay *r = relayManager->getRelayByID(relay.id);
+                if (r != nullptr)
+                {
+                    r->setName(relay.name);
+                }
             }
-        }
 
-        // Save config
-        SaveConfig();
+            // Save config
+            SaveConfig(); });
 
         StaticJsonDocument<200> responseDoc;
         responseDoc["message"] = "Settings updated successfully";
 
-        String response;
-        serializeJson(responseDoc, response);
-        sendJsonResponse(200, response);
+        sendJsonResponse(200, responseDoc);
     }
     catch (const std::exception &e)
     {
@@ -674,52 +1497,127 @@ void handleGetRelayAlarms()
         // get relay id
         uint relayId = server.arg("relayId").toInt();
 
+        static const char *const fieldNames[] = {"id", "state", "hour", "minute", "second", "weekdays"};
+        uint8_t fields;
+        if (!parseFields(fieldNames, 6, fields))
+        {
+            sendJsonResponse(400, "{ \"error\": \"Unknown field\"}");
+            return;
+        }
+
+        // Pages start at the alarm id in cursor and hold up to limit alarms
+        uint cursor = server.hasArg("cursor") ? strtoul(server.arg("cursor").c_str(), nullptr, 10) : 0;
+        long limit = server.hasArg("limit") ? server.arg("limit").toInt() : -1;
+        if (server.hasArg("limit") && limit <= 0)
+        {
+            sendJsonResponse(400, "{ \"error\": \"Invalid limit\"}");
+            return;
+        }
+
         // get relay
-        Relay *relay = relayManager->getRelayByID(relayId);
-        if (relay != nullptr)
+        std::shared_ptr<const RelaySnapshot> snapshot = alarmScheduler->getSnapshot();
+        if (snapshot->findRelay(relayId) == nullptr)
         {
-            StaticJsonDocument<500> doc; // Adjust size as needed
-            JsonArray alarmsArray = doc.createNestedArray("alarms");
+            sendJsonResponse(404, "{ \"error\": \"Relay not found\"}");
+            return;
+        }
+
+        uint32_t since;
+        bool reset;
+        bool delta = parseSince(*snapshot, since, reset);
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("generation", snapshot->generation);
+            json.key("alarms");
+            json.beginArray();
+            long count = 0;
+            bool more = false;
+            uint nextCursor = 0;
+            for (const RelaySnapshot::AlarmInfo &alarm : snapshot->alarms)
+            {
+                if (alarm.relayId != relayId || alarm.id < cursor || (delta && alarm.changed <= since))
+                {
+                    continue;
+                }
+                if (limit >= 0 && count == limit)
+                {
+                    more = true;
+                    nextCursor = alarm.id;
+                    break;
+                }
+
+                json.beginObject();
+                alarmToJson(alarm, json, fields);
+                json.endObject();
+                count++;
+            }
+            json.endArray();
+            if (more)
+            {
+                json.member("nextCursor", nextCursor);
+            }
+            if (server.hasArg("since"))
+            {
+                removalsToJson(snapshot->removedAlarms, json, since, reset, &relayId);
+            }
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/dashboard` GET
+void handleDashboard()
+{
+    try
+    {
+        // Everything comes from one snapshot, so relays and alarms are consistent
+        std::shared_ptr<const RelaySnapshot> snapshot = alarmScheduler->getSnapshot();
+        DateTime now = rtc->now();
 
-            std::vector<uint> alarmIDs = relay->getAlarmIDs();
-            for (uint id : alarmIDs)
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("generation", snapshot->generation);
+            json.member("systemName", snapshot->systemName);
+            json.member("lowPower", lowPowerMode);
+
+            json.key("time");
+            json.beginObject();
+            json.member("hour", now.hour());
+            json.member("minute", now.minute());
+            json.member("second", now.second());
+            json.member("day", now.day());
+            json.member("month", now.month());
+            json.member("year", now.year());
+            json.member("weekday", now.dayOfTheWeek());
+            json.endObject();
+
+            // Alarms are grouped by relay in relay order
+            json.key("relays");
+            json.beginArray();
+            size_t alarm = 0;
+            for (const RelaySnapshot::RelayInfo &relay : snapshot->relays)
             {
-                Alarm *alarm = relay->getAlarmByID(id);
-                if (alarm != nullptr)
+                json.beginObject();
+                relayToJson(relay, json);
+                json.key("alarms");
+                json.beginArray();
+                for (; alarm < snapshot->alarms.size() && snapshot->alarms[alarm].relayId == relay.id; alarm++)
                 {
-                    JsonObject alarmDoc = alarmsArray.createNestedObject();
-                    alarmDoc["id"] = id;
-                    alarmDoc["state"] = alarm->getState();
-
-                    String hour = String(alarm->getHour());
-                    String minute = String(alarm->getMinute());
-                    String second = String(alarm->getSecond());
-                    if (hour.length() == 1)
-                        hour = "0" + hour;
-                    if (minute.length() == 1)
-                        minute = "0" + minute;
-                    if (second.length() == 1)
-                        second = "0" + second;
-                    alarmDoc["hour"] = hour;
-                    alarmDoc["minute"] = minute;
-                    alarmDoc["second"] = second;
-
-                    JsonArray weekdaysArray = alarmDoc.createNestedArray("weekdays");
-                    std::array<bool, 7> weekdays = alarm->getWeekdays();
-                    for (int i = 0; i < 7; i++)
-                    {
-                        weekdaysArray.add(weekdays[i]);
-                    }
+                    json.beginObject();
+                    alarmToJson(snapshot->alarms[alarm], json);
+                    json.endObject();
                 }
+                json.endArray();
+                json.endObject();
             }
-            String response;
-            serializeJson(doc, response);
-            sendJsonResponse(200, response);
-        }
-        else
-        {
-            sendJsonResponse(404, "{ \"error\": \"Relay not found\"}");
-        }
+            json.endArray();
+            json.endObject(); });
     }
     catch (const std::exception &e)
     {
@@ -732,73 +1630,33 @@ void handleCreateRelayAlarm()
 {
     try
     {
-        // Get body
-        String body = server.arg("plain");
-
-        // Define required keys and their types
-        std::map<String, String> requiredKeys = {
-            {"relayId", "uint"},
-            {"state", "bool"},
-            {"hour", "uint"},
-            {"minute", "uint"},
-            {"second", "uint"},
-            {"weekdays", "array_bool_7"}};
-
-        // Allocate memory for the JsonDocument
-        StaticJsonDocument<256> doc; // Adjust size as needed
-
-        // Validate and create JSON document from string
-        String validationError = CreateJsonFromString(body, requiredKeys, doc);
-        if (validationError != "")
+        // Get relayId, state, time, and weekdays. The schema checks the time ranges
+        RelayAlarmBody body;
+        if (!decodeBody(createRelayAlarmSchema, body))
         {
-            sendJsonResponse(400, "{ \"error\": \"" + validationError + "\"}");
             return;
         }
 
-        // Get relayId, state, time, and weekdays
-        uint relayId = doc["relayId"].as<uint>();
-        bool state = doc["state"].as<bool>();
-        uint hour = doc["hour"].as<uint>();
-        uint minute = doc["minute"].as<uint>();
-        uint second = doc["second"].as<uint>();
-        std::array<bool, 7> weekdays;
-        for (int i = 0; i < 7; i++)
-        {
-            weekdays[i] = doc["weekdays"][i].as<bool>();
-        }
-
-        // Get relay
-        Relay *relay = relayManager->getRelayByID(relayId);
-        if (relay == nullptr)
+        // Create alarm and save config
+        SchedulerCommand command(SchedulerCommand::ADD_ALARM);
+        command.relayId = body.relayId;
+        command.state = body.state;
+        command.hour = body.hour;
+        command.minute = body.minute;
+        command.second = body.second;
+        command.weekdays = body.weekdays;
+        if (alarmScheduler->submit(command) == SchedulerCommand::RELAY_NOT_FOUND)
         {
             sendJsonResponse(404, "{ \"error\": \"Relay not found\"}");
             return;
         }
 
-        // Parse time
-        if (hour > 23 || minute > 59 || second > 59)
-        {
-            sendJsonResponse(400, "{ \"error\": \"Invalid time values\"}");
-            return;
-        }
-
-        // Create alarm
-        Alarm *alarm = relay->addAlarm(hour, minute, second, weekdays, state);
-
-        // Calculate new alarm queue
-        calculateNextAlarm();
-
-        // Save config
-        SaveConfig();
-
         // Create response
         StaticJsonDocument<200> responseDoc;
         responseDoc["message"] = "Relay alarm rule created successfully";
-        responseDoc["ruleId"] = alarm->getId();
+        responseDoc["ruleId"] = command.alarmId;
 
-        String response;
-        serializeJson(responseDoc, response);
-        sendJsonResponse(200, response);
+        sendJsonResponse(200, responseDoc);
     }
     catch (const std::exception &e)
     {
@@ -811,25 +1669,10 @@ void handleUpdateRelayAlarm()
 {
     try
     {
-        // Get body
-        String body = server.arg("plain");
-
-        // Define required keys and their types
-        std::map<String, String> requiredKeys = {
-            {"state", "bool"},
-            {"hour", "uint"},
-            {"minute", "uint"},
-            {"second", "uint"},
-            {"weekdays", "array_bool_7"}};
-
-        // Allocate memory for the JsonDocument
-        StaticJsonDocument<256> doc; // Adjust size as needed
-
-        // Validate and create JSON document from string
-        String validationError = CreateJsonFromString(body, requiredKeys, doc);
-        if (validationError != "")
+        // Get state, time and weekdays. The schema checks the time ranges
+        RelayAlarmBody body;
+        if (!decodeBody(updateRelayAlarmSchema, body))
         {
-            sendJsonResponse(400, "{ \"error\": \"" + validationError + "\"}");
             return;
         }
 
@@ -837,62 +1680,32 @@ void handleUpdateRelayAlarm()
         uint relayId = server.arg("relayId").toInt();
         uint alarmId = server.arg("alarmId").toInt();
 
-        // Get relay
-        Relay *relay = relayManager->getRelayByID(relayId);
-        if (relay == nullptr)
+        // Update alarm and save config
+        SchedulerCommand command(SchedulerCommand::UPDATE_ALARM);
+        command.relayId = relayId;
+        command.alarmId = alarmId;
+        command.state = body.state;
+        command.hour = body.hour;
+        command.minute = body.minute;
+        command.second = body.second;
+        command.weekdays = body.weekdays;
+        SchedulerCommand::Result result = alarmScheduler->submit(command);
+        if (result == SchedulerCommand::RELAY_NOT_FOUND)
         {
             sendJsonResponse(404, "{ \"error\": \"Relay not found\"}");
             return;
         }
-
-        // Get alarm
-        Alarm *alarm = relay->getAlarmByID(alarmId);
-        if (alarm == nullptr)
+        if (result == SchedulerCommand::ALARM_NOT_FOUND)
         {
             sendJsonResponse(404, "{ \"error\": \"Alarm not found\"}");
             return;
         }
 
-        // Get state, time and weekdays
-        bool state = doc["state"].as<bool>();
-        uint hour = doc["hour"].as<uint>();
-        uint minute = doc["minute"].as<uint>();
-        uint second = doc["second"].as<uint>();
-        std::array<bool, 7> weekdays;
-        for (int i = 0; i < 7; i++)
-        {
-            weekdays[i] = doc["weekdays"][i].as<bool>();
-        }
-
-        // Validate time
-        if (hour > 23 || minute > 59 || second > 59)
-        {
-            sendJsonResponse(400, "{ \"error\": \"Invalid time values\"}");
-            return;
-        }
-
-        // Update alarm
-        alarm->setHour(hour);
-        alarm->setMinute(minute);
-        alarm->setSecond(second);
-        alarm->setWeekdays(weekdays);
-        alarm->setState(state);
-
-        // Calculate new alarm queue
-        calculateNextAlarm();
-
-        Serial.println("Updated alarm: " + String(alarm->getHour()) + ":" + String(alarm->getMinute()) + ":" + String(alarm->getSecond()));
-
-        // Save config
-        SaveConfig();
-
         // Create response
         StaticJsonDocument<200> responseDoc;
         responseDoc["message"] = "Relay alarm rule updated successfully";
 
-        String response;
-        serializeJson(responseDoc, response);
-        sendJsonResponse(200, response);
+        sendJsonResponse(200, responseDoc);
     }
     catch (const std::exception &e)
     {
@@ -909,35 +1722,27 @@ void handleDeleteRelayAlarm()
         uint relayId = server.arg("relayId").toInt();
         uint alarmId = server.arg("alarmId").toInt();
 
-        // Get relay
-        Relay *relay = relayManager->getRelayByID(relayId);
-        if (relay == nullptr)
+        // Delete alarm and save config
+        SchedulerCommand command(SchedulerCommand::DELETE_ALARM);
+        command.relayId = relayId;
+        command.alarmId = alarmId;
+        SchedulerCommand::Result result = alarmScheduler->submit(command);
+        if (result == SchedulerCommand::RELAY_NOT_FOUND)
         {
             sendJsonResponse(404, "{ \"error\": \"Relay not found\"}");
             return;
         }
-
-        // Get alarm
-        Alarm *alarm = relay->getAlarmByID(alarmId);
-        if (alarm == nullptr)
+        if (result == SchedulerCommand::ALARM_NOT_FOUND)
         {
             sendJsonResponse(404, "{ \"error\": \"Alarm not found\"}");
             return;
         }
 
-        // Delete alarm
-        relay->removeAlarm(alarmId);
-
-        // Calculate new alarm queue
-        calculateNextAlarm();
-
         // Create response
         StaticJsonDocument<200> responseDoc;
         responseDoc["message"] = "Relay alarm rule deleted successfully";
 
-        String response;
-        serializeJson(responseDoc, response);
-        sendJsonResponse(200, response);
+        sendJsonResponse(200, responseDoc);
     }
     catch (const std::exception &e)
     {
@@ -945,82 +1750,180 @@ void handleDeleteRelayAlarm()
     }
 }
 
-// - **Endpoint**: `/api/server-time` GET
-void handleServerTime()
+// Turn a decoded batch operation into a scheduler command. Returns an error
+// message if its op is unknown or a key it needs is missing
+String toBatchCommand(const BatchOperationBody &body, SchedulerCommand &operation)
 {
-    try
+    bool rule = true;
+    if (strcmp(body.op, "create") == 0)
     {
-        DateTime now = rtc->now();
+        operation.type = SchedulerCommand::ADD_ALARM;
+    }
+    else if (strcmp(body.op, "update") == 0)
+    {
+        operation.type = SchedulerCommand::UPDATE_ALARM;
+    }
+    else if (strcmp(body.op, "delete") == 0)
+    {
+        operation.type = SchedulerCommand::DELETE_ALARM;
+        rule = false;
+    }
+    else
+    {
+        return "op must be create, update or delete";
+    }
 
-        StaticJsonDocument<200> doc;
-        doc["hour"] = now.hour();
-        doc["minute"] = now.minute();
-        doc["second"] = now.second();
-        doc["day"] = now.day();
-        doc["month"] = now.month();
-        doc["year"] = now.year();
-        doc["weekday"] = now.dayOfTheWeek();
+    bool alarm = operation.type != SchedulerCommand::ADD_ALARM;
+    if ((alarm && body.alarmId < 0) ||
+        (rule && (body.state < 0 || body.hour < 0 || body.minute < 0 || body.second < 0 || body.weekdays[0] < 0)))
+    {
+        return "Missing key for " + String(body.op);
+    }
 
-        String response;
-        serializeJson(doc, response);
-        sendJsonResponse(200, response);
+    operation.relayId = body.relayId;
+    operation.alarmId = alarm ? body.alarmId : 0;
+    if (rule)
+    {
+        operation.state = body.state;
+        operation.hour = body.hour;
+        operation.minute = body.minute;
+        operation.second = body.second;
+        for (size_t day = 0; day < operation.weekdays.size(); day++)
+        {
+            operation.weekdays[day] = body.weekdays[day];
+        }
     }
-    catch (const std::exception &e)
+    return "";
+}
+
+const char *batchStatus(SchedulerCommand::Result result)
+{
+    switch (result)
     {
-        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    case SchedulerCommand::OK:
+        return "ok";
+    case SchedulerCommand::RELAY_NOT_FOUND:
+        return "relayNotFound";
+    case SchedulerCommand::ALARM_NOT_FOUND:
+        return "alarmNotFound";
+    case SchedulerCommand::TABLE_FULL:
+        return "tableFull";
+    default:
+        return "notExecuted";
     }
 }
 
-// - **Endpoint**: `/api/server-time` POST
-void handleUpdateServerTime()
+// - **Endpoint**: `/api/relay-alarms/batch` POST
+void handleBatchRelayAlarms()
 {
     try
     {
-        // Get body
-        String body = server.arg("plain");
-
-        // Define required keys and their types
-        std::map<String, String> requiredKeys = {
-            {"hourAdjustment", "int"},
-            {"minuteAdjustment", "int"},
-            {"secondAdjustment", "int"},
-            {"date", "string"}};
-
-        // Allocate memory for the JsonDocument
-        StaticJsonDocument<256> doc; // Adjust size as needed
-
-        // Validate and create JSON document from string
-        String validationError = CreateJsonFromString(body, requiredKeys, doc);
-        if (validationError != "")
+        // Too large for the stack of the web task
+        std::unique_ptr<BatchBody> body(new BatchBody());
+        if (!decodeBody(batchSchema, *body))
         {
-            sendJsonResponse(400, "{ \"error\": \"" + validationError + "\"}");
             return;
         }
 
-        DateTime now = rtc->now();
-
-        // Get hour, minute, second, day, month, year
-        int hourAdjustment = (doc["hourAdjustment"].as<int>() + now.hour()) % 24;
-        int minuteAdjustment = (doc["minuteAdjustment"].as<int>() + now.minute()) % 60;
-        int secondAdjustment = (doc["secondAdjustment"].as<int>() + now.second()) % 60;
-        String systemDate = doc["date"].as<String>();
-        int year = systemDate.substring(0, 4).toInt();
-        int month = systemDate.substring(5, 7).toInt();
-        int day = systemDate.substring(8, 10).toInt();
+        // Every operation is checked before any of them is submitted
+        std::vector<SchedulerCommand> operations;
+        operations.reserve(body->operations.count);
+        for (size_t i = 0; i < body->operations.count; i++)
+        {
+            operations.push_back(SchedulerCommand(SchedulerCommand::ADD_ALARM));
+            String error = toBatchCommand(body->operations.items[i], operations.back());
+            if (error != "")
+            {
+                sendJsonResponse(400, "{ \"error\": \"" + error + "\", \"index\": " + String(i) + "}");
+                return;
+            }
+        }
+
+        // Applied as a whole on the scheduler task, or not at all
+        SchedulerCommand command(SchedulerCommand::BATCH);
+        command.batch = &operations;
+        bool applied = alarmScheduler->submit(command) == SchedulerCommand::OK;
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("applied", applied);
+            json.key("results");
+            json.beginArray();
+            for (const SchedulerCommand &operation : operations)
+            {
+                json.beginObject();
+                json.member("status", batchStatus(operation.result));
+                if (operation.type != SchedulerCommand::DELETE_ALARM && applied)
+                {
+                    json.member("alarmId", operation.alarmId);
+                }
+                json.endObject();
+            }
+            json.endArray();
+            json.endObject(); }, applied ? 200 : 409);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/server-time` GET
+void handleServerTime()
+{
+    try
+    {
+        DateTime now = rtc->now();
 
-        // Set the time
-        rtc->setDateTime(DateTime(year, month, day, hourAdjustment, minuteAdjustment, secondAdjustment));
+        StaticJsonDocument<200> doc;
+        doc["hour"] = now.hour();
+        doc["minute"] = now.minute();
+        doc["second"] = now.second();
+        doc["day"] = now.day();
+        doc["month"] = now.month();
+        doc["year"] = now.year();
+        doc["weekday"] = now.dayOfTheWeek();
 
-        // Calculate new alarm queue
-        calculateNextAlarm();
+        sendJsonResponse(200, doc);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/server-time` POST
+void handleUpdateServerTime()
+{
+    try
+    {
+        ServerTimeBody body;
+        if (!decodeBody(serverTimeSchema, body))
+        {
+            return;
+        }
+
+        DateTime now = rtc->now();
+
+        // Get hour, minute, second, day, month, year. The adjustments are at most one unit around
+        int hourAdjustment = (body.hourAdjustment + now.hour() + 24) % 24;
+        int minuteAdjustment = (body.minuteAdjustment + now.minute() + 60) % 60;
+        int secondAdjustment = (body.secondAdjustment + now.second() + 60) % 60;
+        int year = atoi(body.date);
+        int month = atoi(body.date + 5);
+        int day = atoi(body.date + 8);
+
+        // Set the time, calculate the new alarm queue and apply the states of the new time
+        SchedulerCommand command(SchedulerCommand::SET_TIME);
+        command.unixtime = DateTime(year, month, day, hourAdjustment, minuteAdjustment, secondAdjustment).unixtime();
+        alarmScheduler->submit(command);
 
         // Create response
         StaticJsonDocument<200> responseDoc;
         responseDoc["message"] = "Server time updated successfully";
 
-        String response;
-        serializeJson(responseDoc, response);
-        sendJsonResponse(200, response);
+        sendJsonResponse(200, responseDoc);
     }
     catch (const std::exception &e)
     {
@@ -1060,7 +1963,7 @@ void handleFirmwareUpdate()
         else
         {
             Serial.println("Unknown file type");
-            server.send(400, "application/json", "{\"error\": \"Invalid file type\"}");
+            sendJsonResponse(400, "{\"error\": \"Invalid file type\"}");
             return;
         }
     }
@@ -1095,7 +1998,7 @@ void handleFirmwareUpdate()
     else
     {
         Serial.println("Invalid file upload status");
-        server.send(400, "application/json", "{\"error\": \"Invalid file upload\"}");
+        sendJsonResponse(400, "{\"error\": \"Invalid file upload\"}");
     }
 }
 
@@ -1105,20 +2008,601 @@ void handleReset()
 
     try
     {
-        factoryreset();
-        server.send(200, "application/json", "{\"message\": \"Device reset\"}");
+        alarmScheduler->run(factoryreset);
+        sendJsonResponse(200, "{\"message\": \"Device reset\"}");
         restart();
     }
     catch (const std::exception &e)
     {
-        server.send(500, "application/json", "{\"error\": \"Failed to reset device\"}");
+        sendJsonResponse(500, "{\"error\": \"Failed to reset device\"}");
+    }
+}
+
+// - **Endpoint**: `/api/events` GET
+void handleEvents()
+{
+    // The stream keeps the connection of this request, it is written by the web task loop
+    if (!eventStream.subscribe(server.client()))
+    {
+        sendJsonResponse(503, "{ \"error\": \"Too many event subscribers\"}");
+    }
+}
+
+// - **Endpoint**: `/api/udp-control` GET
+void handleUdpControl()
+{
+    try
+    {
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("enabled", udpControl->hasKey());
+            json.member("port", UDP_CONTROL_PORT);
+            json.member("session", udpControl->getSession());
+            json.member("lastLatencyUs", udpControl->getLastLatency());
+            json.member("maxLatencyUs", udpControl->getMaxLatency());
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/udp-control` POST
+void handleUpdateUdpControl()
+{
+    try
+    {
+        UdpControlBody body;
+        if (!decodeBody(udpControlSchema, body))
+        {
+            return;
+        }
+
+        uint8_t key[UDP_KEY_SIZE];
+        bool enabled = body.key[0] != '\0';
+        if (enabled && !parseUdpKey(body.key, key))
+        {
+            sendJsonResponse(400, "{ \"error\": \"Key must be 64 hex digits\"}");
+            return;
+        }
+
+        configManager->setConfig("udpKey", body.key);
+        udpControl->setKey(enabled ? key : nullptr);
+        cluster->setKey(enabled ? key : nullptr);
+
+        StaticJsonDocument<200> responseDoc;
+        responseDoc["message"] = enabled ? "UDP control enabled" : "UDP control disabled";
+
+        sendJsonResponse(200, responseDoc);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/cluster` GET
+void handleCluster()
+{
+    try
+    {
+        Cluster::Status status = cluster->getStatus();
+        std::vector<Cluster::Group> groups = cluster->getGroups();
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("enabled", status.enabled);
+            json.member("running", status.running);
+            json.member("nodeId", status.nodeId);
+            json.member("master", status.master);
+            json.member("synced", status.synced);
+            json.member("offsetUs", status.offset);
+            json.key("peers");
+            json.beginArray();
+            for (const ClusterNode::Peer &peer : status.peers)
+            {
+                json.beginObject();
+                json.member("nodeId", peer.nodeId);
+                json.member("lastSeenMs", (uint32_t)((status.now - peer.lastSeen) / 1000));
+                json.endObject();
+            }
+            json.endArray();
+            json.key("groups");
+            json.beginArray();
+            for (const Cluster::Group &group : groups)
+            {
+                json.beginObject();
+                json.member("name", group.name);
+                json.key("relays");
+                json.beginArray();
+                for (uint relayId : group.relays)
+                {
+                    json.value(relayId);
+                }
+                json.endArray();
+                json.endObject();
+            }
+            json.endArray();
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/cluster` POST
+void handleUpdateCluster()
+{
+    try
+    {
+        ClusterBody body;
+        if (!decodeBody(clusterSchema, body))
+        {
+            return;
+        }
+
+        std::vector<Cluster::Group> groups;
+        for (size_t i = 0; i < body.groups.count; i++)
+        {
+            const ClusterGroupBody &item = body.groups.items[i];
+            if (!Cluster::isValidGroupName(item.name))
+            {
+                sendJsonResponse(400, "{ \"error\": \"Invalid group name\"}");
+                return;
+            }
+            for (const Cluster::Group &group : groups)
+            {
+                if (group.name == item.name)
+                {
+                    sendJsonResponse(400, "{ \"error\": \"Duplicate group name\"}");
+                    return;
+                }
+            }
+
+            Cluster::Group group;
+            group.name = item.name;
+            group.relays.assign(item.relays.items.begin(), item.relays.items.begin() + item.relays.count);
+            groups.push_back(group);
+        }
+
+        cluster->setGroups(groups);
+        cluster->setEnabled(body.enabled);
+
+        StaticJsonDocument<200> responseDoc;
+        responseDoc["message"] = "Cluster settings updated successfully";
+
+        sendJsonResponse(200, responseDoc);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/cluster/group-control` POST
+void handleGroupControl()
+{
+    try
+    {
+        GroupControlBody body;
+        if (!decodeBody(groupControlSchema, body))
+        {
+            return;
+        }
+
+        uint64_t at = 0;
+        if (!cluster->sendGroupCommand(body.group, body.state, at))
+        {
+            sendJsonResponse(503, "{ \"error\": \"Cluster is not running\"}");
+            return;
+        }
+
+        // Cluster time in us the relays are switched at
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("message", "Group command sent");
+            json.member("at", at);
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/station` GET
+void handleStation()
+{
+    try
+    {
+        String ssid = configManager->getConfig("staSsid", "");
+        bool connected = stationMode && WiFi.isConnected();
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("ssid", ssid);
+            json.member("connected", connected);
+            json.member("ip", connected ? WiFi.localIP().toString() : String(""));
+            json.member("rssi", connected ? WiFi.RSSI() : 0);
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/station` POST
+void handleUpdateStation()
+{
+    try
+    {
+        StationBody body;
+        if (!decodeBody(stationSchema, body))
+        {
+            return;
+        }
+        size_t passwordLength = strlen(body.password);
+        if (passwordLength > 0 && passwordLength < 8)
+        {
+            sendJsonResponse(400, "{ \"error\": \"Password must be empty or 8 to 63 characters\"}");
+            return;
+        }
+
+        configManager->setConfig("staSsid", body.ssid);
+        configManager->setConfig("staPassword", body.password);
+        stationChangeRequested = true;
+
+        StaticJsonDocument<200> responseDoc;
+        responseDoc["message"] = body.ssid[0] != '\0' ? "Connecting to the network" : "Station turned off";
+
+        sendJsonResponse(200, responseDoc);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/mqtt` GET
+void handleMqtt()
+{
+    try
+    {
+        MqttBridge::Settings settings = mqttBridge->getSettings();
+        MqttBridge::Status status = mqttBridge->getStatus();
+
+        sendDocument([&](JsonWriter &json)
+                     {
+            json.beginObject();
+            json.member("uri", settings.uri);
+            json.member("username", settings.username);
+            json.member("prefix", settings.prefix);
+            json.member("connected", status.connected);
+            json.member("queued", (uint32_t)status.queued);
+            json.member("dropped", status.dropped);
+            json.endObject(); });
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// - **Endpoint**: `/api/mqtt` POST
+void handleUpdateMqtt()
+{
+    try
+    {
+        MqttBody body;
+        if (!decodeBody(mqttSchema, body))
+        {
+            return;
+        }
+        if (body.uri != "" && !body.uri.startsWith("mqtt://") && !body.uri.startsWith("mqtts://") &&
+            !body.uri.startsWith("ws://") && !body.uri.startsWith("wss://"))
+        {
+            sendJsonResponse(400, "{ \"error\": \"Unsupported broker URI\"}");
+            return;
+        }
+        // Wildcards would subscribe to the commands of other units
+        if (body.prefix.indexOf('+') >= 0 || body.prefix.indexOf('#') >= 0 || body.prefix.endsWith("/"))
+        {
+            sendJsonResponse(400, "{ \"error\": \"Invalid topic prefix\"}");
+            return;
+        }
+
+        MqttBridge::Settings settings;
+        settings.uri = body.uri;
+        settings.username = body.username;
+        settings.password = body.password;
+        settings.prefix = body.prefix;
+        mqttBridge->setSettings(settings);
+
+        StaticJsonDocument<200> responseDoc;
+        responseDoc["message"] = body.uri != "" ? "MQTT bridge enabled" : "MQTT bridge disabled";
+
+        sendJsonResponse(200, responseDoc);
+    }
+    catch (const std::exception &e)
+    {
+        sendJsonResponse(500, "{ \"error\": \"" + String(e.what()) + "\"}");
+    }
+}
+
+// Result published for an MQTT command
+String mqttError(int status, const char *error)
+{
+    return "{\"status\":" + String(status) + ",\"error\":\"" + error + "\"}";
+}
+
+// Decode the JSON payload of an MQTT command. Puts the result to publish into error if it does not match
+template <typename T, size_t N>
+bool decodeMqttPayload(const SchemaField<T> (&schema)[N], const char *payload, size_t length, T &body, String &error)
+{
+    BufferStream input(payload, length);
+    JsonReader reader(input);
+    SchemaError result = decodeSchema(reader, schema, body);
+    if (result.isError())
+    {
+        error = mqttError(400, (String(result.message) + (result.key != nullptr ? result.key : "")).c_str());
+        return false;
+    }
+    return true;
+}
+
+// Commands below the MQTT prefix, runs on the task of the MQTT client:
+//   relays/<id>/set   ON, OFF, true, false, 1 or 0
+//   alarms/create     body of /api/relay-alarm POST
+//   alarms/update     relayId, alarmId and the body of /api/relay-alarm PUT
+//   alarms/delete     relayId and alarmId
+String handleMqttCommand(const String &topic, const char *payload, size_t length)
+{
+    try
+    {
+        if (topic.startsWith("relays/") && topic.endsWith("/set"))
+        {
+            String id = topic.substring(7, topic.length() - 4);
+            if (id.length() == 0 || id.length() > 9 || !std::all_of(id.c_str(), id.c_str() + id.length(), isdigit))
+            {
+                return mqttError(404, "Relay not found");
+            }
+
+            String value(payload, length);
+            value.trim();
+            SchedulerCommand command(SchedulerCommand::SET_RELAY);
+            command.relayId = id.toInt();
+            if (value.equalsIgnoreCase("ON") || value == "true" || value == "1")
+            {
+                command.state = true;
+            }
+            else if (value.equalsIgnoreCase("OFF") || value == "false" || value == "0")
+            {
+                command.state = false;
+            }
+            else
+            {
+                return mqttError(400, "State must be ON or OFF");
+            }
+
+            // The new state is published on the relay topic
+            if (alarmScheduler->submit(command) != SchedulerCommand::OK)
+            {
+                return mqttError(404, "Relay not found");
+            }
+            return "";
+        }
+
+        if (!topic.startsWith("alarms/"))
+        {
+            return "";
+        }
+
+        RelayAlarmBody body = {};
+        String error;
+        SchedulerCommand::Type type;
+        if (topic == "alarms/create")
+        {
+            type = SchedulerCommand::ADD_ALARM;
+            if (!decodeMqttPayload(createRelayAlarmSchema, payload, length, body, error))
+            {
+                return error;
+            }
+        }
+        else if (topic == "alarms/update")
+        {
+            type = SchedulerCommand::UPDATE_ALARM;
+            if (!decodeMqttPayload(mqttUpdateAlarmSchema, payload, length, body, error))
+            {
+                return error;
+            }
+        }
+        else if (topic == "alarms/delete")
+        {
+            type = SchedulerCommand::DELETE_ALARM;
+            if (!decodeMqttPayload(mqttDeleteAlarmSchema, payload, length, body, error))
+            {
+                return error;
+            }
+        }
+        else
+        {
+            return mqttError(404, "Unknown command");
+        }
+
+        SchedulerCommand command(type);
+        command.relayId = body.relayId;
+        command.alarmId = body.alarmId;
+        command.state = body.state;
+        command.hour = body.hour;
+        command.minute = body.minute;
+        command.second = body.second;
+        command.weekdays = body.weekdays;
+        SchedulerCommand::Result result = alarmScheduler->submit(command);
+        if (result == SchedulerCommand::RELAY_NOT_FOUND)
+        {
+            return mqttError(404, "Relay not found");
+        }
+        if (result == SchedulerCommand::ALARM_NOT_FOUND)
+        {
+            return mqttError(404, "Alarm not found");
+        }
+        return "{\"status\":200,\"alarmId\":" + String(command.alarmId) + "}";
+    }
+    catch (const std::exception &e)
+    {
+        return mqttError(500, e.what());
+    }
+}
+
+// Read a UDP control key of 2 * UDP_KEY_SIZE hex digits
+bool parseUdpKey(const String &hex, uint8_t *key)
+{
+    if (hex.length() != 2 * UDP_KEY_SIZE)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < 2 * UDP_KEY_SIZE; i++)
+    {
+        char c = hex[i];
+        uint8_t digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        key[i / 2] = i % 2 == 0 ? digit << 4 : key[i / 2] | digit;
+    }
+    return true;
+}
+
+// Send what changed since the last published generation to the event subscribers.
+// Every state change of the scheduler (fired alarms, relay control, schedule
+// edits) ends in a new snapshot, whose entries carry the generation they changed in
+void publishEvents()
+{
+    std::shared_ptr<const RelaySnapshot> snapshot = alarmScheduler->getSnapshot();
+    uint32_t since = lastEventGeneration;
+    if (snapshot == nullptr || snapshot->generation == since)
+    {
+        return;
+    }
+    lastEventGeneration = snapshot->generation;
+    if (since == 0 || eventStream.size() == 0)
+    {
+        return;
+    }
+
+    uint32_t id = snapshot->generation;
+    if (!snapshot->hasChangesSince(since))
+    {
+        // Removals were forgotten in the meantime
+        eventStream.send("resync", "{}", id);
+        return;
+    }
+
+    if (snapshot->nameChanged > since)
+    {
+        StreamString data;
+        JsonWriter json(data);
+        json.beginObject();
+        json.member("systemName", snapshot->systemName);
+        json.endObject();
+        eventStream.send("settings", data, id);
+    }
+
+    for (const RelaySnapshot::Removal &removal : snapshot->removedRelays)
+    {
+        if (removal.generation <= since)
+            continue;
+
+        StreamString data;
+        JsonWriter json(data);
+        json.beginObject();
+        json.member("id", removal.id);
+        json.endObject();
+        eventStream.send("relay-removed", data, id);
+    }
+
+    for (const RelaySnapshot::RelayInfo &relay : snapshot->relays)
+    {
+        if (relay.changed <= since)
+            continue;
+
+        StreamString data;
+        JsonWriter json(data);
+        json.beginObject();
+        relayToJson(relay, json);
+        json.endObject();
+        eventStream.send("relay", data, id);
+    }
+
+    for (const RelaySnapshot::Removal &removal : snapshot->removedAlarms)
+    {
+        if (removal.generation <= since)
+            continue;
+
+        StreamString data;
+        JsonWriter json(data);
+        json.beginObject();
+        json.member("id", removal.id);
+        json.member("relayId", removal.relayId);
+        json.endObject();
+        eventStream.send("alarm-removed", data, id);
+    }
+
+    for (const RelaySnapshot::AlarmInfo &alarm : snapshot->alarms)
+    {
+        if (alarm.changed <= since)
+            continue;
+
+        StreamString data;
+        JsonWriter json(data);
+        json.beginObject();
+        alarmToJson(alarm, json);
+        json.member("relayId", alarm.relayId);
+        json.endObject();
+        eventStream.send("alarm", data, id);
     }
 }
 
 void factoryreset()
 {
-    ConfigManager *cm = ConfigManager::getInstance();
-    cm->setConfig("config", "{}");
+    relayManager->eraseConfig();
+
+    // Back to the always on default, the device must not go to deep sleep after the reset
+    configManager->eraseConfig("lowPower");
+    lowPowerMode = false;
+
+    // UDP control and the cluster stay off until a new key is set
+    configManager->eraseConfig("udpKey");
+    udpControl->setKey(nullptr);
+    cluster->setKey(nullptr);
+    cluster->eraseConfig();
+
+    mqttBridge->eraseConfig();
+
+    // The web task leaves the network
+    configManager->eraseConfig("staSsid");
+    configManager->eraseConfig("staPassword");
+    stationChangeRequested = true;
 }
 
 void restart()
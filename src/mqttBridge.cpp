@@ -0,0 +1,451 @@
+#include "mqttBridge.h"
+#include "configManager.h"
+#include "jsonWriter.h"
+#include <StreamString.h>
+#include <algorithm>
+
+#define MQTT_SENDING -2 // Message id while it is handed to the client
+#define MQTT_EARLY_ACKS 8
+
+MqttBridge *MqttBridge::instance = nullptr;
+
+MqttBridge::MqttBridge()
+{
+    mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void MqttBridge::lock() const
+{
+    xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+void MqttBridge::unlock() const
+{
+    xSemaphoreGiveRecursive(mutex);
+}
+
+void MqttBridge::notify()
+{
+    if (task != nullptr)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+void MqttBridge::begin(AlarmScheduler *scheduler, CommandHandler handler, const String &defaultPrefix)
+{
+    if (task != nullptr)
+    {
+        return;
+    }
+    this->scheduler = scheduler;
+    this->handler = handler;
+    this->defaultPrefix = defaultPrefix;
+
+    ConfigManager *config = ConfigManager::getInstance();
+    lock();
+    settings.uri = config->getConfig("mqttUri", "");
+    settings.username = config->getConfig("mqttUser", "");
+    settings.password = config->getConfig("mqttPassword", "");
+    settings.prefix = config->getConfig("mqttPrefix", defaultPrefix);
+    unlock();
+
+    xTaskCreatePinnedToCore(MqttBridge::taskLoop, "mqtt", MQTT_TASK_STACK, this, MQTT_TASK_PRIORITY, &task, PRO_CPU_NUM);
+}
+
+void MqttBridge::setSettings(const Settings &settings)
+{
+    ConfigManager *config = ConfigManager::getInstance();
+    lock();
+    config->setConfig("mqttUri", settings.uri);
+    config->setConfig("mqttUser", settings.username);
+    config->setConfig("mqttPassword", settings.password);
+    config->setConfig("mqttPrefix", settings.prefix);
+    this->settings = settings;
+    settingsChanged = true;
+    unlock();
+    notify();
+}
+
+void MqttBridge::eraseConfig()
+{
+    ConfigManager *config = ConfigManager::getInstance();
+    lock();
+    config->eraseConfig("mqttUri");
+    config->eraseConfig("mqttUser");
+    config->eraseConfig("mqttPassword");
+    config->eraseConfig("mqttPrefix");
+    settings = Settings();
+    settings.prefix = defaultPrefix;
+    settingsChanged = true;
+    outbox.clear();
+    earlyAcks.clear();
+    dropped = 0;
+    published = nullptr;
+    unlock();
+    notify();
+}
+
+MqttBridge::Settings MqttBridge::getSettings() const
+{
+    lock();
+    Settings result = settings;
+    unlock();
+    return result;
+}
+
+void MqttBridge::setNetwork(bool up)
+{
+    lock();
+    networkUp = up;
+    unlock();
+    notify();
+}
+
+void MqttBridge::alarmFired(const FiredAlarm &alarm)
+{
+    if (fired.push(alarm))
+    {
+        notify();
+    }
+}
+
+MqttBridge::Status MqttBridge::getStatus() const
+{
+    lock();
+    Status status = {connected, outbox.size(), dropped};
+    unlock();
+    return status;
+}
+
+void MqttBridge::enqueue(const String &topic, const String &payload, bool retain)
+{
+    lock();
+    // Only the latest retained value of a topic matters
+    if (retain)
+    {
+        for (Message &message : outbox)
+        {
+            if (message.id == -1 && message.topic == topic)
+            {
+                message.payload = payload;
+                unlock();
+                return;
+            }
+        }
+    }
+    if (outbox.size() >= MQTT_BUFFER)
+    {
+        outbox.pop_front();
+        dropped++;
+    }
+    outbox.push_back({topic, payload, retain, -1});
+    unlock();
+}
+
+void MqttBridge::connect()
+{
+    lock();
+    Settings current = settings;
+    settingsChanged = false;
+    unlock();
+
+    // The client copies the strings
+    String statusTopic = current.prefix + "/status";
+    esp_mqtt_client_config_t config = {};
+    config.uri = current.uri.c_str();
+    config.username = current.username.isEmpty() ? nullptr : current.username.c_str();
+    config.password = current.password.isEmpty() ? nullptr : current.password.c_str();
+    config.lwt_topic = statusTopic.c_str();
+    config.lwt_msg = "offline";
+    config.lwt_qos = MQTT_QOS;
+    config.lwt_retain = 1;
+    config.keepalive = MQTT_KEEPALIVE;
+
+    client = esp_mqtt_client_init(&config);
+    if (client == nullptr)
+    {
+        Serial.println("MQTT: invalid settings");
+        return;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, MqttBridge::eventHandler, this);
+    esp_mqtt_client_start(client);
+    Serial.println("MQTT client started: " + current.uri);
+}
+
+void MqttBridge::disconnect()
+{
+    esp_mqtt_client_stop(client);
+    esp_mqtt_client_destroy(client);
+    client = nullptr;
+    connected = false;
+
+    lock();
+    for (Message &message : outbox)
+    {
+        message.id = -1;
+    }
+    unlock();
+    Serial.println("MQTT client stopped");
+}
+
+void MqttBridge::queueRelays()
+{
+    std::shared_ptr<const RelaySnapshot> snapshot = scheduler->getSnapshot();
+    lock();
+    std::shared_ptr<const RelaySnapshot> previous = published;
+    String prefix = settings.prefix + "/relays/";
+    unlock();
+    if (snapshot == nullptr || snapshot == previous)
+    {
+        return;
+    }
+
+    for (const RelaySnapshot::RelayInfo &relay : snapshot->relays)
+    {
+        const RelaySnapshot::RelayInfo *before = previous != nullptr ? previous->findRelay(relay.id) : nullptr;
+        if (before != nullptr && before->state == relay.state && before->name == relay.name)
+        {
+            continue;
+        }
+
+        StreamString payload;
+        JsonWriter json(payload);
+        json.beginObject();
+        json.member("id", relay.id);
+        json.member("name", relay.name);
+        json.member("state", relay.state);
+        json.endObject();
+        enqueue(prefix + String(relay.id), payload, true);
+    }
+
+    // An empty retained message removes the one of a deleted relay
+    if (previous != nullptr)
+    {
+        for (const RelaySnapshot::RelayInfo &relay : previous->relays)
+        {
+            if (snapshot->findRelay(relay.id) == nullptr)
+            {
+                enqueue(prefix + String(relay.id), "", true);
+            }
+        }
+    }
+
+    // Unless a reconnect asked for all of them in the meantime
+    lock();
+    if (published == previous)
+    {
+        published = snapshot;
+    }
+    unlock();
+}
+
+void MqttBridge::queueFired()
+{
+    lock();
+    String topic = settings.prefix + "/alarm-fired";
+    unlock();
+
+    FiredAlarm alarm;
+    while (fired.pop(alarm))
+    {
+        StreamString payload;
+        JsonWriter json(payload);
+        json.beginObject();
+        json.member("relayId", alarm.relayId);
+        json.member("alarmId", alarm.alarmId);
+        json.member("state", alarm.state);
+        json.member("time", alarm.unixtime);
+        json.endObject();
+        enqueue(topic, payload, false);
+    }
+}
+
+void MqttBridge::flush()
+{
+    while (connected)
+    {
+        // Copied out, the client must not be called with the lock held: its task takes the lock in onEvent
+        lock();
+        Message *next = nullptr;
+        for (Message &message : outbox)
+        {
+            if (message.id == -1)
+            {
+                next = &message;
+                break;
+            }
+        }
+        if (next == nullptr)
+        {
+            unlock();
+            return;
+        }
+        next->id = MQTT_SENDING;
+        Message message = *next;
+        unlock();
+
+        int id = esp_mqtt_client_publish(client, message.topic.c_str(), message.payload.c_str(), message.payload.length(), MQTT_QOS, message.retain);
+
+        lock();
+        for (auto it = outbox.begin(); it != outbox.end(); it++)
+        {
+            if (it->id != MQTT_SENDING)
+            {
+                continue;
+            }
+            auto ack = std::find(earlyAcks.begin(), earlyAcks.end(), id);
+            if (id >= 0 && ack != earlyAcks.end())
+            {
+                earlyAcks.erase(ack);
+                outbox.erase(it);
+            }
+            else
+            {
+                it->id = id >= 0 ? id : -1;
+            }
+            break;
+        }
+        unlock();
+
+        if (id < 0)
+        {
+            // Tried again on the next round
+            return;
+        }
+    }
+}
+
+void MqttBridge::eventHandler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    static_cast<MqttBridge *>(arg)->onEvent(static_cast<esp_mqtt_event_handle_t>(data));
+}
+
+void MqttBridge::onEvent(esp_mqtt_event_handle_t event)
+{
+    switch (event->event_id)
+    {
+    case MQTT_EVENT_CONNECTED:
+    {
+        lock();
+        String prefix = settings.prefix;
+        // The broker may have lost the retained states, publish all of them again
+        published = nullptr;
+        unlock();
+
+        esp_mqtt_client_subscribe(event->client, (prefix + "/relays/+/set").c_str(), MQTT_QOS);
+        esp_mqtt_client_subscribe(event->client, (prefix + "/alarms/+").c_str(), MQTT_QOS);
+        enqueue(prefix + "/status", "online", true);
+        connected = true;
+        Serial.println("MQTT connected");
+        notify();
+        break;
+    }
+    case MQTT_EVENT_DISCONNECTED:
+    {
+        connected = false;
+        lock();
+        for (Message &message : outbox)
+        {
+            if (message.id >= 0)
+            {
+                message.id = -1;
+            }
+        }
+        unlock();
+        Serial.println("MQTT disconnected");
+        break;
+    }
+    case MQTT_EVENT_PUBLISHED:
+    {
+        lock();
+        auto it = outbox.begin();
+        while (it != outbox.end() && it->id != event->msg_id)
+        {
+            it++;
+        }
+        if (it != outbox.end())
+        {
+            outbox.erase(it);
+        }
+        else
+        {
+            // The publishing task has not stored the id yet
+            if (earlyAcks.size() >= MQTT_EARLY_ACKS)
+            {
+                earlyAcks.erase(earlyAcks.begin());
+            }
+            earlyAcks.push_back(event->msg_id);
+        }
+        unlock();
+        notify();
+        break;
+    }
+    case MQTT_EVENT_DATA:
+    {
+        // Commands are small, fragments of longer messages are ignored
+        if (event->data_len != event->total_data_len || event->data_len > MQTT_MAX_PAYLOAD || handler == nullptr)
+        {
+            break;
+        }
+        lock();
+        String prefix = settings.prefix + "/";
+        unlock();
+
+        String topic(event->topic, event->topic_len);
+        if (!topic.startsWith(prefix))
+        {
+            break;
+        }
+        String result = handler(topic.substring(prefix.length()), event->data, event->data_len);
+        if (!result.isEmpty())
+        {
+            enqueue(topic + "/result", result, false);
+            notify();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void MqttBridge::taskLoop(void *param)
+{
+    MqttBridge *bridge = static_cast<MqttBridge *>(param);
+
+    while (true)
+    {
+        bridge->lock();
+        bool wanted = bridge->networkUp && !bridge->settings.uri.isEmpty();
+        bool changed = bridge->settingsChanged;
+        bridge->unlock();
+
+        if (bridge->client != nullptr && (!wanted || changed))
+        {
+            bridge->disconnect();
+        }
+        if (bridge->client == nullptr && wanted)
+        {
+            bridge->connect();
+        }
+
+        if (bridge->client != nullptr)
+        {
+            // While the broker is unreachable the messages wait in the outbox
+            bridge->queueRelays();
+            bridge->queueFired();
+            bridge->flush();
+        }
+        else
+        {
+            // Alarms that fired while the bridge was off are not reported later
+            FiredAlarm alarm;
+            while (bridge->fired.pop(alarm))
+            {
+            }
+        }
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_POLL));
+    }
+}
@@ -1,6 +1,10 @@
 #include "relay.h"
 #include "alarm.h"
+#include "alarmScheduler.h"
 #include "configManager.h"
+#include "jsonWriter.h"
+#include <StreamString.h>
+#include <algorithm>
 
 uint Relay::idCounter = 0;
 
@@ -8,16 +12,13 @@ Relay::Relay(const uint8_t pin, const String& name) {
     this->id = idCounter++;
     this->name = name;
     this->pin = pin;
+    this->index = AlarmTable::getInstance()->registerRelay(this);
 
     pinMode(pin, OUTPUT);
     this->Off();
 }
 
-Relay::Relay(String json) {
-    DynamicJsonDocument doc(1024);
-    deserializeJson(doc, json);
-
-    uint id = doc["id"].as<uint>();
+Relay::Relay(uint id, const uint8_t pin, const String& name) {
     if (id < idCounter)
     {
         id = idCounter++;
@@ -26,31 +27,36 @@ Relay::Relay(String json) {
     }
 
     this->id = id;
-    this->name = doc["name"].as<String>();
-    this->pin = doc["pin"];
+    this->name = name;
+    this->pin = pin;
+    this->index = AlarmTable::getInstance()->registerRelay(this);
 
     pinMode(pin, OUTPUT);
     this->Off();
-
-    JsonArray alarmsArray = doc["alarms"];
-    for (JsonVariant alarm : alarmsArray) {
-        String alarmJson;
-        serializeJson(alarm, alarmJson);
-        Alarm* tempAlarm = new Alarm(alarmJson, this);
-        this->alarms[tempAlarm->getId()] = tempAlarm;
-    }
 }
 
 Relay::~Relay() {
-    for (auto const& element : this->alarms) {
-        delete element.second;
+    // Walk the slots instead of collecting the ids, deleting a relay must not allocate
+    AlarmTable* table = AlarmTable::getInstance();
+    table->lock();
+    for (uint16_t slot = 0; slot < table->slotCount(); slot++) {
+        if (table->isUsed(slot) && AlarmTable::relayOf(table->getRecord(slot)) == this->index) {
+            AlarmScheduler::getInstance()->remove(Alarm(table->getId(slot), slot));
+            table->remove(slot);
+        }
     }
+    table->unlock();
+    table->unregisterRelay(this->index);
 }
 
 uint Relay::getId() {
     return this->id;
 }
 
+uint8_t Relay::getIndex() const {
+    return this->index;
+}
+
 String Relay::getName() {
     return this->name;
 }
@@ -76,62 +82,97 @@ void Relay::Off() {
     digitalWrite(this->pin, HIGH);
 }
 
-Alarm* Relay::addAlarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, bool state) {
-    Alarm* tempAlarm = new Alarm(hour, minute, second, weekdays, this, state);
-    this->alarms[tempAlarm->getId()] = tempAlarm;
+Alarm Relay::addAlarm(uint hour, uint minute, uint second, std::array<bool, 7> weekdays, bool state) {
+    Alarm tempAlarm = Alarm::create(hour, minute, second, weekdays, this, state);
+    AlarmScheduler::getInstance()->schedule(tempAlarm);
+    this->invalidateSchedule();
 
     return tempAlarm;
 }
 
 void Relay::removeAlarm(const uint id) {
-    auto it = alarms.find(id);
-    if (it != alarms.end()) {
-        delete it->second;
-        alarms.erase(it);
+    Alarm alarm = this->getAlarmByID(id);
+    if (alarm.isValid()) {
+        AlarmScheduler::getInstance()->remove(alarm);
+        AlarmTable::getInstance()->remove(alarm.getSlot());
+        this->invalidateSchedule();
     }
 }
 
 vector<uint> Relay::getAlarmIDs() const {
+    AlarmTable* table = AlarmTable::getInstance();
     vector<uint> ids;
-    for (auto const& element : alarms) {
-        ids.push_back(element.first);
-    }
+    table->forEach(this->index, [&](uint16_t slot) { ids.push_back(table->getId(slot)); });
     return ids;
 }
 
-Alarm* Relay::getAlarmByID(const uint id) const {
-    auto it = alarms.find(id);
-    if (it != alarms.end()) {
-        return it->second;
+Alarm Relay::getAlarmByID(const uint id) const {
+    AlarmTable* table = AlarmTable::getInstance();
+    uint16_t slot = table->find(id);
+    if (slot != ALARM_NO_SLOT && AlarmTable::relayOf(table->getRecord(slot)) == this->index) {
+        return Alarm(id, slot);
     } else {
-        return nullptr;
+        return Alarm();
     }
 }
 
-String Relay::toJson() const {
-    DynamicJsonDocument doc(1024);
-    doc["id"] = this->id;
-    doc["name"] = this->name;
-    doc["pin"] = this->pin;
-
-    JsonArray alarmsArray = doc.createNestedArray("alarms");
-    for (auto const& element : this->alarms) {
-        Alarm* alarm = element.second;
-        DynamicJsonDocument alarmDoc(1024);
-        alarmDoc["id"] = alarm->getId();
-        alarmDoc["hour"] = alarm->getHour();
-        alarmDoc["minute"] = alarm->getMinute();
-        alarmDoc["second"] = alarm->getSecond();
-        alarmDoc.createNestedArray("weekdays");
-        for (int i = 0; i < 7; i++) {
-            alarmDoc["weekdays"][i] = alarm->getWeekdays()[i];
+void Relay::invalidateSchedule() {
+    this->transitionsDirty = true;
+}
+
+void Relay::buildTransitions() {
+    AlarmTable* table = AlarmTable::getInstance();
+    this->transitions.clear();
+    table->forEach(this->index, [&](uint16_t slot) { this->transitions.push_back(table->getRecord(slot)); });
+
+    // Stable so alarms at the same time keep their id order and the newest one wins
+    std::stable_sort(this->transitions.begin(), this->transitions.end(),
+                     [](uint32_t a, uint32_t b) { return AlarmTable::secondOf(a) < AlarmTable::secondOf(b); });
+    this->transitionsDirty = false;
+}
+
+bool Relay::getScheduledState(uint32_t unixtime, bool& state) {
+    if (this->transitionsDirty) {
+        this->buildTransitions();
+    }
+
+    // 1970-01-01 was a Thursday
+    uint8_t weekday = (unixtime / 86400 + 4) % 7;
+    uint32_t daySecond = unixtime % 86400;
+
+    // Walk back from now over up to a week until an alarm on that weekday is found
+    for (int back = 0; back < 8; back++) {
+        uint8_t day = (weekday + 7 - back) % 7;
+        auto it = this->transitions.end();
+        if (back == 0) {
+            it = std::upper_bound(this->transitions.begin(), this->transitions.end(), daySecond,
+                                  [](uint32_t value, uint32_t record) { return value < AlarmTable::secondOf(record); });
+        }
+        while (it != this->transitions.begin()) {
+            --it;
+            if (AlarmTable::weekdaysOf(*it) & (1 << day)) {
+                state = AlarmTable::stateOf(*it);
+                return true;
+            }
         }
-        alarmDoc["relay"] = alarm->getRelay()->getId();
-        alarmDoc["state"] = alarm->getState();
-        alarmsArray.add(alarmDoc);
     }
 
-    String output;
-    serializeJson(doc, output);
+    return false;
+}
+
+String Relay::toJson() const {
+    StreamString output;
+    JsonWriter json(output);
+    json.beginObject();
+    json.member("id", this->id);
+    json.member("name", this->name);
+    json.member("pin", this->pin);
+
+    AlarmTable* table = AlarmTable::getInstance();
+    json.key("alarms");
+    json.beginArray();
+    table->forEach(this->index, [&](uint16_t slot) { Alarm(table->getId(slot), slot).toJson(json); });
+    json.endArray();
+    json.endObject();
     return output;
 }
\ No newline at end of file
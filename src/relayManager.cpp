@@ -1,39 +1,28 @@
 #include "relayManager.h"
 #include "relay.h"
 #include "configManager.h"
+#include "alarmScheduler.h"
+#include "binaryConfig.h"
+#include "jsonReader.h"
+#include <algorithm>
+#include <utility>
 
 RelayManager::RelayManager()
 {
-}
-
-RelayManager::RelayManager(String json)
-{
-    DynamicJsonDocument doc(1024);
-    deserializeJson(doc, json);
-
-    this->name = doc["name"].as<String>();
-
-    JsonArray relaysArray = doc["relays"];
-    for (JsonVariant relay : relaysArray)
-    {
-        String relayJson;
-        serializeJson(relay, relayJson);
-        Relay *tempRelay = new Relay(relayJson);
-        this->relays[tempRelay->getId()] = tempRelay;
-    }
+    this->relays.reserve(MAX_RELAYS);
 }
 
 RelayManager::~RelayManager()
 {
     for (auto const &element : this->relays)
     {
-        delete element.second;
+        this->relayPool.destroy(element.second);
     }
 }
 
 Relay *RelayManager::addRelay(const uint8_t pin, const String &name)
 {
-    Relay *tempRelay = new Relay(pin, name);
+    Relay *tempRelay = this->relayPool.create(pin, name);
     this->relays[tempRelay->getId()] = tempRelay;
 
     return tempRelay;
@@ -67,116 +56,506 @@ void RelayManager::removeRelayByID(const uint id)
     auto it = relays.find(id);
     if (it != relays.end())
     {
+        Relay *relay = it->second;
         relays.erase(it);
-        delete it->second;
+        this->relayPool.destroy(relay);
     }
 }
 
-std::queue<std::vector<Alarm *>> RelayManager::getNextAlarm() const
+void RelayManager::applySchedule(uint32_t unixtime)
+{
+    for (auto const &element : this->relays)
+    {
+        Relay *relay = element.second;
+        bool state;
+        if (!relay->getScheduledState(unixtime, state))
+        {
+            continue;
+        }
+
+        if (state)
+        {
+            relay->On();
+        }
+        else
+        {
+            relay->Off();
+        }
+        Serial.println("Relay " + relay->getName() + " restored to " + String(state ? "on" : "off"));
+    }
+}
+
+String RelayManager::getName() const
+{
+    return this->name;
+}
+
+void RelayManager::setName(const String &name)
 {
+    this->name = name;
+}
 
-    std::vector<Alarm *> alarms;
-    vector<uint> relayIDs = this->getRelayIDs();
-    for (auto const &element : relayIDs)
+// Carry the generation of unchanged entries over from the previous list and report
+// removed ones. Both lists are sorted by key. Returns true if anything changed
+template <typename T, typename Key, typename Same, typename Removed>
+static bool stampChanges(const std::vector<T> &previous, std::vector<T> &current, uint32_t stamp, Key key, Same same, Removed removed)
+{
+    bool changed = false;
+    size_t i = 0;
+    for (T &entry : current)
     {
-        Relay *relay = this->getRelayByID(element);
-        if (relay != nullptr)
+        while (i < previous.size() && key(previous[i]) < key(entry))
         {
-            vector<uint> alarmIDs = relay->getAlarmIDs();
-            for (auto const &alarmID : alarmIDs)
+            removed(previous[i++]);
+            changed = true;
+        }
+
+        if (i < previous.size() && key(previous[i]) == key(entry))
+        {
+            if (same(previous[i], entry))
             {
-                Alarm *alarm = relay->getAlarmByID(alarmID);
-                if (alarm != nullptr)
-                {
-                    alarms.push_back(alarm);
-                }
+                entry.changed = previous[i++].changed;
+                continue;
             }
+            i++;
         }
+        entry.changed = stamp;
+        changed = true;
+    }
+    while (i < previous.size())
+    {
+        removed(previous[i++]);
+        changed = true;
+    }
+    return changed;
+}
+
+void RelayManager::addRemoval(std::vector<RelaySnapshot::Removal> &removals, const RelaySnapshot::Removal &removal)
+{
+    if (removals.size() >= RELAY_MANAGER_REMOVALS)
+    {
+        // Clients that saw a generation before this removal can not be told about it anymore
+        removalsSince = std::max(removalsSince, removals.front().generation);
+        removals.erase(removals.begin());
+    }
+    removals.push_back(removal);
+}
+
+std::shared_ptr<const RelaySnapshot> RelayManager::snapshot()
+{
+    std::shared_ptr<RelaySnapshot> snapshot(new RelaySnapshot());
+    snapshot->systemName = this->name;
+    snapshot->relays.reserve(this->relays.size());
+
+    AlarmTable *table = AlarmTable::getInstance();
+    table->lock();
+    snapshot->alarms.reserve(table->size());
+    for (auto const &element : this->relays)
+    {
+        Relay *relay = element.second;
+        snapshot->relays.push_back({relay->getId(), relay->getName(), relay->getPin(), relay->getState(), 0});
+        table->forEach(relay->getIndex(), [&](uint16_t slot)
+                       { snapshot->alarms.push_back({table->getId(slot), relay->getId(), table->getRecord(slot), 0}); });
     }
+    table->unlock();
 
-    DateTime now = RTC::getInstance()->now();
+    uint32_t stamp = generation + 1;
+    static const RelaySnapshot empty;
+    const RelaySnapshot &previous = lastSnapshot ? *lastSnapshot : empty;
 
-    // Sort alarms
-    std::sort(alarms.begin(), alarms.end(), [now](Alarm *a, Alarm *b)
-              { return a->getNextAlarminSeconds(now) < b->getNextAlarminSeconds(now); });
+    bool changed = lastSnapshot == nullptr;
+    if (previous.systemName != snapshot->systemName || changed)
+    {
+        nameChanged = stamp;
+        changed = true;
+    }
 
-    std::queue<std::vector<Alarm *>> alarmQueue;
+    bool relaysDiffer = stampChanges(
+        previous.relays, snapshot->relays, stamp,
+        [](const RelaySnapshot::RelayInfo &relay)
+        { return relay.id; },
+        [](const RelaySnapshot::RelayInfo &a, const RelaySnapshot::RelayInfo &b)
+        { return a.name == b.name && a.pin == b.pin && a.state == b.state; },
+        [&](const RelaySnapshot::RelayInfo &relay)
+        { addRemoval(removedRelays, {relay.id, relay.id, stamp}); });
+    if (relaysDiffer)
+    {
+        relaysChanged = stamp;
+        changed = true;
+    }
+
+    bool alarmsDiffer = stampChanges(
+        previous.alarms, snapshot->alarms, stamp,
+        [](const RelaySnapshot::AlarmInfo &alarm)
+        { return std::make_pair(alarm.relayId, alarm.id); },
+        [](const RelaySnapshot::AlarmInfo &a, const RelaySnapshot::AlarmInfo &b)
+        { return a.record == b.record; },
+        [&](const RelaySnapshot::AlarmInfo &alarm)
+        { addRemoval(removedAlarms, {alarm.id, alarm.relayId, stamp}); });
+    if (alarmsDiffer)
+    {
+        alarmsChanged = stamp;
+        changed = true;
+    }
 
-    // group alarms which have the same next alarm time together
-    std::vector<Alarm *> groupedAlarms;
-    for (auto const &element : alarms)
+    if (!changed)
     {
-        if (groupedAlarms.size() == 0)
+        return lastSnapshot;
+    }
+
+    generation = stamp;
+    snapshot->generation = generation;
+    snapshot->nameChanged = nameChanged;
+    snapshot->relaysChanged = relaysChanged;
+    snapshot->alarmsChanged = alarmsChanged;
+    snapshot->removedRelays = removedRelays;
+    snapshot->removedAlarms = removedAlarms;
+    snapshot->removalsSince = removalsSince;
+    lastSnapshot = snapshot;
+    return snapshot;
+}
+
+bool RelayManager::loadConfig()
+{
+    ConfigManager *configManager = ConfigManager::getInstance();
+    AlarmTable *table = AlarmTable::getInstance();
+    AlarmScheduler *scheduler = AlarmScheduler::getInstance();
+
+    std::vector<uint8_t> blob;
+    if (!configManager->getBlob(CONFIG_RELAYS_KEY, blob))
+    {
+        return false;
+    }
+
+    BinaryReader relaysReader(blob, CONFIG_TYPE_RELAYS);
+    String name = relaysReader.readString();
+    uint16_t pages = relaysReader.readU16();
+    uint8_t relayCount = relaysReader.readU8();
+    for (uint8_t i = 0; i < relayCount && relaysReader.isValid(); i++)
+    {
+        uint id = relaysReader.readU32();
+        uint8_t pin = relaysReader.readU8();
+        String relayName = relaysReader.readString();
+        if (relaysReader.isValid())
         {
-            groupedAlarms.push_back(element);
+            Relay *relay = this->relayPool.create(id, pin, relayName);
+            this->relays[relay->getId()] = relay;
         }
-        else
+    }
+
+    if (!relaysReader.isValid())
+    {
+        Serial.println("Stored relay config is corrupt");
+        for (auto const &element : this->relays)
+        {
+            this->relayPool.destroy(element.second);
+        }
+        this->relays.clear();
+        return false;
+    }
+
+    this->name = name;
+    this->storedPages = pages;
+
+    // Alarms keep their id and get the next free slot. If earlier slots were empty when saving, or
+    // an id was stored twice, the pages are rewritten below
+    bool moved = false;
+    bool full = false;
+    for (uint16_t page = 0; page < pages && !full; page++)
+    {
+        if (!configManager->getBlob(CONFIG_ALARMS_KEY + String(page), blob))
         {
-            if (element->getNextAlarminSeconds(now) == groupedAlarms[0]->getNextAlarminSeconds(now))
+            continue;
+        }
+
+        BinaryReader reader(blob, CONFIG_TYPE_ALARMS);
+        uint8_t count = reader.readU8();
+        for (uint8_t i = 0; i < count; i++)
+        {
+            uint8_t offset = reader.readU8();
+            uint id = reader.readU32();
+            uint relayId = reader.readU32();
+            uint32_t record = reader.readU32();
+            if (!reader.isValid())
             {
-                groupedAlarms.push_back(element);
+                Serial.println("Alarm page " + String(page) + " is corrupt");
+                break;
             }
-            else
+
+            Relay *relay = getRelayByID(relayId);
+            if (relay == nullptr)
+            {
+                continue;
+            }
+
+            record = (record & ((1UL << ALARM_RELAY_SHIFT) - 1)) | ((uint32_t)relay->getIndex() << ALARM_RELAY_SHIFT);
+            // A config of a build with a larger MAX_ALARMS keeps the alarms that fit
+            uint16_t slot;
+            try
+            {
+                slot = table->add(record, id);
+            }
+            catch (const std::exception &e)
             {
-                alarmQueue.push(groupedAlarms);
-                groupedAlarms.clear();
-                groupedAlarms.push_back(element);
+                Serial.println("Skipping stored alarms: " + String(e.what()));
+                full = true;
+                break;
             }
+            scheduler->schedule(Alarm(table->getId(slot), slot));
+            moved |= slot != page * CONFIG_ALARMS_PER_PAGE + offset || table->getId(slot) != id;
         }
     }
-    if (groupedAlarms.size() > 0) {
-        alarmQueue.push(groupedAlarms);
+
+    for (auto const &element : this->relays)
+    {
+        element.second->invalidateSchedule();
     }
 
-    return alarmQueue;
+    if (moved)
+    {
+        saveConfig();
+    }
+    return true;
 }
 
- String RelayManager::getName() const
+void RelayManager::saveConfig() const
 {
-    return this->name;
+    ConfigManager *configManager = ConfigManager::getInstance();
+    AlarmTable *table = AlarmTable::getInstance();
+
+    uint16_t pages = (table->slotCount() + CONFIG_ALARMS_PER_PAGE - 1) / CONFIG_ALARMS_PER_PAGE;
+
+    BinaryWriter relaysWriter(CONFIG_TYPE_RELAYS);
+    relaysWriter.writeString(this->name);
+    relaysWriter.writeU16(pages);
+    relaysWriter.writeU8(this->relays.size());
+    for (auto const &element : this->relays)
+    {
+        Relay *relay = element.second;
+        relaysWriter.writeU32(relay->getId());
+        relaysWriter.writeU8(relay->getPin());
+        relaysWriter.writeString(relay->getName());
+    }
+    configManager->setBlob(CONFIG_RELAYS_KEY, relaysWriter.finish());
+
+    table->lock();
+    for (uint16_t page = 0; page < pages; page++)
+    {
+        uint16_t first = page * CONFIG_ALARMS_PER_PAGE;
+        uint16_t last = min((size_t)(first + CONFIG_ALARMS_PER_PAGE), table->slotCount());
+
+        uint8_t count = 0;
+        for (uint16_t slot = first; slot < last; slot++)
+        {
+            count += table->isUsed(slot);
+        }
+        if (count == 0)
+        {
+            configManager->eraseConfig(CONFIG_ALARMS_KEY + String(page));
+            continue;
+        }
+
+        BinaryWriter writer(CONFIG_TYPE_ALARMS);
+        writer.writeU8(count);
+        for (uint16_t slot = first; slot < last; slot++)
+        {
+            if (!table->isUsed(slot))
+            {
+                continue;
+            }
+
+            uint32_t record = table->getRecord(slot);
+            Relay *relay = table->getRelay(AlarmTable::relayOf(record));
+            writer.writeU8(slot - first);
+            writer.writeU32(table->getId(slot));
+            writer.writeU32(relay != nullptr ? relay->getId() : ALARM_FREE_ID);
+            writer.writeU32(record & ((1UL << ALARM_RELAY_SHIFT) - 1));
+        }
+        configManager->setBlob(CONFIG_ALARMS_KEY + String(page), writer.finish());
+    }
+    table->unlock();
+
+    for (uint16_t page = pages; page < this->storedPages; page++)
+    {
+        configManager->eraseConfig(CONFIG_ALARMS_KEY + String(page));
+    }
+    this->storedPages = pages;
 }
 
-void RelayManager::setName(const String &name)
+void RelayManager::eraseConfig()
 {
-    this->name = name;
+    ConfigManager *configManager = ConfigManager::getInstance();
+
+    for (uint16_t page = 0; page < this->storedPages; page++)
+    {
+        configManager->eraseConfig(CONFIG_ALARMS_KEY + String(page));
+    }
+    this->storedPages = 0;
+
+    configManager->eraseConfig(CONFIG_RELAYS_KEY);
+    configManager->eraseConfig(CONFIG_LEGACY_KEY);
+}
+
+bool RelayManager::loadJson(Stream &input)
+{
+    JsonReader reader(input);
+    char key[16];
+
+    if (reader.beginObject())
+    {
+        while (reader.nextKey(key, sizeof(key)))
+        {
+            if (strcmp(key, "name") == 0)
+            {
+                this->name = reader.readString();
+            }
+            else if (strcmp(key, "relays") == 0 && reader.beginArray())
+            {
+                while (reader.nextElement())
+                {
+                    loadRelayJson(reader);
+                }
+            }
+            else
+            {
+                reader.skipValue();
+            }
+        }
+    }
+
+    if (!reader.isValid())
+    {
+        Serial.println("Failed to parse JSON config");
+    }
+    return reader.isValid();
 }
 
-String RelayManager::toJson() const
+void RelayManager::loadRelayJson(JsonReader &reader)
 {
-    DynamicJsonDocument doc(1024);
+    char key[16];
+    bool hasId = false;
+    uint id = 0;
+    uint8_t pin = 0;
+    String name;
+    Relay *relay = nullptr;
 
-    doc["name"] = this->name;
+    if (!reader.beginObject())
+    {
+        return;
+    }
 
-    JsonArray relaysArray = doc.createNestedArray("relays");
-    for (auto const &element : this->relays)
+    while (reader.nextKey(key, sizeof(key)))
     {
-        Relay *relay = element.second;
-        DynamicJsonDocument relayDoc(1024);
-        relayDoc["id"] = relay->getId();
-        relayDoc["name"] = relay->getName();
-        relayDoc["pin"] = relay->getPin();
-        JsonArray alarmsArray = relayDoc.createNestedArray("alarms");
-        for (auto const &element : relay->getAlarmIDs())
-        {
-            Alarm *alarm = relay->getAlarmByID(element);
-            DynamicJsonDocument alarmDoc(1024);
-            alarmDoc["id"] = alarm->getId();
-            alarmDoc["hour"] = alarm->getHour();
-            alarmDoc["minute"] = alarm->getMinute();
-            alarmDoc["second"] = alarm->getSecond();
-            alarmDoc.createNestedArray("weekdays");
-            for (int i = 0; i < 7; i++)
+        if (strcmp(key, "id") == 0)
+        {
+            id = reader.readInt();
+            hasId = true;
+        }
+        else if (strcmp(key, "name") == 0)
+        {
+            name = reader.readString();
+        }
+        else if (strcmp(key, "pin") == 0)
+        {
+            pin = reader.readInt();
+        }
+        else if (strcmp(key, "alarms") == 0 && reader.beginArray())
+        {
+            // Every firmware writes id, name and pin before the alarms
+            if (relay == nullptr)
             {
-                alarmDoc["weekdays"][i] = alarm->getWeekdays()[i];
+                relay = hasId ? this->relayPool.create(id, pin, name) : this->relayPool.create(pin, name);
+                this->relays[relay->getId()] = relay;
+            }
+            while (reader.nextElement())
+            {
+                loadAlarmJson(reader, relay);
             }
-            alarmDoc["relay"] = alarm->getRelay()->getId();
-            alarmDoc["state"] = alarm->getState();
-            alarmsArray.add(alarmDoc);
         }
-        relaysArray.add(relayDoc);
+        else
+        {
+            reader.skipValue();
+        }
     }
 
-    String output;
-    serializeJson(doc, output);
-    return output;
+    if (relay == nullptr && reader.isValid())
+    {
+        relay = hasId ? this->relayPool.create(id, pin, name) : this->relayPool.create(pin, name);
+        this->relays[relay->getId()] = relay;
+    }
+    if (relay != nullptr)
+    {
+        relay->invalidateSchedule();
+    }
+}
+
+void RelayManager::loadAlarmJson(JsonReader &reader, Relay *relay)
+{
+    char key[16];
+    uint id = ALARM_FREE_ID;
+    uint hour = 0;
+    uint minute = 0;
+    uint second = 0;
+    bool state = false;
+    std::array<bool, 7> weekdays = {false, false, false, false, false, false, false};
+
+    if (!reader.beginObject())
+    {
+        return;
+    }
+
+    while (reader.nextKey(key, sizeof(key)))
+    {
+        if (strcmp(key, "id") == 0)
+        {
+            id = reader.readInt();
+        }
+        else if (strcmp(key, "hour") == 0)
+        {
+            hour = reader.readInt();
+        }
+        else if (strcmp(key, "minute") == 0)
+        {
+            minute = reader.readInt();
+        }
+        else if (strcmp(key, "second") == 0)
+        {
+            second = reader.readInt();
+        }
+        else if (strcmp(key, "state") == 0)
+        {
+            state = reader.readBool();
+        }
+        else if (strcmp(key, "weekdays") == 0 && reader.beginArray())
+        {
+            int counter = 0;
+            while (reader.nextElement())
+            {
+                bool value = reader.readBool();
+                if (counter < 7)
+                {
+                    weekdays[counter++] = value;
+                }
+            }
+        }
+        else
+        {
+            reader.skipValue();
+        }
+    }
+
+    if (!reader.isValid())
+    {
+        return;
+    }
+
+    try
+    {
+        Alarm alarm = Alarm::create(hour, minute, second, weekdays, relay, state, id);
+        AlarmScheduler::getInstance()->schedule(alarm);
+    }
+    catch (const std::exception &e)
+    {
+        Serial.println("Skipping alarm " + String(id) + ": " + String(e.what()));
+    }
 }
\ No newline at end of file
@@ -1,12 +1,14 @@
 #include "rtc.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 RTC *RTC::instance = nullptr; // Initialize pointer to nullptr
 
-RTC *RTC::getInstance(uint8_t sdaPin, uint8_t sclPin)
+RTC *RTC::getInstance(uint8_t sdaPin, uint8_t sclPin, uint8_t sqwPin)
 {
     if (instance == nullptr)
     {
-        instance = new RTC(sdaPin, sclPin);
+        instance = new RTC(sdaPin, sclPin, sqwPin);
 
         Wire.begin(sdaPin, sclPin);
         while (true)
@@ -25,16 +27,199 @@ RTC *RTC::getInstance(uint8_t sdaPin, uint8_t sclPin)
             // Set the date and time at compile time
             instance->rtc.adjust(DateTime(2020, 2, 1, 0, 0, 0));
         }
+
+        // Lock the software clock to the square wave and check it periodically
+        instance->enableSquareWave();
+
+        // A task of its own, the I2C read must not block the esp_timer task
+        xTaskCreatePinnedToCore(RTC::resyncTask, "rtc", RTC_TASK_STACK, instance, RTC_TASK_PRIORITY, nullptr, PRO_CPU_NUM);
     }
     return instance;
 }
 
+void IRAM_ATTR RTC::onSquareWave()
+{
+    RTC *clock = instance;
+    int64_t t = esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&clock->mux);
+    int64_t interval = t - clock->edgeMicros;
+    if (!clock->locked)
+    {
+        // First edge after reading the DS3231, the read second has just ended
+        clock->edgeSecond += interval / clock->periodMicros + 1;
+        clock->locked = true;
+    }
+    else if (interval < clock->periodMicros / 2)
+    {
+        // Bounce, not a real edge
+        portEXIT_CRITICAL_ISR(&clock->mux);
+        return;
+    }
+    else if (interval < clock->periodMicros + clock->periodMicros / 2)
+    {
+        // Track the esp_timer drift against the DS3231 oscillator
+        clock->periodMicros += (interval - clock->periodMicros) / 16;
+        clock->edgeSecond++;
+    }
+    else
+    {
+        // Edges were missed, count the elapsed seconds
+        clock->edgeSecond += (interval + clock->periodMicros / 2) / clock->periodMicros;
+    }
+    clock->edgeMicros = t;
+    portEXIT_CRITICAL_ISR(&clock->mux);
+}
+
+void RTC::resyncTask(void *param)
+{
+    RTC *clock = static_cast<RTC *>(param);
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS((uint32_t)RTC_RESYNC_INTERVAL * 1000));
+        clock->resync();
+    }
+}
+
+void RTC::enableSquareWave()
+{
+    // The seconds register increments on the falling edge of the 1 Hz output
+    rtc.writeSqwPinMode(DS3231_SquareWave1Hz);
+    pinMode(sqwPin, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(sqwPin), RTC::onSquareWave, FALLING);
+    sqwEnabled = true;
+
+    resync();
+}
+
+void RTC::disableSquareWave()
+{
+    if (sqwEnabled)
+    {
+        detachInterrupt(digitalPinToInterrupt(sqwPin));
+        sqwEnabled = false;
+        locked = false;
+    }
+}
+
+void RTC::resync()
+{
+    // Read the DS3231 without an edge in between, so the value belongs to the last edge
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        int64_t before = edgeMicros;
+        DateTime t = rtc.now();
+        int64_t after = esp_timer_get_time();
+
+        portENTER_CRITICAL(&mux);
+        if (edgeMicros != before)
+        {
+            portEXIT_CRITICAL(&mux);
+            continue;
+        }
+
+        int32_t error = 0;
+        if (!locked || !sqwEnabled || after - edgeMicros > RTC_SQW_TIMEOUT)
+        {
+            // No square wave, only whole seconds are known until the next edge
+            edgeMicros = after;
+            locked = false;
+        }
+        else
+        {
+            error = (int32_t)(t.unixtime() - edgeSecond);
+        }
+        edgeSecond = t.unixtime();
+        portEXIT_CRITICAL(&mux);
+
+        if (error != 0)
+        {
+            Serial.println("RTC resync corrected " + String(error) + " s");
+        }
+        return;
+    }
+}
+
+uint64_t RTC::nowMicros()
+{
+    // The timer is read under the lock, an edge in between would make elapsed negative
+    portENTER_CRITICAL(&mux);
+    int64_t t = esp_timer_get_time();
+    uint32_t second = edgeSecond;
+    int64_t elapsed = t - edgeMicros;
+    int64_t period = periodMicros;
+    int64_t offset = offsetMicros;
+    portEXIT_CRITICAL(&mux);
+
+    if (elapsed < 0)
+    {
+        elapsed = 0;
+    }
+    uint64_t fraction = (uint64_t)elapsed * 1000000 / period;
+
+    // While edges are expected never run past the next second, so the clock stays monotonic
+    if (sqwEnabled && locked && elapsed < RTC_SQW_TIMEOUT && fraction > 999999)
+    {
+        fraction = 999999;
+    }
+    return (uint64_t)second * 1000000 + fraction + offset;
+}
+
 DateTime RTC::now()
 {
-    return rtc.now();
+    return DateTime((uint32_t)(nowMicros() / 1000000));
 }
 
 void RTC::setDateTime(const DateTime &dt)
 {
     rtc.adjust(dt);
+
+    // Writing the seconds restarts the DS3231 countdown chain, the next edge is one second away
+    portENTER_CRITICAL(&mux);
+    edgeSecond = dt.unixtime();
+    edgeMicros = esp_timer_get_time();
+    locked = sqwEnabled;
+    offsetMicros = 0;
+    portEXIT_CRITICAL(&mux);
+}
+
+void RTC::setOffsetMicros(int64_t offset)
+{
+    portENTER_CRITICAL(&mux);
+    offsetMicros = offset;
+    portEXIT_CRITICAL(&mux);
+}
+
+int64_t RTC::getOffsetMicros()
+{
+    portENTER_CRITICAL(&mux);
+    int64_t offset = offsetMicros;
+    portEXIT_CRITICAL(&mux);
+    return offset;
+}
+
+void RTC::setWakeAlarm(const DateTime &dt)
+{
+    // INT/SQW pin in interrupt mode, only Alarm1 may pull it low. The software clock runs on without edges
+    disableSquareWave();
+    rtc.writeSqwPinMode(DS3231_OFF);
+    rtc.disableAlarm(2);
+    rtc.clearAlarm(2);
+    rtc.clearAlarm(1);
+
+    // The DS3231 does not know the offset, round it to whole seconds
+    int64_t offset = getOffsetMicros();
+    int64_t shift = (offset >= 0 ? offset + 500000 : offset - 500000) / 1000000;
+
+    // Match date, hour, minute and second. The next alarm is always less than a week away
+    if (!rtc.setAlarm1(DateTime((uint32_t)(dt.unixtime() - shift)), DS3231_A1_Date))
+    {
+        Serial.println("Failed to set RTC wake alarm");
+    }
+}
+
+void RTC::clearWakeAlarm()
+{
+    rtc.clearAlarm(1);
+    rtc.disableAlarm(1);
 }
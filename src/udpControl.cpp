@@ -0,0 +1,392 @@
+#include "udpControl.h"
+#include "relay.h"
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+
+UdpControl *UdpControl::instance = nullptr;
+
+void UdpControl::begin(AlarmScheduler *scheduler, uint32_t session)
+{
+    if (task != nullptr)
+    {
+        return;
+    }
+    this->scheduler = scheduler;
+    this->session = session;
+    xTaskCreatePinnedToCore(UdpControl::taskLoop, "udpControl", UDP_CONTROL_TASK_STACK, this, UDP_CONTROL_TASK_PRIORITY, &task, PRO_CPU_NUM);
+}
+
+void UdpControl::setKey(const uint8_t *key)
+{
+    portENTER_CRITICAL(&mux);
+    if (key != nullptr)
+    {
+        memcpy(this->key, key, UDP_KEY_SIZE);
+    }
+    else
+    {
+        memset(this->key, 0, UDP_KEY_SIZE);
+    }
+    keySet = key != nullptr;
+    portEXIT_CRITICAL(&mux);
+
+    if (task != nullptr)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+bool UdpControl::hasKey()
+{
+    portENTER_CRITICAL(&mux);
+    bool result = keySet;
+    portEXIT_CRITICAL(&mux);
+    return result;
+}
+
+bool UdpControl::copyKey(uint8_t *out)
+{
+    portENTER_CRITICAL(&mux);
+    bool result = keySet;
+    memcpy(out, key, UDP_KEY_SIZE);
+    portEXIT_CRITICAL(&mux);
+    return result;
+}
+
+void UdpControl::setNetwork(bool up)
+{
+    networkUp = up;
+    if (task != nullptr)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
+void UdpControl::alarmFired(const FiredAlarm &alarm)
+{
+    // Only the most recent alarms matter if the task falls behind
+    fired.push(alarm);
+}
+
+bool UdpControl::open()
+{
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        Serial.println("UDP control: failed to create socket");
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(UDP_CONTROL_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr *)&address, sizeof(address)) < 0)
+    {
+        Serial.println("UDP control: failed to bind port " + String(UDP_CONTROL_PORT));
+        close();
+        return false;
+    }
+
+    // Bounds the wait for packets, so fired alarms are sent out soon
+    timeval timeout = {0, UDP_CONTROL_POLL * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    Serial.println("UDP control listening on port " + String(UDP_CONTROL_PORT));
+    return true;
+}
+
+void UdpControl::close()
+{
+    if (sock >= 0)
+    {
+        ::close(sock);
+        sock = -1;
+    }
+    // Clients have to start over with HELLO once the socket is back
+    for (Client &client : clients)
+    {
+        client = Client();
+    }
+}
+
+void UdpControl::send(const uint8_t *data, uint32_t address, uint16_t port)
+{
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = port;
+    to.sin_addr.s_addr = address;
+    sendto(sock, data, UDP_PACKET_SIZE, 0, (sockaddr *)&to, sizeof(to));
+}
+
+UdpControl::Client &UdpControl::findClient(uint32_t address, uint16_t port)
+{
+    Client *oldest = &clients[0];
+    for (Client &client : clients)
+    {
+        if (client.used && client.address == address && client.port == port)
+        {
+            return client;
+        }
+        if (!client.used)
+        {
+            oldest = &client;
+        }
+        else if (oldest->used && (int32_t)(client.lastSeen - oldest->lastSeen) < 0)
+        {
+            oldest = &client;
+        }
+    }
+
+    // A new client may only use sequences above all accepted so far, so requests
+    // recorded from other clients can not be replayed from its address
+    *oldest = Client();
+    oldest->used = true;
+    oldest->address = address;
+    oldest->port = port;
+    oldest->lastSequence = highestSequence;
+    return *oldest;
+}
+
+void UdpControl::receive()
+{
+    uint8_t data[UDP_PACKET_SIZE + 1]; // One more to tell longer packets apart
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    int length = recvfrom(sock, data, sizeof(data), 0, (sockaddr *)&from, &fromLength);
+    if (length <= 0)
+    {
+        return;
+    }
+    int64_t receivedAt = esp_timer_get_time();
+    handle(data, length, from.sin_addr.s_addr, from.sin_port, receivedAt);
+}
+
+void UdpControl::handle(const uint8_t *data, size_t length, uint32_t address, uint16_t port, int64_t receivedAt)
+{
+    uint8_t key[UDP_KEY_SIZE];
+    UdpPacket request;
+    // Packets that are not signed with the key get no reply at all
+    if (!copyKey(key) || !decodeUdpPacket(data, length, key, request) || (request.type & UDP_REPLY))
+    {
+        return;
+    }
+
+    Client &client = findClient(address, port);
+    client.lastSeen = millis();
+    uint8_t out[UDP_PACKET_SIZE];
+
+    if (request.type == UdpPacket::HELLO)
+    {
+        UdpPacket reply = request.reply(UdpPacket::OK);
+        reply.session = session;
+        reply.value = client.lastSequence + 1;
+        encodeUdpPacket(reply, key, out);
+        send(out, address, port);
+        return;
+    }
+
+    if (request.session != session)
+    {
+        UdpPacket reply = request.reply(UdpPacket::BAD_SESSION);
+        reply.session = session;
+        encodeUdpPacket(reply, key, out);
+        send(out, address, port);
+        return;
+    }
+
+    if (request.type == UdpPacket::EVENT_ACK)
+    {
+        acknowledge(client, request.sequence);
+        return;
+    }
+
+    // A resent request, the reply got lost. Answer again without executing it twice
+    if (client.hasReply && request.sequence == client.lastSequence)
+    {
+        send(client.reply, address, port);
+        return;
+    }
+
+    if (request.sequence <= client.lastSequence)
+    {
+        UdpPacket reply = request.reply(UdpPacket::STALE_SEQUENCE);
+        reply.value = client.lastSequence + 1;
+        encodeUdpPacket(reply, key, out);
+        send(out, address, port);
+        return;
+    }
+
+    client.lastSequence = request.sequence;
+    if (request.sequence > highestSequence)
+    {
+        highestSequence = request.sequence;
+    }
+
+    UdpPacket reply = execute(request, client, receivedAt);
+    encodeUdpPacket(reply, key, client.reply);
+    client.hasReply = true;
+    send(client.reply, address, port);
+}
+
+UdpPacket UdpControl::execute(const UdpPacket &request, Client &client, int64_t receivedAt)
+{
+    switch (request.type)
+    {
+    case UdpPacket::SET_RELAY:
+    {
+        SchedulerCommand command(SchedulerCommand::SET_RELAY);
+        command.relayId = request.relayId;
+        command.state = request.state;
+        SchedulerCommand::Result result = scheduler->submit(command);
+        // The relay pin is set when submit returns
+        uint32_t latency = esp_timer_get_time() - receivedAt;
+        if (result != SchedulerCommand::OK)
+        {
+            return request.reply(UdpPacket::RELAY_NOT_FOUND);
+        }
+
+        lastLatency = latency;
+        if (latency > maxLatency)
+        {
+            maxLatency = latency;
+        }
+        UdpPacket reply = request.reply(UdpPacket::OK);
+        reply.state = request.state;
+        reply.value = latency;
+        return reply;
+    }
+    case UdpPacket::GET_RELAY:
+    {
+        std::shared_ptr<const RelaySnapshot> snapshot = scheduler->getSnapshot();
+        const RelaySnapshot::RelayInfo *relay = snapshot ? snapshot->findRelay(request.relayId) : nullptr;
+        if (relay == nullptr)
+        {
+            return request.reply(UdpPacket::RELAY_NOT_FOUND);
+        }
+        UdpPacket reply = request.reply(UdpPacket::OK);
+        reply.state = relay->state;
+        return reply;
+    }
+    case UdpPacket::SUBSCRIBE:
+    {
+        client.leaseUntil = millis() + UDP_CONTROL_LEASE * 1000;
+        UdpPacket reply = request.reply(UdpPacket::OK);
+        reply.value = UDP_CONTROL_LEASE;
+        return reply;
+    }
+    default:
+        return request.reply(UdpPacket::UNKNOWN_TYPE);
+    }
+}
+
+void UdpControl::acknowledge(Client &client, uint32_t sequence)
+{
+    for (uint8_t i = 0; i < client.eventCount; i++)
+    {
+        if (client.events[i].packet.sequence == sequence)
+        {
+            client.eventCount--;
+            for (uint8_t j = i; j < client.eventCount; j++)
+            {
+                client.events[j] = client.events[j + 1];
+            }
+            return;
+        }
+    }
+}
+
+void UdpControl::sendEvents()
+{
+    uint8_t key[UDP_KEY_SIZE];
+    uint8_t out[UDP_PACKET_SIZE];
+    if (!copyKey(key))
+    {
+        return;
+    }
+    uint32_t now = millis();
+
+    // New events go to every client with a running lease
+    FiredAlarm alarm;
+    while (fired.pop(alarm))
+    {
+        for (Client &client : clients)
+        {
+            if (!client.used || (int32_t)(client.leaseUntil - now) <= 0)
+            {
+                continue;
+            }
+            if (client.eventCount == UDP_CONTROL_PENDING_EVENTS)
+            {
+                acknowledge(client, client.events[0].packet.sequence);
+            }
+
+            Event &event = client.events[client.eventCount++];
+            event.packet = UdpPacket();
+            event.packet.type = UdpPacket::ALARM_FIRED;
+            event.packet.sequence = ++client.eventSequence;
+            event.packet.session = session;
+            event.packet.relayId = alarm.relayId;
+            event.packet.alarmId = alarm.alarmId;
+            event.packet.state = alarm.state;
+            event.packet.value = alarm.unixtime;
+            event.sent = 0;
+            event.sentAt = now - UDP_CONTROL_RETRY;
+        }
+    }
+
+    // Send each event until it is acknowledged or out of retries
+    for (Client &client : clients)
+    {
+        uint8_t i = 0;
+        while (i < client.eventCount)
+        {
+            Event &event = client.events[i];
+            if (now - event.sentAt < UDP_CONTROL_RETRY)
+            {
+                i++;
+                continue;
+            }
+            if (event.sent == UDP_CONTROL_RETRIES)
+            {
+                acknowledge(client, event.packet.sequence);
+                continue;
+            }
+            encodeUdpPacket(event.packet, key, out);
+            send(out, client.address, client.port);
+            event.sent++;
+            event.sentAt = now;
+            i++;
+        }
+    }
+}
+
+void UdpControl::taskLoop(void *param)
+{
+    UdpControl *control = static_cast<UdpControl *>(param);
+
+    while (true)
+    {
+        if (!control->networkUp || !control->hasKey())
+        {
+            if (control->sock >= 0)
+            {
+                control->close();
+                Serial.println("UDP control stopped");
+            }
+            // Until the key or the network changes
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (control->sock < 0 && !control->open())
+        {
+            // Retried on the next change or after a while
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        control->receive();
+        control->sendEvents();
+    }
+}
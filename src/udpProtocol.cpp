@@ -0,0 +1,83 @@
+#include "udpProtocol.h"
+#include "mbedtls/md.h"
+#include <cstring>
+
+static void writeU32(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static uint32_t readU32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+void signUdpData(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], uint8_t *tag)
+{
+    uint8_t hmac[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, UDP_KEY_SIZE, data, length, hmac);
+    memcpy(tag, hmac, UDP_TAG_SIZE);
+}
+
+bool checkUdpTag(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], const uint8_t *tag)
+{
+    // Compared in constant time, so the time taken tells nothing about the tag
+    uint8_t expected[UDP_TAG_SIZE];
+    signUdpData(data, length, key, expected);
+    uint8_t difference = 0;
+    for (size_t i = 0; i < UDP_TAG_SIZE; i++)
+    {
+        difference |= expected[i] ^ tag[i];
+    }
+    return difference == 0;
+}
+
+UdpPacket UdpPacket::reply(Status status) const
+{
+    UdpPacket reply;
+    reply.type = type | UDP_REPLY;
+    reply.status = status;
+    reply.sequence = sequence;
+    reply.session = session;
+    reply.relayId = relayId;
+    return reply;
+}
+
+void encodeUdpPacket(const UdpPacket &packet, const uint8_t key[UDP_KEY_SIZE], uint8_t *out)
+{
+    memset(out, 0, UDP_PACKET_SIZE);
+    out[0] = UDP_MAGIC;
+    out[1] = UDP_VERSION;
+    out[2] = packet.type;
+    out[3] = packet.status;
+    writeU32(out + 4, packet.sequence);
+    writeU32(out + 8, packet.session);
+    writeU32(out + 12, packet.relayId);
+    writeU32(out + 16, packet.alarmId);
+    out[20] = packet.state;
+    writeU32(out + 24, packet.value);
+
+    signUdpData(out, UDP_SIGNED_SIZE, key, out + UDP_SIGNED_SIZE);
+}
+
+bool decodeUdpPacket(const uint8_t *data, size_t length, const uint8_t key[UDP_KEY_SIZE], UdpPacket &packet)
+{
+    if (length != UDP_PACKET_SIZE || data[0] != UDP_MAGIC || data[1] != UDP_VERSION ||
+        !checkUdpTag(data, UDP_SIGNED_SIZE, key, data + UDP_SIGNED_SIZE))
+    {
+        return false;
+    }
+
+    packet.type = data[2];
+    packet.status = data[3];
+    packet.sequence = readU32(data + 4);
+    packet.session = readU32(data + 8);
+    packet.relayId = readU32(data + 12);
+    packet.alarmId = readU32(data + 16);
+    packet.state = data[20] != 0;
+    packet.value = readU32(data + 24);
+    return true;
+}
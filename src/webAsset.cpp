@@ -0,0 +1,14 @@
+#include "webAsset.h"
+#include "webAssetData.h"
+
+const WebAsset *findWebAsset(const char *path)
+{
+#if WEB_ASSET_COUNT > 0
+    uint8_t index = webAssetTable[webAssetHash(path, WEB_ASSET_SEED) % WEB_ASSET_TABLE_SIZE];
+    if (index != WEB_ASSET_NONE && strcmp(webAssets[index].path, path) == 0)
+    {
+        return &webAssets[index];
+    }
+#endif
+    return nullptr;
+}
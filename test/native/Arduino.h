@@ -0,0 +1,261 @@
+#pragma once
+// Host build of the parts of the Arduino core the firmware sources use. Header
+// only, so the native test env needs no framework.
+#include <algorithm>
+#include <cstdarg>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+typedef unsigned int uint;
+typedef uint8_t byte;
+
+#define HEX 16
+#define DEC 10
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+class String
+{
+private:
+    std::string text;
+
+    static std::string format(unsigned long long value, unsigned char base)
+    {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), base == HEX ? "%llx" : "%llu", value);
+        return buffer;
+    }
+
+public:
+    String() {}
+    String(const char *value) : text(value != nullptr ? value : "") {}
+    String(const char *value, unsigned int length) : text(value, length) {}
+    String(const std::string &value) : text(value) {}
+    explicit String(char value) : text(1, value) {}
+    String(int value) : text(std::to_string(value)) {}
+    String(unsigned int value, unsigned char base = DEC) : text(format(value, base)) {}
+    String(long value) : text(std::to_string(value)) {}
+    String(unsigned long value, unsigned char base = DEC) : text(format(value, base)) {}
+    String(long long value) : text(std::to_string(value)) {}
+    String(unsigned long long value, unsigned char base = DEC) : text(format(value, base)) {}
+    String(double value, unsigned int decimals = 2)
+    {
+        char buffer[40];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+        text = buffer;
+    }
+
+    const char *c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    bool isEmpty() const { return text.empty(); }
+    bool reserve(unsigned int size)
+    {
+        text.reserve(size);
+        return true;
+    }
+
+    char operator[](unsigned int index) const { return index < text.size() ? text[index] : 0; }
+    char charAt(unsigned int index) const { return (*this)[index]; }
+    int indexOf(char c, unsigned int from = 0) const { return find(text.find(c, from)); }
+    int indexOf(const String &value, unsigned int from = 0) const { return find(text.find(value.text, from)); }
+    int lastIndexOf(char c) const { return find(text.rfind(c)); }
+    bool startsWith(const String &prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+    bool endsWith(const String &suffix) const
+    {
+        return text.size() >= suffix.text.size() && text.compare(text.size() - suffix.text.size(), suffix.text.size(), suffix.text) == 0;
+    }
+    String substring(unsigned int from) const { return substring(from, text.size()); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to)
+        {
+            std::swap(from, to);
+        }
+        from = std::min<size_t>(from, text.size());
+        to = std::min<size_t>(to, text.size());
+        return String(text.substr(from, to - from));
+    }
+    long toInt() const { return atol(text.c_str()); }
+    void remove(unsigned int index) { remove(index, text.size()); }
+    void remove(unsigned int index, unsigned int count)
+    {
+        if (index < text.size())
+        {
+            text.erase(index, count);
+        }
+    }
+    void trim()
+    {
+        size_t start = text.find_first_not_of(" \t\r\n");
+        size_t end = text.find_last_not_of(" \t\r\n");
+        text = start == std::string::npos ? "" : text.substr(start, end - start + 1);
+    }
+    void toLowerCase()
+    {
+        for (char &c : text)
+        {
+            c = tolower((unsigned char)c);
+        }
+    }
+    bool equalsIgnoreCase(const String &other) const
+    {
+        return text.size() == other.text.size() &&
+               std::equal(text.begin(), text.end(), other.text.begin(), [](char a, char b)
+                          { return tolower((unsigned char)a) == tolower((unsigned char)b); });
+    }
+
+    bool concat(const String &value)
+    {
+        text += value.text;
+        return true;
+    }
+    bool concat(const char *value, unsigned int length)
+    {
+        text.append(value, length);
+        return true;
+    }
+    bool concat(char c)
+    {
+        text += c;
+        return true;
+    }
+    String &operator+=(const String &value)
+    {
+        text += value.text;
+        return *this;
+    }
+    String &operator+=(const char *value)
+    {
+        text += value;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        text += c;
+        return *this;
+    }
+
+    bool operator==(const String &other) const { return text == other.text; }
+    bool operator==(const char *other) const { return text == other; }
+    bool operator!=(const String &other) const { return text != other.text; }
+    bool operator!=(const char *other) const { return text != other; }
+    bool operator<(const String &other) const { return text < other.text; }
+
+    friend String operator+(const String &a, const String &b) { return String(a.text + b.text); }
+    friend String operator+(const String &a, const char *b) { return String(a.text + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.text); }
+    friend String operator+(const String &a, char b) { return String(a.text + b); }
+
+private:
+    static int find(size_t position) { return position == std::string::npos ? -1 : (int)position; }
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *data, size_t size)
+    {
+        size_t written = 0;
+        while (size-- > 0)
+        {
+            written += write(*data++);
+        }
+        return written;
+    }
+    size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+
+    size_t print(const String &value) { return write((const uint8_t *)value.c_str(), value.length()); }
+    size_t print(const char *value) { return write(value); }
+    size_t print(char value) { return write((uint8_t)value); }
+    size_t print(int value) { return print(String(value)); }
+    size_t print(unsigned int value) { return print(String(value)); }
+    size_t print(long value) { return print(String(value)); }
+    size_t print(unsigned long value) { return print(String(value)); }
+    size_t print(long long value) { return print(String(value)); }
+    size_t print(unsigned long long value) { return print(String(value)); }
+    template <typename T>
+    size_t println(const T &value) { return print(value) + print("\r\n"); }
+    size_t println() { return print("\r\n"); }
+    // Through a stack buffer like the core does for short output
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buffer[64];
+        va_list arguments;
+        va_start(arguments, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+        va_end(arguments);
+        return length > 0 ? write((const uint8_t *)buffer, std::min((size_t)length, sizeof(buffer) - 1)) : 0;
+    }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// The firmware logs a lot, tests only show it with NATIVE_SERIAL_ECHO
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override
+    {
+#ifdef NATIVE_SERIAL_ECHO
+        putchar(c);
+#endif
+        return 1;
+    }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+inline HardwareSerial Serial;
+
+inline unsigned long millis() { return esp_timer_get_time() / 1000; }
+inline unsigned long micros() { return esp_timer_get_time(); }
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() { std::this_thread::yield(); }
+
+// Pins remember what was written, digitalRead of an output returns its level
+namespace native
+{
+    inline uint8_t pinLevels[64];
+}
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) { native::pinLevels[pin % 64] = level; }
+inline int digitalRead(uint8_t pin) { return native::pinLevels[pin % 64]; }
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+
+template <typename T>
+T min(T a, T b) { return a < b ? a : b; }
+template <typename T>
+T max(T a, T b) { return a > b ? a : b; }
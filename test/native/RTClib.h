@@ -0,0 +1,130 @@
+#pragma once
+// DateTime of RTClib and a DS3231 that keeps its time in memory
+#include <Arduino.h>
+#include <Wire.h>
+
+#define SECONDS_PER_DAY 86400L
+
+class TimeSpan
+{
+private:
+    int32_t seconds;
+
+public:
+    TimeSpan(int32_t seconds = 0) : seconds(seconds) {}
+    TimeSpan(int16_t days, int8_t hours, int8_t minutes, int8_t seconds)
+        : seconds(days * SECONDS_PER_DAY + hours * 3600L + minutes * 60L + seconds) {}
+    int32_t totalseconds() const { return seconds; }
+};
+
+class DateTime
+{
+private:
+    uint32_t time;
+
+    // Days since 1970-01-01 of a civil date, after Howard Hinnant's algorithm
+    static int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d)
+    {
+        y -= m <= 2;
+        int32_t era = (y >= 0 ? y : y - 399) / 400;
+        uint32_t yoe = (uint32_t)(y - era * 400);
+        uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (int32_t)doe - 719468;
+    }
+
+    void civil(uint16_t &year, uint8_t &month, uint8_t &day) const
+    {
+        int32_t z = time / SECONDS_PER_DAY + 719468;
+        int32_t era = z / 146097;
+        uint32_t doe = (uint32_t)(z - era * 146097);
+        uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        uint32_t mp = (5 * doy + 2) / 153;
+        day = doy - (153 * mp + 2) / 5 + 1;
+        month = mp < 10 ? mp + 3 : mp - 9;
+        year = yoe + era * 400 + (month <= 2);
+    }
+
+public:
+    DateTime(uint32_t time = 946684800) : time(time) {}
+    DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0)
+        : time((uint32_t)daysFromCivil(year, month, day) * SECONDS_PER_DAY + hour * 3600UL + minute * 60UL + second) {}
+
+    uint32_t unixtime() const { return time; }
+    bool isValid() const { return time >= 946684800; }
+    uint16_t year() const
+    {
+        uint16_t y;
+        uint8_t m, d;
+        civil(y, m, d);
+        return y;
+    }
+    uint8_t month() const
+    {
+        uint16_t y;
+        uint8_t m, d;
+        civil(y, m, d);
+        return m;
+    }
+    uint8_t day() const
+    {
+        uint16_t y;
+        uint8_t m, d;
+        civil(y, m, d);
+        return d;
+    }
+    uint8_t hour() const { return time % SECONDS_PER_DAY / 3600; }
+    uint8_t minute() const { return time % 3600 / 60; }
+    uint8_t second() const { return time % 60; }
+    uint8_t dayOfTheWeek() const { return (time / SECONDS_PER_DAY + 4) % 7; } // 0 is Sunday
+
+    DateTime operator+(const TimeSpan &span) const { return DateTime(time + span.totalseconds()); }
+    DateTime operator-(const TimeSpan &span) const { return DateTime(time - span.totalseconds()); }
+    TimeSpan operator-(const DateTime &other) const { return TimeSpan((int32_t)(time - other.time)); }
+    bool operator<(const DateTime &other) const { return time < other.time; }
+    bool operator>(const DateTime &other) const { return time > other.time; }
+    bool operator<=(const DateTime &other) const { return time <= other.time; }
+    bool operator>=(const DateTime &other) const { return time >= other.time; }
+    bool operator==(const DateTime &other) const { return time == other.time; }
+    bool operator!=(const DateTime &other) const { return time != other.time; }
+};
+
+enum Ds3231SqwPinMode
+{
+    DS3231_OFF = 0x1C,
+    DS3231_SquareWave1Hz = 0x00
+};
+
+enum Ds3231Alarm1Mode
+{
+    DS3231_A1_PerSecond = 0x0F,
+    DS3231_A1_Second = 0x0E,
+    DS3231_A1_Minute = 0x0C,
+    DS3231_A1_Hour = 0x08,
+    DS3231_A1_Date = 0x00,
+    DS3231_A1_Day = 0x10
+};
+
+// Counts from the time it was last adjusted to, starting at 2024-01-01
+class RTC_DS3231
+{
+private:
+    uint32_t base = 1704067200;
+    int64_t baseMicros = 0;
+
+public:
+    bool begin(TwoWire * = nullptr) { return true; }
+    bool lostPower() { return false; }
+    void adjust(const DateTime &dt)
+    {
+        base = dt.unixtime();
+        baseMicros = esp_timer_get_time();
+    }
+    DateTime now() { return DateTime(base + (uint32_t)((esp_timer_get_time() - baseMicros) / 1000000)); }
+    void writeSqwPinMode(Ds3231SqwPinMode) {}
+    bool setAlarm1(const DateTime &, Ds3231Alarm1Mode) { return true; }
+    void disableAlarm(uint8_t) {}
+    void clearAlarm(uint8_t) {}
+    bool alarmFired(uint8_t) { return false; }
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include <Arduino.h>
+
+class StreamString : public Stream, public String
+{
+private:
+    size_t position = 0;
+
+public:
+    size_t write(uint8_t c) override
+    {
+        concat((char)c);
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        concat((const char *)data, size);
+        return size;
+    }
+    int available() override { return length() - position; }
+    int read() override { return position < length() ? (uint8_t)charAt(position++) : -1; }
+    int peek() override { return position < length() ? (uint8_t)charAt(position) : -1; }
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+    bool begin(int sda = -1, int scl = -1) { return true; }
+};
+
+inline TwoWire Wire;
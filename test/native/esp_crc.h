@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+inline uint32_t esp_crc32_le(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    crc = ~crc;
+    while (length-- > 0)
+    {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+#include <random>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef void (*shutdown_handler_t)(void);
+inline esp_err_t esp_register_shutdown_handler(shutdown_handler_t) { return ESP_OK; }
+
+inline uint32_t esp_random()
+{
+    static std::random_device device;
+    return device();
+}
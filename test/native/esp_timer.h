@@ -0,0 +1,10 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Microseconds since the start of the test program
+inline int64_t esp_timer_get_time()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
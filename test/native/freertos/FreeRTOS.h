@@ -0,0 +1,67 @@
+#pragma once
+// FreeRTOS on host threads: a task is a detached std::thread with a notification
+// counter, mutexes are std mutexes and a tick is one millisecond.
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+struct tskTaskControlBlock
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint32_t notifications = 0;
+};
+typedef tskTaskControlBlock *TaskHandle_t;
+
+struct QueueDefinition
+{
+    std::recursive_timed_mutex mutex;
+};
+typedef QueueDefinition *SemaphoreHandle_t;
+
+// Interrupts do not exist on the host, a critical section is a lock
+struct portMUX_TYPE
+{
+    std::recursive_mutex mutex;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL_ISR(mux) (mux)->mutex.unlock()
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+namespace native
+{
+    // Threads that were not created as tasks, like the one running the tests,
+    // get their control block when they first need it. Never freed, detached
+    // tasks may still use theirs while the program exits
+    inline thread_local TaskHandle_t currentTask = nullptr;
+
+    inline TaskHandle_t self()
+    {
+        if (currentTask == nullptr)
+        {
+            currentTask = new tskTaskControlBlock();
+        }
+        return currentTask;
+    }
+}
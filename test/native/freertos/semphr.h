@@ -0,0 +1,38 @@
+#pragma once
+#include "FreeRTOS.h"
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+    return new QueueDefinition();
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new QueueDefinition();
+}
+
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        semaphore->mutex.lock();
+        return pdTRUE;
+    }
+    return semaphore->mutex.try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+    semaphore->mutex.unlock();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return xSemaphoreTakeRecursive(semaphore, ticks);
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xSemaphoreGiveRecursive(semaphore);
+}
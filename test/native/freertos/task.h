@@ -0,0 +1,69 @@
+#pragma once
+#include "FreeRTOS.h"
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *, uint32_t, void *param, UBaseType_t, TaskHandle_t *handle, BaseType_t)
+{
+    TaskHandle_t task = new tskTaskControlBlock();
+    // Set before the task runs, like a task of higher priority would see it
+    if (handle != nullptr)
+    {
+        *handle = task;
+    }
+    std::thread([function, param, task]()
+                {
+        native::currentTask = task;
+        function(param); })
+        .detach();
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack, void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stack, param, priority, handle, tskNO_AFFINITY);
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return native::self();
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::lock_guard<std::mutex> guard(task->mutex);
+    task->notifications++;
+    task->changed.notify_all();
+    return pdPASS;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken != nullptr)
+    {
+        *woken = pdTRUE;
+    }
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    TaskHandle_t task = native::self();
+    std::unique_lock<std::mutex> guard(task->mutex);
+    auto pending = [task]()
+    { return task->notifications > 0; };
+    if (ticks == portMAX_DELAY)
+    {
+        task->changed.wait(guard, pending);
+    }
+    else if (!task->changed.wait_for(guard, std::chrono::milliseconds(ticks), pending))
+    {
+        return 0;
+    }
+    uint32_t value = task->notifications;
+    task->notifications = clearOnExit ? 0 : value - 1;
+    return value;
+}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
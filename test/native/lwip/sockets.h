@@ -0,0 +1,8 @@
+#pragma once
+// lwIP offers the BSD socket API, on the host it is the system one
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
@@ -0,0 +1,162 @@
+#pragma once
+// HMAC-SHA-256 of mbedTLS, the only digest the firmware uses
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef enum
+{
+    MBEDTLS_MD_NONE = 0,
+    MBEDTLS_MD_SHA256 = 6
+} mbedtls_md_type_t;
+
+struct mbedtls_md_info_t
+{
+    mbedtls_md_type_t type;
+};
+
+namespace native
+{
+    class Sha256
+    {
+    private:
+        uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        uint8_t block[64];
+        size_t used = 0;
+        uint64_t total = 0;
+
+        static uint32_t rotate(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+        void compress()
+        {
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++)
+            {
+                uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; i++)
+            {
+                uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+
+    public:
+        void update(const uint8_t *data, size_t length)
+        {
+            total += length;
+            while (length-- > 0)
+            {
+                block[used++] = *data++;
+                if (used == sizeof(block))
+                {
+                    compress();
+                    used = 0;
+                }
+            }
+        }
+
+        void finish(uint8_t *digest)
+        {
+            uint64_t bits = total * 8;
+            uint8_t pad = 0x80;
+            update(&pad, 1);
+            pad = 0;
+            while (used != 56)
+            {
+                update(&pad, 1);
+            }
+            for (int i = 7; i >= 0; i--)
+            {
+                block[used++] = bits >> (8 * i);
+            }
+            compress();
+            for (int i = 0; i < 8; i++)
+            {
+                digest[4 * i] = state[i] >> 24;
+                digest[4 * i + 1] = state[i] >> 16;
+                digest[4 * i + 2] = state[i] >> 8;
+                digest[4 * i + 3] = state[i];
+            }
+        }
+    };
+}
+
+inline const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+    static const mbedtls_md_info_t sha256 = {MBEDTLS_MD_SHA256};
+    return type == MBEDTLS_MD_SHA256 ? &sha256 : nullptr;
+}
+
+inline int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *key, size_t keyLength,
+                           const unsigned char *input, size_t length, unsigned char *output)
+{
+    if (info == nullptr)
+    {
+        return -1;
+    }
+    uint8_t padded[64] = {};
+    if (keyLength > sizeof(padded))
+    {
+        native::Sha256 hash;
+        hash.update(key, keyLength);
+        hash.finish(padded);
+    }
+    else
+    {
+        memcpy(padded, key, keyLength);
+    }
+
+    uint8_t pad[64];
+    uint8_t inner[32];
+    native::Sha256 first;
+    for (size_t i = 0; i < sizeof(pad); i++)
+    {
+        pad[i] = padded[i] ^ 0x36;
+    }
+    first.update(pad, sizeof(pad));
+    first.update(input, length);
+    first.finish(inner);
+
+    native::Sha256 second;
+    for (size_t i = 0; i < sizeof(pad); i++)
+    {
+        pad[i] = padded[i] ^ 0x5c;
+    }
+    second.update(pad, sizeof(pad));
+    second.update(inner, sizeof(inner));
+    second.finish(output);
+    return 0;
+}
@@ -0,0 +1,416 @@
+#pragma once
+// ESP-MQTT client connected to a broker in memory, native::mqttBroker. Each client
+// has a thread of its own that connects, delivers messages and acknowledges
+// publishes through the registered event handler, like the task of ESP-MQTT.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "esp_system.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *data);
+
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT,
+    MQTT_EVENT_DELETED
+} esp_mqtt_event_id_t;
+
+struct esp_mqtt_client;
+typedef esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    char *data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char *topic;
+    int topic_len;
+    int msg_id;
+    bool retain;
+    int qos;
+} esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct
+{
+    const char *uri;
+    const char *username;
+    const char *password;
+    const char *lwt_topic;
+    const char *lwt_msg;
+    int lwt_qos;
+    int lwt_retain;
+    int keepalive;
+} esp_mqtt_client_config_t;
+
+namespace native
+{
+    struct MqttMessage
+    {
+        std::string topic;
+        std::string payload;
+        bool retain;
+    };
+
+    // MQTT topic filter with + and # wildcards
+    inline bool mqttTopicMatches(const std::string &filter, const std::string &topic)
+    {
+        size_t f = 0;
+        size_t t = 0;
+        while (f < filter.size())
+        {
+            if (filter[f] == '#')
+            {
+                return true;
+            }
+            if (filter[f] == '+')
+            {
+                while (t < topic.size() && topic[t] != '/')
+                {
+                    t++;
+                }
+                f++;
+                continue;
+            }
+            if (t >= topic.size() || filter[f] != topic[t])
+            {
+                return false;
+            }
+            f++;
+            t++;
+        }
+        return t == topic.size();
+    }
+
+    class MqttBroker
+    {
+    private:
+        std::mutex mutex;
+        bool reachable = true;
+        std::vector<esp_mqtt_client *> sessions;
+        std::map<std::string, std::string> retained;
+        std::vector<MqttMessage> log;
+
+        void route(const MqttMessage &message);
+
+    public:
+        // Without network the clients are dropped, their last will is published and they can not reconnect
+        void setReachable(bool reachable);
+
+        bool connect(esp_mqtt_client *client);
+        void disconnect(esp_mqtt_client *client, bool graceful);
+        void subscribe(esp_mqtt_client *client, const std::string &filter);
+
+        // From a client or a test. A retained empty payload removes the retained message
+        void publish(const MqttMessage &message)
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            route(message);
+        }
+
+        // Every message the broker received, in order
+        std::vector<MqttMessage> messages()
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            return log;
+        }
+
+        // Payload of the retained message of a topic, empty if there is none
+        std::string retainedPayload(const std::string &topic)
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            auto it = retained.find(topic);
+            return it != retained.end() ? it->second : "";
+        }
+
+        size_t connectedClients()
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            return sessions.size();
+        }
+    };
+
+    inline MqttBroker mqttBroker;
+}
+
+struct esp_mqtt_client
+{
+    struct Delivery
+    {
+        esp_mqtt_event_id_t event;
+        int id;
+        native::MqttMessage message;
+    };
+
+    std::string uri;
+    std::string lwtTopic;
+    std::string lwtMessage;
+    bool lwtRetain = false;
+    esp_event_handler_t handler = nullptr;
+    void *handlerArg = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Delivery> deliveries;
+    std::vector<std::string> subscriptions;
+    bool running = false;
+    bool connected = false;
+    int nextId = 1;
+    std::thread thread;
+
+    void push(const Delivery &delivery)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        deliveries.push_back(delivery);
+        changed.notify_all();
+    }
+
+    void dispatch(esp_mqtt_event_id_t id, const Delivery *delivery = nullptr)
+    {
+        std::string topic = delivery != nullptr ? delivery->message.topic : "";
+        std::string data = delivery != nullptr ? delivery->message.payload : "";
+        esp_mqtt_event_t event = {};
+        event.event_id = id;
+        event.client = this;
+        event.topic = &topic[0];
+        event.topic_len = topic.size();
+        event.data = &data[0];
+        event.data_len = data.size();
+        event.total_data_len = data.size();
+        event.msg_id = delivery != nullptr ? delivery->id : 0;
+        event.retain = delivery != nullptr && delivery->message.retain;
+        event.qos = 1;
+        if (handler != nullptr)
+        {
+            handler(handlerArg, "MQTT_EVENTS", id, &event);
+        }
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        while (running)
+        {
+            // Before connecting again, so a lost connection is reported first
+            while (!deliveries.empty())
+            {
+                Delivery delivery = deliveries.front();
+                deliveries.pop_front();
+                guard.unlock();
+                dispatch(delivery.event, &delivery);
+                guard.lock();
+            }
+
+            if (!connected)
+            {
+                guard.unlock();
+                bool up = native::mqttBroker.connect(this);
+                guard.lock();
+                if (up)
+                {
+                    connected = true;
+                    guard.unlock();
+                    dispatch(MQTT_EVENT_CONNECTED);
+                    guard.lock();
+                    continue;
+                }
+            }
+
+            changed.wait_for(guard, std::chrono::milliseconds(connected ? 100 : 10));
+        }
+    }
+};
+
+inline void native::MqttBroker::route(const MqttMessage &message)
+{
+    log.push_back(message);
+    if (message.retain)
+    {
+        if (message.payload.empty())
+        {
+            retained.erase(message.topic);
+        }
+        else
+        {
+            retained[message.topic] = message.payload;
+        }
+    }
+    for (esp_mqtt_client *client : sessions)
+    {
+        std::lock_guard<std::mutex> guard(client->mutex);
+        for (const std::string &filter : client->subscriptions)
+        {
+            if (mqttTopicMatches(filter, message.topic))
+            {
+                // Forwarded messages are not retained, like a broker does for existing subscriptions
+                client->deliveries.push_back({MQTT_EVENT_DATA, 0, {message.topic, message.payload, false}});
+                client->changed.notify_all();
+                break;
+            }
+        }
+    }
+}
+
+inline bool native::MqttBroker::connect(esp_mqtt_client *client)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!reachable)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> clientGuard(client->mutex);
+    client->subscriptions.clear();
+    sessions.push_back(client);
+    return true;
+}
+
+inline void native::MqttBroker::disconnect(esp_mqtt_client *client, bool graceful)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    auto session = std::find(sessions.begin(), sessions.end(), client);
+    if (session == sessions.end())
+    {
+        return;
+    }
+    sessions.erase(session);
+    if (!graceful && !client->lwtTopic.empty())
+    {
+        route({client->lwtTopic, client->lwtMessage, client->lwtRetain});
+    }
+}
+
+inline void native::MqttBroker::subscribe(esp_mqtt_client *client, const std::string &filter)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    std::lock_guard<std::mutex> clientGuard(client->mutex);
+    client->subscriptions.push_back(filter);
+    for (const auto &message : retained)
+    {
+        if (mqttTopicMatches(filter, message.first))
+        {
+            client->deliveries.push_back({MQTT_EVENT_DATA, 0, {message.first, message.second, true}});
+        }
+    }
+    client->changed.notify_all();
+}
+
+inline void native::MqttBroker::setReachable(bool reachable)
+{
+    std::vector<esp_mqtt_client *> dropped;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        this->reachable = reachable;
+        if (!reachable)
+        {
+            dropped = sessions;
+        }
+    }
+    for (esp_mqtt_client *client : dropped)
+    {
+        disconnect(client, false);
+        // Reported on the client thread, messages in flight are lost
+        std::lock_guard<std::mutex> guard(client->mutex);
+        client->connected = false;
+        client->deliveries.clear();
+        client->deliveries.push_back({MQTT_EVENT_DISCONNECTED, 0, {}});
+        client->changed.notify_all();
+    }
+}
+
+inline esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    if (config->uri == nullptr || strncmp(config->uri, "mqtt", 4) != 0)
+    {
+        return nullptr;
+    }
+    esp_mqtt_client *client = new esp_mqtt_client();
+    client->uri = config->uri;
+    client->lwtTopic = config->lwt_topic != nullptr ? config->lwt_topic : "";
+    client->lwtMessage = config->lwt_msg != nullptr ? config->lwt_msg : "";
+    client->lwtRetain = config->lwt_retain != 0;
+    return client;
+}
+
+inline esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t, esp_event_handler_t handler, void *arg)
+{
+    client->handler = handler;
+    client->handlerArg = arg;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    client->running = true;
+    client->thread = std::thread(&esp_mqtt_client::run, client);
+    return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    {
+        std::lock_guard<std::mutex> guard(client->mutex);
+        client->running = false;
+        client->changed.notify_all();
+    }
+    if (client->thread.joinable())
+    {
+        client->thread.join();
+    }
+    native::mqttBroker.disconnect(client, true);
+    client->connected = false;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    delete client;
+    return ESP_OK;
+}
+
+inline int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int)
+{
+    std::unique_lock<std::mutex> guard(client->mutex);
+    if (!client->connected)
+    {
+        return -1;
+    }
+    int id = client->nextId++;
+    guard.unlock();
+    native::mqttBroker.subscribe(client, topic);
+    return id;
+}
+
+// QoS 1: the broker acknowledges with MQTT_EVENT_PUBLISHED on the client thread
+inline int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int length, int, int retain)
+{
+    std::unique_lock<std::mutex> guard(client->mutex);
+    if (!client->connected)
+    {
+        return -1;
+    }
+    int id = client->nextId++;
+    guard.unlock();
+    native::mqttBroker.publish({topic, std::string(data, length > 0 ? length : strlen(data)), retain != 0});
+    client->push({MQTT_EVENT_PUBLISHED, id, {}});
+    return id;
+}
@@ -0,0 +1,106 @@
+#pragma once
+// NVS in memory. Tests read native::nvsEntries to see what was committed
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "esp_system.h"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+typedef uint32_t nvs_handle_t;
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+namespace native
+{
+    inline std::mutex nvsMutex;
+    inline std::map<std::string, std::vector<uint8_t>> nvsEntries; // Strings include their terminator
+    inline size_t nvsCommits = 0;
+
+    inline esp_err_t nvsGet(const char *key, void *out, size_t *length)
+    {
+        std::lock_guard<std::mutex> guard(nvsMutex);
+        auto it = nvsEntries.find(key);
+        if (it == nvsEntries.end())
+        {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if (out != nullptr)
+        {
+            if (*length < it->second.size())
+            {
+                return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(out, it->second.data(), it->second.size());
+        }
+        *length = it->second.size();
+        return ESP_OK;
+    }
+
+    inline esp_err_t nvsSet(const char *key, const void *data, size_t length)
+    {
+        std::lock_guard<std::mutex> guard(nvsMutex);
+        nvsEntries[key].assign((const uint8_t *)data, (const uint8_t *)data + length);
+        return ESP_OK;
+    }
+}
+
+inline esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *handle)
+{
+    *handle = 1;
+    return ESP_OK;
+}
+
+inline void nvs_close(nvs_handle_t) {}
+
+inline esp_err_t nvs_get_str(nvs_handle_t, const char *key, char *out, size_t *length)
+{
+    return native::nvsGet(key, out, length);
+}
+
+inline esp_err_t nvs_set_str(nvs_handle_t, const char *key, const char *value)
+{
+    return native::nvsSet(key, value, strlen(value) + 1);
+}
+
+inline esp_err_t nvs_get_blob(nvs_handle_t, const char *key, void *out, size_t *length)
+{
+    return native::nvsGet(key, out, length);
+}
+
+inline esp_err_t nvs_set_blob(nvs_handle_t, const char *key, const void *data, size_t length)
+{
+    return native::nvsSet(key, data, length);
+}
+
+inline esp_err_t nvs_erase_key(nvs_handle_t, const char *key)
+{
+    std::lock_guard<std::mutex> guard(native::nvsMutex);
+    return native::nvsEntries.erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+inline esp_err_t nvs_erase_all(nvs_handle_t)
+{
+    std::lock_guard<std::mutex> guard(native::nvsMutex);
+    native::nvsEntries.clear();
+    return ESP_OK;
+}
+
+inline esp_err_t nvs_commit(nvs_handle_t)
+{
+    std::lock_guard<std::mutex> guard(native::nvsMutex);
+    native::nvsCommits++;
+    return ESP_OK;
+}
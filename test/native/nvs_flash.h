@@ -0,0 +1,8 @@
+#pragma once
+#include "nvs.h"
+
+inline esp_err_t nvs_flash_init() { return ESP_OK; }
+inline esp_err_t nvs_flash_erase()
+{
+    return nvs_erase_all(0);
+}
@@ -0,0 +1,132 @@
+#include <unity.h>
+#include "configManager.h"
+#include "relayManager.h"
+#include <nvs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+
+// A reboot starts with fresh id counters and an empty alarm table, so each boot
+// runs in a process of its own. The NVS entries are handed on through a pipe.
+static std::array<bool, 7> everyDay = {true, true, true, true, true, true, true};
+
+static bool writeAll(int fd, const void *data, size_t length)
+{
+    return write(fd, data, length) == (ssize_t)length;
+}
+
+static bool readAll(int fd, void *data, size_t length)
+{
+    uint8_t *bytes = static_cast<uint8_t *>(data);
+    while (length > 0)
+    {
+        ssize_t n = read(fd, bytes, length);
+        if (n <= 0)
+        {
+            return false;
+        }
+        bytes += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Run the given boot in a child process and take over the NVS it committed. Returns its exit code
+template <typename F>
+static int boot(F run)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        run();
+        ConfigManager::getInstance()->flush();
+        bool ok = true;
+        for (const auto &entry : native::nvsEntries)
+        {
+            uint32_t sizes[2] = {(uint32_t)entry.first.size(), (uint32_t)entry.second.size()};
+            ok = ok && writeAll(fds[1], sizes, sizeof(sizes)) && writeAll(fds[1], entry.first.data(), sizes[0]) && writeAll(fds[1], entry.second.data(), sizes[1]);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    native::nvsEntries.clear();
+    uint32_t sizes[2];
+    while (readAll(fds[0], sizes, sizeof(sizes)))
+    {
+        std::string key(sizes[0], '\0');
+        std::vector<uint8_t> value(sizes[1]);
+        readAll(fds[0], &key[0], sizes[0]);
+        readAll(fds[0], value.data(), sizes[1]);
+        native::nvsEntries[key] = value;
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// id:hour of every alarm, in id order
+static std::string describeAlarms(Relay *relay)
+{
+    std::ostringstream alarms;
+    for (uint id : relay->getAlarmIDs())
+    {
+        alarms << id << ":" << (int)relay->getAlarmByID(id).getHour() << ";";
+    }
+    return alarms.str();
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_alarm_ids_survive_a_reboot()
+{
+    TEST_ASSERT_EQUAL(0, boot([]()
+                          {
+        RelayManager manager;
+        Relay *relay = manager.addRelay(5, "Relay");
+        uint first = relay->addAlarm(1, 0, 0, everyDay, true).getId();
+        relay->addAlarm(2, 0, 0, everyDay, false);
+        relay->addAlarm(3, 0, 0, everyDay, true);
+        relay->removeAlarm(first);
+        // Reuses the slot of the first alarm, so the stored slots are no longer in id order
+        relay->addAlarm(4, 0, 0, everyDay, false);
+        manager.saveConfig(); }));
+
+    std::string expected = "1:2;2:3;3:4;";
+    for (int reboot = 0; reboot < 2; reboot++)
+    {
+        TEST_ASSERT_EQUAL(0, boot([expected]()
+                              {
+            RelayManager manager;
+            if (!manager.loadConfig() || manager.getRelayIDs().size() != 1)
+            {
+                _exit(2);
+            }
+            Relay *relay = manager.getRelayByID(manager.getRelayIDs()[0]);
+            if (describeAlarms(relay) != expected)
+            {
+                _exit(3);
+            }
+            // New alarms continue after the stored ids
+            if (relay->addAlarm(5, 0, 0, everyDay, true).getId() != 4)
+            {
+                _exit(4);
+            }
+            relay->removeAlarm(4); }));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_alarm_ids_survive_a_reboot);
+    return UNITY_END();
+}
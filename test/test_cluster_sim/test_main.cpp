@@ -0,0 +1,233 @@
+#include <unity.h>
+#include "clusterNode.h"
+#include "clusterTransport.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define NODES 5
+#define STEP 100                // in us of simulated time
+#define BEACON_INTERVAL 1000000 // in us, like the cluster task
+#define LOSS 0.1                // share of packets lost on the way to each unit
+#define MIN_DELAY 300           // in us
+#define MAX_DELAY 4300          // in us
+#define MAX_SPREAD 5000         // in us, all units switch within this
+#define COMMAND_LEAD 50000      // in us
+
+static const uint8_t key[UDP_KEY_SIZE] = {7};
+static const uint32_t nodeIds[NODES] = {50, 10, 30, 40, 20};
+
+// Units on one network with loss and delay. Every unit has its own clock, with
+// an offset of up to 5 s and a drift of up to 20 ppm against simulated time
+class Simulation
+{
+private:
+    struct Packet
+    {
+        uint64_t deliverAt;
+        std::string data;
+    };
+
+    class Transport : public ClusterTransport
+    {
+    public:
+        Simulation *simulation;
+        size_t index;
+        std::deque<Packet> inbox;
+
+        void send(const uint8_t *data, size_t length) override { simulation->send(index, data, length); }
+        // Delivered by runUntil(), the simulation has no receiving task
+        size_t receive(uint8_t *, size_t, uint32_t) override { return 0; }
+    };
+
+    std::mt19937 rng;
+    Transport transports[NODES];
+    int64_t clockOffset[NODES];
+    double drift[NODES];
+    uint64_t nextBeacon[NODES];
+
+    void send(size_t from, const uint8_t *data, size_t length)
+    {
+        lastPacket.assign((const char *)data, length);
+        for (size_t i = 0; i < NODES; i++)
+        {
+            if (i == from || !connected[i] || std::uniform_real_distribution<>(0, 1)(rng) < LOSS)
+            {
+                continue;
+            }
+            uint64_t delay = MIN_DELAY + rng() % (MAX_DELAY - MIN_DELAY);
+            transports[i].inbox.push_back({now + delay, std::string((const char *)data, length)});
+        }
+    }
+
+public:
+    uint64_t now = 0; // Simulated time in us
+    std::unique_ptr<ClusterNode> nodes[NODES];
+    bool connected[NODES];
+    uint64_t applied[NODES] = {}; // Simulated time the last command was applied
+    std::string lastPacket;       // Last packet any unit sent
+
+    Simulation(uint32_t seed) : rng(seed)
+    {
+        for (size_t i = 0; i < NODES; i++)
+        {
+            transports[i].simulation = this;
+            transports[i].index = i;
+            clockOffset[i] = rng() % 5000000000ULL;
+            drift[i] = ((int)(rng() % 40) - 20) * 1e-6;
+            nextBeacon[i] = rng() % BEACON_INTERVAL;
+            connected[i] = true;
+            nodes[i].reset(new ClusterNode(transports[i], nodeIds[i], key));
+        }
+    }
+
+    uint64_t local(size_t i) const
+    {
+        return 1700000000000000ULL + (uint64_t)(now * (1 + drift[i])) + clockOffset[i];
+    }
+
+    // Run every connected unit like the cluster task does until the given time
+    void runUntil(uint64_t end)
+    {
+        for (; now < end; now += STEP)
+        {
+            for (size_t i = 0; i < NODES; i++)
+            {
+                if (!connected[i])
+                {
+                    continue;
+                }
+                std::deque<Packet> &inbox = transports[i].inbox;
+                for (auto packet = inbox.begin(); packet != inbox.end();)
+                {
+                    if (packet->deliverAt <= now)
+                    {
+                        nodes[i]->handle((const uint8_t *)packet->data.data(), packet->data.size(), local(i));
+                        packet = inbox.erase(packet);
+                    }
+                    else
+                    {
+                        ++packet;
+                    }
+                }
+                if (now >= nextBeacon[i])
+                {
+                    nodes[i]->expire(local(i));
+                    nodes[i]->sendBeacon(local(i));
+                    nextBeacon[i] += BEACON_INTERVAL;
+                }
+                ClusterNode::Command command;
+                while (nodes[i]->takeDue(local(i), command))
+                {
+                    applied[i] = now;
+                }
+            }
+        }
+    }
+
+    // Largest difference of the cluster time between connected units, in us
+    uint64_t clusterTimeSpread() const
+    {
+        int64_t low = INT64_MAX;
+        int64_t high = INT64_MIN;
+        for (size_t i = 0; i < NODES; i++)
+        {
+            if (connected[i])
+            {
+                int64_t time = nodes[i]->clusterTime(local(i)) - 1700000000000000LL;
+                low = std::min(low, time);
+                high = std::max(high, time);
+            }
+        }
+        return high - low;
+    }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_units_follow_the_lowest_id()
+{
+    Simulation simulation(1);
+    simulation.runUntil(10000000);
+    for (size_t i = 0; i < NODES; i++)
+    {
+        TEST_ASSERT_EQUAL(10, simulation.nodes[i]->getMaster());
+        TEST_ASSERT_TRUE(simulation.nodes[i]->isSynced());
+    }
+    TEST_ASSERT_LESS_THAN(MAX_SPREAD, simulation.clusterTimeSpread());
+}
+
+void test_group_commands_switch_all_units_together()
+{
+    for (uint32_t seed = 1; seed <= 5; seed++)
+    {
+        Simulation simulation(seed);
+        simulation.runUntil(30000000);
+        simulation.nodes[3]->sendCommand("lobby", true, simulation.local(3), COMMAND_LEAD);
+        simulation.runUntil(32000000);
+
+        uint64_t first = UINT64_MAX;
+        uint64_t last = 0;
+        for (size_t i = 0; i < NODES; i++)
+        {
+            TEST_ASSERT_NOT_EQUAL(0, simulation.applied[i]);
+            first = std::min(first, simulation.applied[i]);
+            last = std::max(last, simulation.applied[i]);
+        }
+        TEST_ASSERT_LESS_THAN(MAX_SPREAD, last - first);
+    }
+}
+
+void test_tampered_and_replayed_commands_are_ignored()
+{
+    Simulation simulation(2);
+    simulation.runUntil(10000000);
+    simulation.nodes[1]->sendCommand("lobby", true, simulation.local(1), COMMAND_LEAD);
+    std::string command = simulation.lastPacket;
+    simulation.runUntil(10500000);
+    TEST_ASSERT_NOT_EQUAL(0, simulation.applied[0]);
+
+    ClusterNode &node = *simulation.nodes[0];
+    ClusterNode::Command due;
+    node.handle((const uint8_t *)command.data(), command.size(), simulation.local(0));
+    TEST_ASSERT_EQUAL(UINT64_MAX, node.nextDue());
+
+    // A fresh command with the state flipped after signing
+    simulation.nodes[1]->sendCommand("lobby", true, simulation.local(1), COMMAND_LEAD);
+    std::string tampered = simulation.lastPacket;
+    tampered[3] ^= 1;
+    node.handle((const uint8_t *)tampered.data(), tampered.size(), simulation.local(0));
+    TEST_ASSERT_EQUAL(UINT64_MAX, node.nextDue());
+    TEST_ASSERT_FALSE(node.takeDue(simulation.local(0) + CLUSTER_MAX_LEAD, due));
+}
+
+void test_next_lowest_id_takes_over()
+{
+    Simulation simulation(3);
+    simulation.runUntil(10000000);
+    simulation.connected[1] = false;
+    simulation.runUntil(20000000);
+    for (size_t i = 0; i < NODES; i++)
+    {
+        if (i != 1)
+        {
+            TEST_ASSERT_EQUAL(20, simulation.nodes[i]->getMaster());
+        }
+    }
+    TEST_ASSERT_LESS_THAN(MAX_SPREAD, simulation.clusterTimeSpread());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_units_follow_the_lowest_id);
+    RUN_TEST(test_group_commands_switch_all_units_together);
+    RUN_TEST(test_tampered_and_replayed_commands_are_ignored);
+    RUN_TEST(test_next_lowest_id_takes_over);
+    return UNITY_END();
+}
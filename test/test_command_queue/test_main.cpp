@@ -0,0 +1,230 @@
+#include <unity.h>
+#include "alarmScheduler.h"
+#include "mpscQueue.h"
+#include "relayManager.h"
+#include "relaySnapshot.h"
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#define PRODUCERS 4
+#define READERS 2
+#define QUEUE_VALUES 100000
+#define COMMANDS_PER_PRODUCER 500
+
+void setUp() {}
+void tearDown() {}
+
+void test_queue_keeps_the_order_of_each_producer()
+{
+    static MpscQueue<uint64_t, 16> queue;
+    std::vector<std::thread> producers;
+    for (uint64_t p = 0; p < PRODUCERS; p++)
+    {
+        producers.emplace_back([p]()
+                               {
+            for (uint64_t i = 0; i < QUEUE_VALUES; i++)
+            {
+                while (!queue.push(p << 32 | i))
+                {
+                    std::this_thread::yield();
+                }
+            } });
+    }
+
+    uint64_t next[PRODUCERS] = {};
+    long received = 0;
+    bool ordered = true;
+    while (received < (long)PRODUCERS * QUEUE_VALUES)
+    {
+        uint64_t value;
+        if (!queue.pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        uint64_t producer = value >> 32;
+        ordered = ordered && producer < PRODUCERS && (value & 0xFFFFFFFF) == next[producer];
+        next[producer]++;
+        received++;
+    }
+    for (std::thread &producer : producers)
+    {
+        producer.join();
+    }
+
+    uint64_t value;
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_FALSE(queue.pop(value));
+}
+
+// Checks a snapshot could have been taken between two commands. Returns false if not
+static bool isConsistent(const RelaySnapshot &snapshot)
+{
+    size_t relay = 0;
+    for (const RelaySnapshot::AlarmInfo &alarm : snapshot.alarms)
+    {
+        while (relay < snapshot.relays.size() && snapshot.relays[relay].id != alarm.relayId)
+        {
+            relay++;
+        }
+        if (relay == snapshot.relays.size() || alarm.changed > snapshot.generation)
+        {
+            return false;
+        }
+    }
+    return snapshot.alarms.size() <= MAX_ALARMS;
+}
+
+void test_many_tasks_submit_while_readers_use_snapshots()
+{
+    RelayManager *manager = new RelayManager();
+    uint relayIds[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        relayIds[p] = manager->addRelay(20 + p, "Relay " + String(p))->getId();
+    }
+    AlarmScheduler *scheduler = AlarmScheduler::getInstance();
+    scheduler->begin(manager);
+
+    std::atomic<bool> stopped(false);
+    std::atomic<int> failures(0);
+    std::atomic<int> inconsistent(0);
+    std::atomic<TaskHandle_t> handles[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        handles[p] = nullptr;
+    }
+
+    // Each producer owns a relay, adds alarms and deletes every second one
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        producers.emplace_back([&, p]()
+                               {
+            handles[p] = xTaskGetCurrentTaskHandle();
+            for (int i = 0; i < COMMANDS_PER_PRODUCER; i++)
+            {
+                SchedulerCommand add(SchedulerCommand::ADD_ALARM);
+                add.relayId = relayIds[p];
+                add.hour = i % 24;
+                add.minute = i % 60;
+                add.weekdays[i % 7] = true;
+                add.state = i % 2;
+                if (scheduler->submit(add) != SchedulerCommand::OK)
+                {
+                    failures++;
+                    continue;
+                }
+
+                SchedulerCommand set(SchedulerCommand::SET_RELAY);
+                set.relayId = relayIds[p];
+                set.state = i % 2;
+                if (scheduler->submit(set) != SchedulerCommand::OK)
+                {
+                    failures++;
+                }
+
+                if (i % 2 == 1)
+                {
+                    SchedulerCommand remove(SchedulerCommand::DELETE_ALARM);
+                    remove.relayId = relayIds[p];
+                    remove.alarmId = add.alarmId;
+                    if (scheduler->submit(remove) != SchedulerCommand::OK)
+                    {
+                        failures++;
+                    }
+                }
+            } });
+    }
+
+    // Notifications meant for the loops of the producers must not end their wait early
+    std::thread notifier([&]()
+                         {
+        while (!stopped)
+        {
+            for (int p = 0; p < PRODUCERS; p++)
+            {
+                TaskHandle_t handle = handles[p];
+                if (handle != nullptr)
+                {
+                    xTaskNotifyGive(handle);
+                }
+            }
+            std::this_thread::yield();
+        } });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < READERS; r++)
+    {
+        readers.emplace_back([&]()
+                             {
+            uint32_t last = 0;
+            while (!stopped)
+            {
+                std::shared_ptr<const RelaySnapshot> snapshot = scheduler->getSnapshot();
+                if (snapshot->generation < last || !isConsistent(*snapshot))
+                {
+                    inconsistent++;
+                }
+                last = snapshot->generation;
+            } });
+    }
+
+    for (std::thread &producer : producers)
+    {
+        producer.join();
+    }
+
+    // The snapshot is published after the commands ran, give the scheduler task a moment
+    size_t expected = PRODUCERS * COMMANDS_PER_PRODUCER / 2;
+    for (int i = 0; i < 1000 && scheduler->getSnapshot()->alarms.size() != expected; i++)
+    {
+        delay(1);
+    }
+    stopped = true;
+    notifier.join();
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    TEST_ASSERT_EQUAL(0, failures.load());
+    TEST_ASSERT_EQUAL(0, inconsistent.load());
+    TEST_ASSERT_EQUAL(expected, AlarmTable::getInstance()->size());
+    TEST_ASSERT_EQUAL(expected, scheduler->size());
+    TEST_ASSERT_EQUAL(expected, scheduler->getSnapshot()->alarms.size());
+    for (int p = 0; p < PRODUCERS; p++)
+    {
+        TEST_ASSERT_EQUAL(COMMANDS_PER_PRODUCER / 2, manager->getRelayByID(relayIds[p])->getAlarmIDs().size());
+    }
+}
+
+void test_errors_are_rethrown_in_the_caller()
+{
+    bool thrown = false;
+    std::thread caller([&]()
+                       {
+        try
+        {
+            AlarmScheduler::getInstance()->run([]()
+                                               { throw std::runtime_error("Command failed"); });
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        } });
+    caller.join();
+    TEST_ASSERT_TRUE(thrown);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_queue_keeps_the_order_of_each_producer);
+    RUN_TEST(test_many_tasks_submit_while_readers_use_snapshots);
+    RUN_TEST(test_errors_are_rethrown_in_the_caller);
+    return UNITY_END();
+}
@@ -0,0 +1,223 @@
+#include <unity.h>
+#include "alarmScheduler.h"
+#include "alarmTable.h"
+#include "jsonReader.h"
+#include "relayManager.h"
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+
+#define TEST_RELAYS 4
+
+// Peak heap use while loading, tracked through the global allocator
+static std::atomic<size_t> heapBytes(0);
+static std::atomic<size_t> peakBytes(0);
+
+struct alignas(std::max_align_t) Header
+{
+    size_t size;
+};
+
+void *operator new(size_t size)
+{
+    Header *header = static_cast<Header *>(malloc(sizeof(Header) + size));
+    if (header == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    size_t used = heapBytes += size;
+    size_t peak = peakBytes.load();
+    while (used > peak && !peakBytes.compare_exchange_weak(peak, used))
+    {
+    }
+    return header + 1;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    Header *header = static_cast<Header *>(pointer) - 1;
+    heapBytes -= header->size;
+    free(header);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+// Config as older firmware wrote it, with relay ids above every relay id used before.
+// expected lists id:hour,minute,second,state,weekday of each alarm
+static std::string makeConfig(uint base, int alarmsPerRelay, std::string &expected)
+{
+    std::mt19937 rng(base);
+    std::ostringstream json;
+    std::ostringstream alarms;
+    json << "{\"name\":\"Sys\\u00e9\\\"x\",\"extra\":{\"a\":[1,2,{\"b\":null}],\"c\":-1.5e3},\n\"relays\":[";
+    int total = 0;
+    for (int r = 0; r < TEST_RELAYS; r++)
+    {
+        json << (r > 0 ? "," : "") << "{\"id\":" << base + r * 3 << ",\"name\":\"R" << r << "\",\"pin\":" << 10 + r << ",\"alarms\":[";
+        for (int a = 0; a < alarmsPerRelay; a++)
+        {
+            int hour = rng() % 24;
+            int minute = rng() % 60;
+            int second = rng() % 60;
+            bool state = rng() % 2;
+            uint id = base + total * 2;
+            json << (a > 0 ? "," : "") << "{\"id\":" << id << ",\"hour\":" << hour << ",\"minute\":" << minute << ",\"second\":" << second << ",\"weekdays\":[";
+            for (int d = 0; d < 7; d++)
+            {
+                json << (d > 0 ? "," : "") << (d == a % 7 ? "true" : "false");
+            }
+            json << "],\"relay\":" << base + r * 3 << ",\"state\":" << (state ? "true" : "false") << "}";
+            alarms << id << ":" << hour << "," << minute << "," << second << "," << state << "," << a % 7 << ";";
+            total++;
+        }
+        json << "]}";
+    }
+    json << "]}";
+    expected = alarms.str();
+    return json.str();
+}
+
+static std::string describeAlarms(const RelayManager &manager)
+{
+    std::ostringstream alarms;
+    for (uint relayId : manager.getRelayIDs())
+    {
+        Relay *relay = manager.getRelayByID(relayId);
+        for (uint id : relay->getAlarmIDs())
+        {
+            Alarm alarm = relay->getAlarmByID(id);
+            std::array<bool, 7> weekdays = alarm.getWeekdays();
+            int day = 0;
+            while (day < 7 && !weekdays[day])
+            {
+                day++;
+            }
+            alarms << id << ":" << (int)alarm.getHour() << "," << (int)alarm.getMinute() << "," << (int)alarm.getSecond() << "," << alarm.getState() << "," << day << ";";
+        }
+    }
+    return alarms.str();
+}
+
+static bool load(RelayManager &manager, const std::string &json)
+{
+    BufferStream input(json.c_str(), json.size());
+    return manager.loadJson(input);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_loads_a_full_table()
+{
+    std::string expected;
+    std::string json = makeConfig(1000, MAX_ALARMS / TEST_RELAYS, expected);
+    std::unique_ptr<RelayManager> manager(new RelayManager());
+
+    TEST_ASSERT_TRUE(load(*manager, json));
+    TEST_ASSERT_EQUAL_STRING("Sys\xc3\xa9\"x", manager->getName().c_str());
+    TEST_ASSERT_EQUAL(TEST_RELAYS, manager->getRelayIDs().size());
+    for (int r = 0; r < TEST_RELAYS; r++)
+    {
+        Relay *relay = manager->getRelayByID(1000 + r * 3);
+        TEST_ASSERT_NOT_NULL(relay);
+        TEST_ASSERT_EQUAL(10 + r, relay->getPin());
+        TEST_ASSERT_EQUAL_STRING(("R" + std::to_string(r)).c_str(), relay->getName().c_str());
+    }
+    TEST_ASSERT_EQUAL(MAX_ALARMS, AlarmTable::getInstance()->size());
+    TEST_ASSERT_EQUAL(MAX_ALARMS, AlarmScheduler::getInstance()->size());
+    TEST_ASSERT_TRUE(expected == describeAlarms(*manager));
+}
+
+void test_skips_alarms_beyond_the_table()
+{
+    std::string expected;
+    std::string json = makeConfig(10000, 300, expected);
+    std::unique_ptr<RelayManager> manager(new RelayManager());
+
+    TEST_ASSERT_TRUE(load(*manager, json));
+    TEST_ASSERT_EQUAL(TEST_RELAYS, manager->getRelayIDs().size());
+    TEST_ASSERT_EQUAL(MAX_ALARMS, AlarmTable::getInstance()->size());
+    // Relays and alarms are loaded in order, the ones that fit are the start of the config
+    std::string loaded = describeAlarms(*manager);
+    TEST_ASSERT_TRUE(expected.compare(0, loaded.size(), loaded) == 0);
+}
+
+void test_peak_memory_does_not_grow_with_alarms()
+{
+    // The tables reserve MAX_ALARMS up front, what the loader itself needs must not depend on the config
+    size_t peaks[2];
+    int alarmsPerRelay[2] = {10, MAX_ALARMS / TEST_RELAYS};
+    for (int i = 0; i < 2; i++)
+    {
+        std::string expected;
+        std::string json = makeConfig(20000 + i * 10000, alarmsPerRelay[i], expected);
+        std::unique_ptr<RelayManager> manager(new RelayManager());
+
+        size_t before = heapBytes.load();
+        peakBytes = before;
+        TEST_ASSERT_TRUE(load(*manager, json));
+        peaks[i] = peakBytes.load() - before;
+    }
+    TEST_ASSERT_EQUAL(peaks[0], peaks[1]);
+}
+
+void test_keeps_alarm_ids_that_are_not_in_order()
+{
+    // Written by firmware that added alarms to the relays in turn, so the ids do not rise across relays
+    const char *json = "{\"relays\":["
+                       "{\"id\":50000,\"pin\":5,\"alarms\":[{\"id\":900,\"hour\":1},{\"id\":5,\"hour\":2}]},"
+                       "{\"id\":50001,\"pin\":6,\"alarms\":[{\"id\":300,\"hour\":3},{\"id\":7,\"hour\":4},{\"id\":12,\"hour\":5}]}]}";
+    const uint relayIds[] = {50000, 50000, 50001, 50001, 50001};
+    const uint alarmIds[] = {900, 5, 300, 7, 12};
+    std::unique_ptr<RelayManager> manager(new RelayManager());
+
+    TEST_ASSERT_TRUE(load(*manager, json));
+    TEST_ASSERT_EQUAL(5, AlarmTable::getInstance()->size());
+    for (int i = 0; i < 5; i++)
+    {
+        Relay *relay = manager->getRelayByID(relayIds[i]);
+        TEST_ASSERT_NOT_NULL(relay);
+        Alarm alarm = relay->getAlarmByID(alarmIds[i]);
+        TEST_ASSERT_TRUE(alarm.isValid());
+        TEST_ASSERT_EQUAL(i + 1, alarm.getHour());
+    }
+    TEST_ASSERT_TRUE(describeAlarms(*manager) == "5:2,0,0,0,7;900:1,0,0,0,7;7:4,0,0,0,7;12:5,0,0,0,7;300:3,0,0,0,7;");
+}
+
+void test_rejects_syntax_errors()
+{
+    const char *configs[] = {
+        "{\"relays\":[{\"id\":1,\"alarms\":[{\"hour\":1,}]}]}",
+        "{\"relays\":[{\"id\":1,\"pin\":5 \"alarms\":[]}]}",
+        "{\"relays\":[{\"id\":1,\"alarms\":[{\"hour\":1",
+        "{\"extra\":[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]}",
+    };
+    for (const char *config : configs)
+    {
+        RelayManager manager;
+        TEST_ASSERT_FALSE_MESSAGE(load(manager, config), config);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_loads_a_full_table);
+    RUN_TEST(test_skips_alarms_beyond_the_table);
+    RUN_TEST(test_peak_memory_does_not_grow_with_alarms);
+    RUN_TEST(test_keeps_alarm_ids_that_are_not_in_order);
+    RUN_TEST(test_rejects_syntax_errors);
+    return UNITY_END();
+}
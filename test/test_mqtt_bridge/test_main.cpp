@@ -0,0 +1,210 @@
+#include <unity.h>
+#include "alarmScheduler.h"
+#include "mqttBridge.h"
+#include "relayManager.h"
+#include <mqtt_client.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// The bridge talks to the broker in memory of test/native/mqtt_client.h, which
+// keeps retained messages and subscriptions and publishes the last will like
+// Mosquitto does. The latency it measures is the one of the bridge alone.
+#define PREFIX "test"
+#define DEFAULT_PREFIX "smart-relay"
+#define MAX_PUSH_LATENCY 100 // in ms
+#define TIMEOUT 2000         // in ms
+
+static RelayManager *relayManager;
+static Relay *relay;
+
+// relays/<id>/set of handleMqttCommand in main.cpp
+static String handleCommand(const String &topic, const char *payload, size_t length)
+{
+    if (!topic.startsWith("relays/") || !topic.endsWith("/set"))
+    {
+        return "";
+    }
+    SchedulerCommand command(SchedulerCommand::SET_RELAY);
+    command.relayId = topic.substring(7, topic.length() - 4).toInt();
+    command.state = String(payload, length) == "ON";
+    if (AlarmScheduler::getInstance()->submit(command) != SchedulerCommand::OK)
+    {
+        return "{\"status\":404,\"error\":\"Relay not found\"}";
+    }
+    return "";
+}
+
+template <typename F>
+static bool waitFor(F condition)
+{
+    uint32_t start = millis();
+    while (!condition())
+    {
+        if (millis() - start > TIMEOUT)
+        {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
+}
+
+static std::string relayTopic(Relay *relay)
+{
+    return PREFIX "/relays/" + std::to_string(relay->getId());
+}
+
+static bool relayStateIs(bool state)
+{
+    std::string payload = native::mqttBroker.retainedPayload(relayTopic(relay));
+    return payload.find(state ? "\"state\":true" : "\"state\":false") != std::string::npos;
+}
+
+// Messages the broker received on a topic since the given index of its log
+static std::vector<native::MqttMessage> messagesSince(size_t index, const std::string &topic)
+{
+    std::vector<native::MqttMessage> all = native::mqttBroker.messages();
+    std::vector<native::MqttMessage> result;
+    for (size_t i = index; i < all.size(); i++)
+    {
+        if (all[i].topic == topic)
+        {
+            result.push_back(all[i]);
+        }
+    }
+    return result;
+}
+
+static void setRelay(bool state)
+{
+    SchedulerCommand command(SchedulerCommand::SET_RELAY);
+    command.relayId = relay->getId();
+    command.state = state;
+    AlarmScheduler::getInstance()->submit(command);
+}
+
+static void fireAlarm(uint32_t unixtime)
+{
+    // Like the fire listener of main.cpp, on the scheduler task
+    AlarmScheduler::getInstance()->run([unixtime]()
+                                       {
+        Alarm alarm = relay->addAlarm(1, 2, 3, {true, true, true, true, true, true, true}, true);
+        MqttBridge::getInstance()->alarmFired({relay->getId(), alarm.getId(), alarm.getState(), unixtime}); });
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_publishes_the_status_and_retained_relay_states()
+{
+    TEST_ASSERT_TRUE(waitFor([]()
+                             { return MqttBridge::getInstance()->getStatus().connected; }));
+    TEST_ASSERT_TRUE(waitFor([]()
+                             { return native::mqttBroker.retainedPayload(PREFIX "/status") == "online"; }));
+    for (uint id : relayManager->getRelayIDs())
+    {
+        TEST_ASSERT_TRUE(waitFor([id]()
+                                 { return !native::mqttBroker.retainedPayload(relayTopic(relayManager->getRelayByID(id))).empty(); }));
+    }
+    std::string payload = native::mqttBroker.retainedPayload(relayTopic(relay));
+    TEST_ASSERT_TRUE(payload.find("\"name\":\"Relay 1\"") != std::string::npos);
+    TEST_ASSERT_TRUE(relayStateIs(false));
+}
+
+void test_set_commands_are_pushed_back_within_tens_of_ms()
+{
+    auto start = std::chrono::steady_clock::now();
+    native::mqttBroker.publish({relayTopic(relay) + "/set", "ON", false});
+    TEST_ASSERT_TRUE(waitFor([]()
+                             { return relayStateIs(true); }));
+    long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_LESS_THAN(MAX_PUSH_LATENCY, elapsed);
+    TEST_ASSERT_TRUE(relay->getState());
+
+    // Errors are published on the result topic
+    size_t index = native::mqttBroker.messages().size();
+    native::mqttBroker.publish({PREFIX "/relays/99/set", "ON", false});
+    TEST_ASSERT_TRUE(waitFor([index]()
+                             { return !messagesSince(index, PREFIX "/relays/99/set/result").empty(); }));
+    TEST_ASSERT_TRUE(messagesSince(index, PREFIX "/relays/99/set/result")[0].payload.find("\"status\":404") != std::string::npos);
+}
+
+void test_fired_alarms_are_published()
+{
+    size_t index = native::mqttBroker.messages().size();
+    fireAlarm(12345);
+    TEST_ASSERT_TRUE(waitFor([index]()
+                             { return !messagesSince(index, PREFIX "/alarm-fired").empty(); }));
+    native::MqttMessage message = messagesSince(index, PREFIX "/alarm-fired")[0];
+    TEST_ASSERT_FALSE(message.retain);
+    TEST_ASSERT_TRUE(message.payload.find("\"time\":12345") != std::string::npos);
+    TEST_ASSERT_TRUE(message.payload.find("\"relayId\":" + std::to_string(relay->getId())) != std::string::npos);
+}
+
+void test_messages_wait_while_the_broker_is_unreachable()
+{
+    MqttBridge *bridge = MqttBridge::getInstance();
+    native::mqttBroker.setReachable(false);
+    TEST_ASSERT_TRUE(waitFor([bridge]()
+                             { return !bridge->getStatus().connected; }));
+    // The last will
+    TEST_ASSERT_EQUAL_STRING("offline", native::mqttBroker.retainedPayload(PREFIX "/status").c_str());
+
+    size_t index = native::mqttBroker.messages().size();
+    setRelay(false);
+    fireAlarm(23456);
+    TEST_ASSERT_TRUE(waitFor([bridge]()
+                             { return bridge->getStatus().queued >= 2; }));
+    TEST_ASSERT_EQUAL(index, native::mqttBroker.messages().size());
+
+    native::mqttBroker.setReachable(true);
+    TEST_ASSERT_TRUE(waitFor([]()
+                             { return relayStateIs(false); }));
+    TEST_ASSERT_TRUE(waitFor([index]()
+                             { return !messagesSince(index, PREFIX "/alarm-fired").empty(); }));
+    TEST_ASSERT_TRUE(messagesSince(index, PREFIX "/alarm-fired")[0].payload.find("\"time\":23456") != std::string::npos);
+    TEST_ASSERT_EQUAL_STRING("online", native::mqttBroker.retainedPayload(PREFIX "/status").c_str());
+    TEST_ASSERT_TRUE(waitFor([bridge]()
+                             { return bridge->getStatus().queued == 0; }));
+    TEST_ASSERT_EQUAL(0, bridge->getStatus().dropped);
+}
+
+void test_erase_config_stops_the_bridge()
+{
+    MqttBridge *bridge = MqttBridge::getInstance();
+    bridge->eraseConfig();
+    TEST_ASSERT_TRUE(waitFor([]()
+                             { return native::mqttBroker.connectedClients() == 0; }));
+    MqttBridge::Settings settings = bridge->getSettings();
+    TEST_ASSERT_TRUE(settings.uri.isEmpty());
+    TEST_ASSERT_EQUAL_STRING(DEFAULT_PREFIX, settings.prefix.c_str());
+    TEST_ASSERT_FALSE(bridge->getStatus().connected);
+    TEST_ASSERT_EQUAL(0, bridge->getStatus().queued);
+
+    // Commands are no longer received
+    native::mqttBroker.publish({relayTopic(relay) + "/set", "ON", false});
+    delay(MAX_PUSH_LATENCY);
+    TEST_ASSERT_FALSE(relay->getState());
+}
+
+int main(int argc, char **argv)
+{
+    relayManager = new RelayManager();
+    relay = relayManager->addRelay(5, "Relay 1");
+    relayManager->addRelay(6, "Relay 2");
+    AlarmScheduler::getInstance()->begin(relayManager);
+
+    MqttBridge *bridge = MqttBridge::getInstance();
+    bridge->begin(AlarmScheduler::getInstance(), handleCommand, DEFAULT_PREFIX);
+    bridge->setSettings({"mqtt://localhost:1883", "", "", PREFIX});
+    bridge->setNetwork(true);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_publishes_the_status_and_retained_relay_states);
+    RUN_TEST(test_set_commands_are_pushed_back_within_tens_of_ms);
+    RUN_TEST(test_fired_alarms_are_published);
+    RUN_TEST(test_messages_wait_while_the_broker_is_unreachable);
+    RUN_TEST(test_erase_config_stops_the_bridge);
+    return UNITY_END();
+}
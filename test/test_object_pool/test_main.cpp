@@ -0,0 +1,156 @@
+#include <unity.h>
+#include "alarmScheduler.h"
+#include "alarmTable.h"
+#include "objectPool.h"
+#include "relayManager.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#define CYCLES 100000
+#define ALARMS_PER_RELAY 20
+#define CHECK_INTERVAL 10000
+
+// The host heap has no largest free block to watch. Counting what is allocated
+// shows the same thing: once the pools and tables are warm, a create/delete
+// cycle must leave the heap exactly as it found it.
+static std::atomic<size_t> heapBytes(0);
+static std::atomic<size_t> heapAllocations(0);
+
+struct alignas(std::max_align_t) Header
+{
+    size_t size;
+};
+
+void *operator new(size_t size)
+{
+    Header *header = static_cast<Header *>(malloc(sizeof(Header) + size));
+    if (header == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    heapBytes += size;
+    heapAllocations++;
+    return header + 1;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    Header *header = static_cast<Header *>(pointer) - 1;
+    heapBytes -= header->size;
+    free(header);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+static std::mt19937 rng(7);
+
+static Relay *addRelayWithAlarms(RelayManager &manager)
+{
+    Relay *relay = manager.addRelay(5, "Relay");
+    std::array<bool, 7> weekdays = {};
+    weekdays[rng() % 7] = true;
+    for (int i = 0; i < ALARMS_PER_RELAY; i++)
+    {
+        relay->addAlarm(rng() % 24, rng() % 60, rng() % 60, weekdays, rng() % 2);
+    }
+    return relay;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_cycles_keep_heap_stable()
+{
+    RelayManager manager;
+    AlarmTable *table = AlarmTable::getInstance();
+    AlarmScheduler *scheduler = AlarmScheduler::getInstance();
+
+    std::vector<uint> ids;
+    for (int i = 0; i < MAX_RELAYS; i++)
+    {
+        ids.push_back(addRelayWithAlarms(manager)->getId());
+    }
+
+    // Warm up, the scheduler heap and the id index reach their final capacity
+    for (int i = 0; i < 1000; i++)
+    {
+        size_t index = rng() % ids.size();
+        manager.removeRelayByID(ids[index]);
+        ids[index] = addRelayWithAlarms(manager)->getId();
+    }
+
+    size_t bytes = heapBytes;
+    size_t allocations = heapAllocations;
+    for (int cycle = 1; cycle <= CYCLES; cycle++)
+    {
+        size_t index = rng() % ids.size();
+        manager.removeRelayByID(ids[index]);
+        ids[index] = addRelayWithAlarms(manager)->getId();
+
+        if (cycle % CHECK_INTERVAL == 0)
+        {
+            TEST_ASSERT_EQUAL(MAX_RELAYS * ALARMS_PER_RELAY, table->size());
+            TEST_ASSERT_EQUAL(MAX_RELAYS * ALARMS_PER_RELAY, scheduler->size());
+            TEST_ASSERT_EQUAL(bytes, heapBytes.load());
+        }
+    }
+    // Relays, alarms and their indexes never touch the heap
+    TEST_ASSERT_EQUAL(allocations, heapAllocations.load());
+    TEST_ASSERT_LESS_OR_EQUAL(MAX_ALARMS, table->slotCount());
+}
+
+void test_pool_full_throws()
+{
+    RelayManager manager;
+    for (int i = 0; i < MAX_RELAYS; i++)
+    {
+        manager.addRelay(5, "Relay");
+    }
+
+    bool thrown = false;
+    try
+    {
+        manager.addRelay(5, "One too many");
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    TEST_ASSERT_TRUE(thrown);
+    TEST_ASSERT_EQUAL(MAX_RELAYS, manager.getRelayIDs().size());
+
+    // A freed slot is used again
+    manager.removeRelayByID(manager.getRelayIDs().front());
+    TEST_ASSERT_NOT_NULL(manager.addRelay(5, "Again"));
+}
+
+void test_pool_reuses_storage()
+{
+    ObjectPool<String, 2> pool;
+    String *first = pool.create("a");
+    String *second = pool.create("b");
+    pool.destroy(first);
+    String *third = pool.create("c");
+    TEST_ASSERT_TRUE(first == third);
+    TEST_ASSERT_EQUAL_STRING("b", second->c_str());
+    TEST_ASSERT_EQUAL_STRING("c", third->c_str());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_cycles_keep_heap_stable);
+    RUN_TEST(test_pool_full_throws);
+    RUN_TEST(test_pool_reuses_storage);
+    return UNITY_END();
+}
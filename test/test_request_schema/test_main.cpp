@@ -0,0 +1,286 @@
+#include <unity.h>
+#include "requestSchema.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+
+// The microbenchmarks compare with the validator the handlers used before, built
+// on ArduinoJson. Without the library only the schema decoder is measured
+#if __has_include(<ArduinoJson.h>)
+#include <ArduinoJson.h>
+#define BENCHMARK_LEGACY
+#endif
+
+#define BENCHMARK_ITERATIONS 100000
+
+static std::atomic<size_t> heapAllocations(0);
+
+struct alignas(std::max_align_t) Header
+{
+    size_t size;
+};
+
+void *operator new(size_t size)
+{
+    Header *header = static_cast<Header *>(malloc(sizeof(Header) + size));
+    if (header == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    heapAllocations++;
+    return header + 1;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (pointer != nullptr)
+    {
+        free(static_cast<Header *>(pointer) - 1);
+    }
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+// Bodies as main.cpp declares them
+struct RelayAlarmBody
+{
+    uint relayId = 0; // Only sent on creation and over MQTT
+    uint alarmId = 0; // Only sent over MQTT
+    bool state;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    std::array<bool, 7> weekdays;
+};
+constexpr SchemaField<RelayAlarmBody> createRelayAlarmSchema[] = {
+    SCHEMA_INT(RelayAlarmBody, relayId, 0, LONG_MAX),
+    SCHEMA_BOOL(RelayAlarmBody, state),
+    SCHEMA_INT(RelayAlarmBody, hour, 0, 23),
+    SCHEMA_INT(RelayAlarmBody, minute, 0, 59),
+    SCHEMA_INT(RelayAlarmBody, second, 0, 59),
+    SCHEMA_BOOLS(RelayAlarmBody, weekdays)};
+
+struct RelayNameBody
+{
+    uint id;
+    String name;
+};
+constexpr SchemaField<RelayNameBody> relayNameSchema[] = {
+    SCHEMA_INT(RelayNameBody, id, 0, LONG_MAX),
+    SCHEMA_STRING(RelayNameBody, name, 0, 255)};
+
+struct SettingsBody
+{
+    String systemName;
+    SchemaList<RelayNameBody, MAX_RELAYS> relays;
+    int8_t lowPower = -1; // -1 if not sent
+};
+constexpr SchemaField<SettingsBody> settingsSchema[] = {
+    SCHEMA_STRING(SettingsBody, systemName, 0, 255),
+    SCHEMA_LIST(SettingsBody, relays, relayNameSchema),
+    SCHEMA_OPTIONAL_BOOL(SettingsBody, lowPower)};
+
+struct ServerTimeBody
+{
+    int hourAdjustment;
+    int minuteAdjustment;
+    int secondAdjustment;
+    char date[11]; // YYYY-MM-DD
+};
+constexpr SchemaField<ServerTimeBody> serverTimeSchema[] = {
+    SCHEMA_INT(ServerTimeBody, hourAdjustment, -23, 23),
+    SCHEMA_INT(ServerTimeBody, minuteAdjustment, -59, 59),
+    SCHEMA_INT(ServerTimeBody, secondAdjustment, -59, 59),
+    SCHEMA_STRING(ServerTimeBody, date, 10, 10)};
+
+static const char *createAlarmRequest = "{\"relayId\":3,\"state\":true,\"hour\":6,\"minute\":5,\"second\":0,\"weekdays\":[true,false,true,false,true,false,true]}";
+
+// Error message and key, empty if the body was decoded
+template <typename T, size_t N>
+static std::string decode(const char *body, const SchemaField<T> (&schema)[N], T &target)
+{
+    BufferStream input(body, strlen(body));
+    JsonReader reader(input);
+    SchemaError error = decodeSchema(reader, schema, target);
+    return error.isError() ? std::string(error.message) + (error.key != nullptr ? error.key : "") : "";
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_decodes_typed_members()
+{
+    RelayAlarmBody alarm;
+    TEST_ASSERT_EQUAL_STRING("", decode("{\"relayId\":3,\"state\":true,\"hour\":6,\"minute\":5,\"second\":0,\"weekdays\":[true,false,true,false,true,false,true],\"x\":{\"y\":[1]}}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL(3, alarm.relayId);
+    TEST_ASSERT_TRUE(alarm.state);
+    TEST_ASSERT_EQUAL(6, alarm.hour);
+    TEST_ASSERT_EQUAL(5, alarm.minute);
+    TEST_ASSERT_TRUE(alarm.weekdays[2]);
+    TEST_ASSERT_FALSE(alarm.weekdays[1]);
+
+    SettingsBody settings;
+    TEST_ASSERT_EQUAL_STRING("", decode("{\"systemName\":\"Home\",\"relays\":[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\\u00e9\"}]}", settingsSchema, settings).c_str());
+    TEST_ASSERT_EQUAL_STRING("Home", settings.systemName.c_str());
+    TEST_ASSERT_EQUAL(2, settings.relays.count);
+    TEST_ASSERT_EQUAL(2, settings.relays.items[1].id);
+    TEST_ASSERT_EQUAL_STRING("b\xc3\xa9", settings.relays.items[1].name.c_str());
+    TEST_ASSERT_EQUAL(-1, settings.lowPower);
+
+    ServerTimeBody time;
+    TEST_ASSERT_EQUAL_STRING("", decode("{\"hourAdjustment\":-1,\"minuteAdjustment\":30,\"secondAdjustment\":0,\"date\":\"2024-05-06\"}", serverTimeSchema, time).c_str());
+    TEST_ASSERT_EQUAL(-1, time.hourAdjustment);
+    TEST_ASSERT_EQUAL(30, time.minuteAdjustment);
+    TEST_ASSERT_EQUAL_STRING("2024-05-06", time.date);
+}
+
+void test_rejects_values_out_of_range()
+{
+    RelayAlarmBody alarm;
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: hour", decode("{\"relayId\":3,\"state\":true,\"hour\":24,\"minute\":5,\"second\":0,\"weekdays\":[true,false,true,false,true,false,true]}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: relayId", decode("{\"relayId\":99999999999999999999999,\"state\":true}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: relayId", decode("{\"relayId\":-1}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: relayId", decode("{\"relayId\":\"1\"}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: weekdays", decode("{\"relayId\":1,\"state\":true,\"hour\":1,\"minute\":5,\"second\":0,\"weekdays\":[true]}", createRelayAlarmSchema, alarm).c_str());
+
+    SettingsBody settings;
+    // One relay more than the list holds
+    std::string relays;
+    for (int i = 0; i <= MAX_RELAYS; i++)
+    {
+        relays += std::string(i > 0 ? "," : "") + "{\"id\":1,\"name\":\"a\"}";
+    }
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: relays", decode(("{\"systemName\":\"Home\",\"relays\":[" + relays + "]}").c_str(), settingsSchema, settings).c_str());
+
+    ServerTimeBody time;
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: date", decode("{\"hourAdjustment\":-1,\"minuteAdjustment\":30,\"secondAdjustment\":0,\"date\":\"2024-05-066\"}", serverTimeSchema, time).c_str());
+}
+
+void test_reports_missing_keys_and_syntax_errors()
+{
+    RelayAlarmBody alarm;
+    TEST_ASSERT_EQUAL_STRING("Missing key: hour", decode("{\"relayId\":1,\"state\":true}", createRelayAlarmSchema, alarm).c_str());
+    TEST_ASSERT_EQUAL_STRING("Failed to parse JSON", decode("{\"relayId\":1,", createRelayAlarmSchema, alarm).c_str());
+
+    SettingsBody settings;
+    TEST_ASSERT_EQUAL_STRING("Invalid value for key: relays", decode("{\"systemName\":\"Home\",\"relays\":[{\"name\":\"a\"}]}", settingsSchema, settings).c_str());
+}
+
+void test_decoding_does_not_allocate()
+{
+    RelayAlarmBody alarm;
+    BufferStream input(createAlarmRequest, strlen(createAlarmRequest));
+    JsonReader reader(input);
+    size_t before = heapAllocations.load();
+    SchemaError error = decodeSchema(reader, createRelayAlarmSchema, alarm);
+    TEST_ASSERT_FALSE(error.isError());
+    TEST_ASSERT_EQUAL(before, heapAllocations.load());
+}
+
+#ifdef BENCHMARK_LEGACY
+// CreateJsonFromString of the handlers before the schemas, with the key map each one built
+static String legacyValidate(const String &body, const std::map<String, String> &requiredKeys, JsonDocument &doc)
+{
+    DeserializationError error = deserializeJson(doc, body.c_str(), body.length());
+    if (error)
+    {
+        return "Failed to parse JSON";
+    }
+
+    for (const auto &keyTypePair : requiredKeys)
+    {
+        const String &key = keyTypePair.first;
+        const String &type = keyTypePair.second;
+        JsonVariant value = doc[key.c_str()];
+
+        if (value.isNull())
+        {
+            return "Missing key: " + key;
+        }
+
+        if (type == "uint" && !value.is<uint>())
+        {
+            return "Invalid type for key: " + key;
+        }
+        else if (type == "bool" && !value.is<bool>())
+        {
+            return "Invalid type for key: " + key;
+        }
+        else if (type == "array_bool_7")
+        {
+            if (!value.is<JsonArray>() || value.size() != 7)
+            {
+                return "Invalid array size for key: " + key;
+            }
+            for (int i = 0; i < 7; i++)
+            {
+                if (!value[i].is<bool>())
+                {
+                    return "Invalid array element type for key: " + key;
+                }
+            }
+        }
+    }
+    return "";
+}
+#endif
+
+// Time and allocations per request, printed for comparison. Decoding must stay valid
+void test_benchmark_create_alarm_body()
+{
+    char message[120];
+    RelayAlarmBody alarm;
+    size_t allocations = heapAllocations.load();
+    auto start = std::chrono::steady_clock::now();
+    bool valid = true;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        BufferStream input(createAlarmRequest, strlen(createAlarmRequest));
+        JsonReader reader(input);
+        valid = valid && !decodeSchema(reader, createRelayAlarmSchema, alarm).isError();
+    }
+    long long nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    snprintf(message, sizeof(message), "decodeSchema: %lld ns, %zu allocations per request", nanos / BENCHMARK_ITERATIONS, (heapAllocations.load() - allocations) / BENCHMARK_ITERATIONS);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(valid);
+
+#ifdef BENCHMARK_LEGACY
+    allocations = heapAllocations.load();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        String body = createAlarmRequest;
+        std::map<String, String> requiredKeys = {
+            {"relayId", "uint"},
+            {"state", "bool"},
+            {"hour", "uint"},
+            {"minute", "uint"},
+            {"second", "uint"},
+            {"weekdays", "array_bool_7"}};
+        JsonDocument doc;
+        valid = valid && legacyValidate(body, requiredKeys, doc).isEmpty();
+    }
+    nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    snprintf(message, sizeof(message), "CreateJsonFromString: %lld ns, %zu allocations per request", nanos / BENCHMARK_ITERATIONS, (heapAllocations.load() - allocations) / BENCHMARK_ITERATIONS);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(valid);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_decodes_typed_members);
+    RUN_TEST(test_rejects_values_out_of_range);
+    RUN_TEST(test_reports_missing_keys_and_syntax_errors);
+    RUN_TEST(test_decoding_does_not_allocate);
+    RUN_TEST(test_benchmark_create_alarm_body);
+    return UNITY_END();
+}
@@ -0,0 +1,232 @@
+#include <unity.h>
+#include "alarmScheduler.h"
+#include "relayManager.h"
+#include "udpControl.h"
+#include "udpProtocol.h"
+#include <lwip/sockets.h>
+
+#define SESSION 777
+#define REPLY_TIMEOUT 200 // in ms, per attempt
+#define ATTEMPTS 10
+
+static const uint8_t key[UDP_KEY_SIZE] = {1, 2, 3};
+static const uint8_t wrongKey[UDP_KEY_SIZE] = {9};
+
+static RelayManager *relayManager;
+static Relay *relay;
+static int client = -1;
+static sockaddr_in device;
+static uint32_t nextSequence = 1;
+
+static void sendPacket(const UdpPacket &packet, const uint8_t *signingKey = key)
+{
+    uint8_t data[UDP_PACKET_SIZE];
+    encodeUdpPacket(packet, signingKey, data);
+    sendto(client, data, sizeof(data), 0, (sockaddr *)&device, sizeof(device));
+}
+
+// Next packet of the given type, false if none came within REPLY_TIMEOUT
+static bool receivePacket(uint8_t type, UdpPacket &packet)
+{
+    uint32_t start = millis();
+    while (millis() - start < REPLY_TIMEOUT)
+    {
+        uint8_t data[64];
+        int length = recv(client, data, sizeof(data), 0);
+        if (length > 0 && decodeUdpPacket(data, length, key, packet) && packet.type == type)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Resend until the reply arrives, like clients do. The first attempts may come before the socket is open
+static UdpPacket request(UdpPacket packet)
+{
+    packet.session = packet.session != 0 ? packet.session : SESSION;
+    UdpPacket reply;
+    for (int attempt = 0; attempt < ATTEMPTS; attempt++)
+    {
+        sendPacket(packet);
+        if (receivePacket(packet.type | UDP_REPLY, reply) && reply.sequence == packet.sequence)
+        {
+            return reply;
+        }
+    }
+    TEST_FAIL_MESSAGE("No reply");
+    return reply;
+}
+
+static UdpPacket setRelay(bool state)
+{
+    UdpPacket packet;
+    packet.type = UdpPacket::SET_RELAY;
+    packet.sequence = nextSequence++;
+    packet.relayId = relay->getId();
+    packet.state = state;
+    return request(packet);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_hello_returns_the_session()
+{
+    UdpPacket hello;
+    hello.type = UdpPacket::HELLO;
+    UdpPacket reply = request(hello);
+    TEST_ASSERT_EQUAL(UdpPacket::OK, reply.status);
+    TEST_ASSERT_EQUAL(SESSION, reply.session);
+    TEST_ASSERT_EQUAL(1, reply.value);
+}
+
+void test_set_relay_switches_in_single_digit_milliseconds()
+{
+    UdpPacket reply = setRelay(true);
+    TEST_ASSERT_EQUAL(UdpPacket::OK, reply.status);
+    TEST_ASSERT_TRUE(reply.state);
+    TEST_ASSERT_LESS_THAN(10000, reply.value);
+    TEST_ASSERT_EQUAL(reply.value, UdpControl::getInstance()->getLastLatency());
+
+    UdpPacket get;
+    get.type = UdpPacket::GET_RELAY;
+    get.sequence = nextSequence++;
+    get.relayId = relay->getId();
+    reply = request(get);
+    TEST_ASSERT_EQUAL(UdpPacket::OK, reply.status);
+    TEST_ASSERT_TRUE(reply.state);
+
+    get.sequence = nextSequence++;
+    get.relayId = 99;
+    TEST_ASSERT_EQUAL(UdpPacket::RELAY_NOT_FOUND, request(get).status);
+}
+
+void test_repeated_requests_are_answered_but_not_executed()
+{
+    UdpPacket packet;
+    packet.type = UdpPacket::SET_RELAY;
+    packet.sequence = nextSequence++;
+    packet.relayId = relay->getId();
+    packet.state = false;
+    UdpPacket first = request(packet);
+    TEST_ASSERT_EQUAL(UdpPacket::OK, first.status);
+
+    // Switched on meanwhile, the resent request must not switch it off again
+    SchedulerCommand on(SchedulerCommand::SET_RELAY);
+    on.relayId = relay->getId();
+    on.state = true;
+    AlarmScheduler::getInstance()->submit(on);
+
+    UdpPacket again = request(packet);
+    TEST_ASSERT_EQUAL(first.value, again.value);
+    TEST_ASSERT_FALSE(again.state);
+    TEST_ASSERT_TRUE(relay->getState());
+
+    packet.sequence--;
+    UdpPacket stale = request(packet);
+    TEST_ASSERT_EQUAL(UdpPacket::STALE_SEQUENCE, stale.status);
+    TEST_ASSERT_EQUAL(nextSequence, stale.value);
+}
+
+void test_rejects_other_sessions_and_keys()
+{
+    UdpPacket packet;
+    packet.type = UdpPacket::GET_RELAY;
+    packet.sequence = nextSequence++;
+    packet.session = SESSION + 1;
+    packet.relayId = relay->getId();
+    UdpPacket reply = request(packet);
+    TEST_ASSERT_EQUAL(UdpPacket::BAD_SESSION, reply.status);
+    TEST_ASSERT_EQUAL(SESSION, reply.session);
+
+    // Packets signed with another key are dropped without a reply
+    packet.session = SESSION;
+    packet.sequence = nextSequence++;
+    sendPacket(packet, wrongKey);
+    TEST_ASSERT_FALSE(receivePacket(UdpPacket::GET_RELAY | UDP_REPLY, reply));
+}
+
+void test_alarm_events_are_resent_until_acknowledged()
+{
+    UdpPacket subscribe;
+    subscribe.type = UdpPacket::SUBSCRIBE;
+    subscribe.sequence = nextSequence++;
+    TEST_ASSERT_EQUAL(UDP_CONTROL_LEASE, request(subscribe).value);
+
+    // Like the fire listener of main.cpp, on the scheduler task
+    uint alarmId = 0;
+    AlarmScheduler::getInstance()->run([&]()
+                                       {
+        Alarm alarm = relay->addAlarm(1, 2, 3, {true, true, true, true, true, true, true}, true);
+        alarmId = alarm.getId();
+        UdpControl::getInstance()->alarmFired({relay->getId(), alarm.getId(), alarm.getState(), 12345}); });
+
+    UdpPacket event;
+    TEST_ASSERT_TRUE(receivePacket(UdpPacket::ALARM_FIRED, event));
+    TEST_ASSERT_EQUAL(relay->getId(), event.relayId);
+    TEST_ASSERT_EQUAL(alarmId, event.alarmId);
+    TEST_ASSERT_TRUE(event.state);
+    TEST_ASSERT_EQUAL(12345, event.value);
+
+    UdpPacket resent;
+    TEST_ASSERT_TRUE(receivePacket(UdpPacket::ALARM_FIRED, resent));
+    TEST_ASSERT_EQUAL(event.sequence, resent.sequence);
+
+    UdpPacket ack;
+    ack.type = UdpPacket::EVENT_ACK;
+    ack.session = SESSION;
+    ack.sequence = event.sequence;
+    sendPacket(ack);
+    delay(REPLY_TIMEOUT);
+    // A resend may have crossed the acknowledgement
+    while (receivePacket(UdpPacket::ALARM_FIRED, resent))
+    {
+    }
+    TEST_ASSERT_FALSE(receivePacket(UdpPacket::ALARM_FIRED, resent));
+}
+
+void test_no_replies_without_a_key()
+{
+    UdpControl *control = UdpControl::getInstance();
+    control->setKey(nullptr);
+    delay(UDP_CONTROL_POLL * 5);
+
+    UdpPacket hello;
+    hello.type = UdpPacket::HELLO;
+    sendPacket(hello);
+    UdpPacket reply;
+    TEST_ASSERT_FALSE(receivePacket(UdpPacket::HELLO | UDP_REPLY, reply));
+
+    control->setKey(key);
+    TEST_ASSERT_EQUAL(SESSION, request(hello).session);
+}
+
+int main(int argc, char **argv)
+{
+    relayManager = new RelayManager();
+    relay = relayManager->addRelay(5, "Relay");
+    AlarmScheduler::getInstance()->begin(relayManager);
+
+    UdpControl *control = UdpControl::getInstance();
+    control->begin(AlarmScheduler::getInstance(), SESSION);
+    control->setKey(key);
+    control->setNetwork(true);
+
+    client = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval timeout = {0, 20000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    device = {};
+    device.sin_family = AF_INET;
+    device.sin_port = htons(UDP_CONTROL_PORT);
+    device.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_hello_returns_the_session);
+    RUN_TEST(test_set_relay_switches_in_single_digit_milliseconds);
+    RUN_TEST(test_repeated_requests_are_answered_but_not_executed);
+    RUN_TEST(test_rejects_other_sessions_and_keys);
+    RUN_TEST(test_alarm_events_are_resent_until_acknowledged);
+    RUN_TEST(test_no_replies_without_a_key);
+    return UNITY_END();
+}